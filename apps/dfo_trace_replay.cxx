@@ -0,0 +1,378 @@
+/**
+ * @file dfo_trace_replay.cxx
+ *
+ * Offline replay of a trace recorded by the DFOModule (see the trace_file
+ * attribute of DFOConf). The TriggerDecisions of the trace are assigned again
+ * with a chosen policy and busy thresholds, to a set of simulated dataflow
+ * applications. The resulting deadtime and completion latency are compared
+ * with the ones of the recorded run.
+ *
+ * Each decision keeps the processing time it had in the recorded run, taken
+ * as the time between its assignment and its completion. Applications
+ * process their decisions either all in parallel or, with --workers, with a
+ * limited number of workers and a FIFO queue.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/DFOTrace.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace dunedaq::dfmodules;
+
+namespace {
+
+struct ReplayOptions
+{
+  std::string trace_file;
+  std::string policy = "round-robin"; // round-robin, least-slots or least-bytes
+  size_t busy_threshold = 5;
+  size_t free_threshold = 3;
+  size_t n_apps = 0;  // 0 means as many as in the trace
+  size_t workers = 0; // 0 means no limit
+};
+
+void
+print_usage(const char* name)
+{
+  std::cout << "Usage: " << name << " <trace file> [options]\n"
+            << "  --policy <p>   round-robin, least-slots or least-bytes (default round-robin)\n"
+            << "  --busy <n>     busy threshold of each application (default 5)\n"
+            << "  --free <n>     free threshold of each application (default 3)\n"
+            << "  --apps <n>     number of applications (default: as in the trace)\n"
+            << "  --workers <n>  decisions processed in parallel by an application, 0 for no limit (default 0)\n";
+}
+
+bool
+parse_options(int argc, char** argv, ReplayOptions& opts)
+{
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto next = [&]() -> std::string {
+      if (i + 1 >= argc)
+        throw std::invalid_argument("missing value for " + arg);
+      return argv[++i];
+    };
+    if (arg == "--policy")
+      opts.policy = next();
+    else if (arg == "--busy")
+      opts.busy_threshold = std::stoul(next());
+    else if (arg == "--free")
+      opts.free_threshold = std::stoul(next());
+    else if (arg == "--apps")
+      opts.n_apps = std::stoul(next());
+    else if (arg == "--workers")
+      opts.workers = std::stoul(next());
+    else if (opts.trace_file.empty() && arg.rfind("--", 0) != 0)
+      opts.trace_file = arg;
+    else
+      return false;
+  }
+  return !opts.trace_file.empty() && opts.free_threshold <= opts.busy_threshold && opts.busy_threshold > 0 &&
+         (opts.policy == "round-robin" || opts.policy == "least-slots" || opts.policy == "least-bytes");
+}
+
+/**
+ * @brief What is known of one decision from the trace
+ */
+struct TracedDecision
+{
+  uint64_t trigger_number = 0; // NOLINT(build/unsigned)
+  int64_t received_ns = -1;
+  int64_t assigned_ns = -1;
+  int64_t completed_ns = -1;
+  uint64_t bytes = 0; // NOLINT(build/unsigned)
+
+  bool complete() const { return received_ns >= 0 && assigned_ns >= 0 && completed_ns >= assigned_ns; }
+  int64_t processing_ns() const { return completed_ns - assigned_ns; }
+};
+
+struct Trace
+{
+  std::vector<TracedDecision> decisions; // complete ones, in order of arrival
+  size_t n_apps = 0;
+  size_t incomplete = 0;
+  int64_t busy_ns = 0;
+  size_t busy_transitions = 0;
+  int64_t end_ns = 0;
+};
+
+Trace
+read_trace(const std::string& file_name)
+{
+  DFOTraceReader reader(file_name);
+  std::map<uint64_t, TracedDecision> decisions; // NOLINT(build/unsigned)
+  Trace trace;
+  int64_t busy_since = -1;
+
+  DFOTraceRecord rec;
+  while (reader.next(rec)) {
+    trace.end_ns = std::max(trace.end_ns, rec.time_ns);
+    switch (rec.type) {
+      case DFOTraceRecord::kDecision:
+        decisions[rec.trigger_number].trigger_number = rec.trigger_number;
+        decisions[rec.trigger_number].received_ns = rec.time_ns;
+        break;
+      case DFOTraceRecord::kAssignment:
+        decisions[rec.trigger_number].assigned_ns = rec.time_ns;
+        decisions[rec.trigger_number].bytes = rec.bytes;
+        break;
+      case DFOTraceRecord::kCompletion:
+        decisions[rec.trigger_number].completed_ns = rec.time_ns;
+        break;
+      case DFOTraceRecord::kBusy:
+        if (rec.app && busy_since < 0) {
+          busy_since = rec.time_ns;
+          ++trace.busy_transitions;
+        } else if (!rec.app && busy_since >= 0) {
+          trace.busy_ns += rec.time_ns - busy_since;
+          busy_since = -1;
+        }
+        break;
+      default:
+        break;
+    }
+  }
+  if (busy_since >= 0)
+    trace.busy_ns += trace.end_ns - busy_since;
+
+  trace.n_apps = reader.get_app_names().size();
+  for (auto& [trigger_number, decision] : decisions) {
+    if (decision.complete())
+      trace.decisions.push_back(decision);
+    else
+      ++trace.incomplete;
+  }
+  std::stable_sort(trace.decisions.begin(), trace.decisions.end(), [](const auto& a, const auto& b) {
+    return a.received_ns < b.received_ns;
+  });
+  return trace;
+}
+
+/**
+ * @brief Simulated dataflow application, with the same busy logic as TriggerRecordBuilderData
+ */
+struct SimulatedApp
+{
+  size_t used_slots = 0;
+  uint64_t outstanding_bytes = 0; // NOLINT(build/unsigned)
+  bool busy = false;
+  size_t running = 0;
+  std::deque<size_t> waiting; // indices of decisions waiting for a worker
+  size_t assigned = 0;
+};
+
+struct ReplayResult
+{
+  size_t accepted = 0;
+  size_t inhibited = 0;
+  int64_t busy_ns = 0;
+  size_t busy_transitions = 0;
+  int64_t duration_ns = 0;
+  std::vector<double> latencies_us; // from arrival to completion
+  std::vector<size_t> assigned_per_app;
+};
+
+ReplayResult
+replay(const Trace& trace, const ReplayOptions& opts)
+{
+  ReplayResult result;
+  std::vector<SimulatedApp> apps(opts.n_apps);
+
+  // completion time, application, decision index
+  using completion_t = std::tuple<int64_t, size_t, size_t>;
+  std::priority_queue<completion_t, std::vector<completion_t>, std::greater<completion_t>> completions;
+
+  bool dfo_busy = false;
+  int64_t busy_since = 0;
+  size_t last_app = opts.n_apps - 1;
+
+  auto update_dfo_busy = [&](int64_t now) {
+    bool busy = std::all_of(apps.begin(), apps.end(), [](const SimulatedApp& a) { return a.busy; });
+    if (busy && !dfo_busy) {
+      busy_since = now;
+      ++result.busy_transitions;
+    } else if (!busy && dfo_busy) {
+      result.busy_ns += now - busy_since;
+    }
+    dfo_busy = busy;
+  };
+
+  auto start_if_possible = [&](size_t app_index, int64_t now) {
+    auto& app = apps[app_index];
+    while (!app.waiting.empty() && (opts.workers == 0 || app.running < opts.workers)) {
+      auto index = app.waiting.front();
+      app.waiting.pop_front();
+      ++app.running;
+      completions.emplace(now + trace.decisions[index].processing_ns(), app_index, index);
+    }
+  };
+
+  auto complete_until = [&](int64_t time) {
+    while (!completions.empty() && std::get<0>(completions.top()) <= time) {
+      auto [now, app_index, index] = completions.top();
+      completions.pop();
+      auto& app = apps[app_index];
+      --app.running;
+      --app.used_slots;
+      app.outstanding_bytes -= trace.decisions[index].bytes;
+      if (app.used_slots < opts.free_threshold)
+        app.busy = false;
+      result.latencies_us.push_back((now - trace.decisions[index].received_ns) / 1000.);
+      start_if_possible(app_index, now);
+      update_dfo_busy(now);
+    }
+  };
+
+  auto choose = [&]() -> size_t {
+    size_t best = opts.n_apps;
+    for (size_t step = 1; step <= opts.n_apps; ++step) {
+      size_t candidate = (last_app + step) % opts.n_apps;
+      if (apps[candidate].busy)
+        continue;
+      if (opts.policy == "round-robin")
+        return candidate;
+      if (best == opts.n_apps) {
+        best = candidate;
+      } else if (opts.policy == "least-slots" ? apps[candidate].used_slots < apps[best].used_slots
+                                              : std::tie(apps[candidate].outstanding_bytes, apps[candidate].used_slots) <
+                                                  std::tie(apps[best].outstanding_bytes, apps[best].used_slots)) {
+        best = candidate;
+      }
+    }
+    return best;
+  };
+
+  for (size_t index = 0; index < trace.decisions.size(); ++index) {
+    const auto& decision = trace.decisions[index];
+    complete_until(decision.received_ns);
+
+    if (dfo_busy) {
+      // the trigger would have been inhibited
+      ++result.inhibited;
+      continue;
+    }
+
+    auto app_index = choose();
+    auto& app = apps[app_index];
+    last_app = app_index;
+    ++app.used_slots;
+    ++app.assigned;
+    app.outstanding_bytes += decision.bytes;
+    if (app.used_slots >= opts.busy_threshold)
+      app.busy = true;
+    ++result.accepted;
+
+    app.waiting.push_back(index);
+    start_if_possible(app_index, decision.received_ns);
+    update_dfo_busy(decision.received_ns);
+  }
+  complete_until(std::numeric_limits<int64_t>::max());
+
+  int64_t start = trace.decisions.empty() ? 0 : trace.decisions.front().received_ns;
+  int64_t end = trace.decisions.empty() ? 0 : trace.decisions.back().received_ns;
+  result.duration_ns = end - start;
+  if (dfo_busy)
+    result.busy_ns += end - busy_since;
+
+  for (const auto& app : apps)
+    result.assigned_per_app.push_back(app.assigned);
+  return result;
+}
+
+double
+percentile(std::vector<double>& values, double p)
+{
+  if (values.empty())
+    return 0.;
+  auto index = static_cast<size_t>(p * (values.size() - 1));
+  std::nth_element(values.begin(), values.begin() + index, values.end());
+  return values[index];
+}
+
+void
+print_latencies(std::vector<double>& latencies)
+{
+  std::cout << "p50 " << percentile(latencies, 0.5) << ", p90 " << percentile(latencies, 0.9) << ", p99 "
+            << percentile(latencies, 0.99) << ", max " << percentile(latencies, 1.) << " us\n";
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+  ReplayOptions opts;
+  try {
+    if (!parse_options(argc, argv, opts)) {
+      print_usage(argv[0]);
+      return 1;
+    }
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  Trace trace;
+  try {
+    trace = read_trace(opts.trace_file);
+  } catch (const dunedaq::dfmodules::DFOTraceFileProblem& e) {
+    std::cerr << e.what() << std::endl;
+    return 2;
+  }
+  if (opts.n_apps == 0)
+    opts.n_apps = trace.n_apps;
+  if (opts.n_apps == 0 || trace.decisions.empty()) {
+    std::cerr << "Nothing to replay in " << opts.trace_file << std::endl;
+    return 2;
+  }
+
+  double trace_duration = trace.decisions.back().received_ns - trace.decisions.front().received_ns;
+  std::vector<double> recorded_latencies;
+  for (const auto& decision : trace.decisions)
+    recorded_latencies.push_back((decision.completed_ns - decision.received_ns) / 1000.);
+
+  auto result = replay(trace, opts);
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "Trace " << opts.trace_file << ": " << trace.decisions.size() << " complete decisions ("
+            << trace.incomplete << " incomplete ignored), " << trace.n_apps << " applications\n";
+  std::cout << "Recorded run:\n";
+  std::cout << "  busy fraction:     " << std::setprecision(4)
+            << (trace_duration > 0 ? trace.busy_ns / trace_duration : 0.) << " (" << trace.busy_transitions
+            << " busy transitions)\n"
+            << std::setprecision(1);
+  std::cout << "  latency:           ";
+  print_latencies(recorded_latencies);
+
+  std::cout << "Replay with policy " << opts.policy << ", busy/free thresholds " << opts.busy_threshold << "/"
+            << opts.free_threshold << ", " << opts.n_apps << " applications, "
+            << (opts.workers ? std::to_string(opts.workers) : std::string("unlimited")) << " workers:\n";
+  std::cout << "  accepted:          " << result.accepted << ", inhibited " << result.inhibited << "\n";
+  std::cout << "  busy fraction:     " << std::setprecision(4)
+            << (result.duration_ns > 0 ? static_cast<double>(result.busy_ns) / result.duration_ns : 0.) << " ("
+            << result.busy_transitions << " busy transitions)\n"
+            << std::setprecision(1);
+  std::cout << "  latency:           ";
+  print_latencies(result.latencies_us);
+  for (size_t i = 0; i < result.assigned_per_app.size(); ++i) {
+    std::cout << "  app " << i << " assigned:    " << result.assigned_per_app[i] << "\n";
+  }
+  return 0;
+}
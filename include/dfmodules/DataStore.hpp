@@ -27,10 +27,17 @@
 
 #include "nlohmann/json.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cstddef>
+#include <exception>
+#include <functional>
+#include <future>
 #include <memory>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #ifndef EXTERN_C_FUNC_DECLARE_START
@@ -123,12 +130,120 @@ public:
    */
   virtual void write(const daqdataformats::TriggerRecord& tr) = 0;
 
+  /**
+   * @brief Writes several TriggerRecords into the DataStore, in order.
+   * Implementations can do the per-write bookkeeping once for the whole batch.
+   * If a problem occurs after some of the records have been written, their
+   * number is returned and the problem is left to be reported by the next
+   * call for the remaining records. Exceptions are thrown only when no record
+   * could be written.
+   * @param records TriggerRecords to write.
+   * @return the number of records written, from the front of records
+   */
+  virtual size_t write_batch(const std::vector<const daqdataformats::TriggerRecord*>& records)
+  {
+    for (size_t i = 0; i < records.size(); ++i) {
+      try {
+        write(*records[i]);
+      } catch (const std::exception&) {
+        if (i == 0)
+          throw;
+        return i;
+      }
+    }
+    return records.size();
+  }
+
   /**
    * @brief Writes the TimeSlice into the DataStore.
    * @param ts TimeSlice to write.
    */
   virtual void write(const daqdataformats::TimeSlice& ts) = 0;
 
+  /**
+   * @brief Retry parameters of the asynchronous writes. After a
+   * RetryableDataStoreProblem, the write is attempted again after min_wait,
+   * the wait being multiplied by increase_factor for each further attempt, up
+   * to max_wait.
+   */
+  struct RetryPolicy
+  {
+    std::chrono::microseconds min_wait{ 1000 };
+    std::chrono::microseconds max_wait{ 1000000 };
+    int increase_factor{ 2 };
+  };
+
+  /**
+   * @brief Called when an asynchronous write has completed, with nullptr when
+   * it succeeded or with the problem that stopped it. It is called from the
+   * thread doing the write and must not throw.
+   */
+  using write_callback_t = std::function<void(std::exception_ptr)>;
+
+  /**
+   * @brief Called with each failed attempt of an asynchronous write that is
+   * going to be retried, so that the caller can report it with its own
+   * context. It is called from the thread doing the write and must not throw.
+   * Without it, the DataStore reports the problem itself.
+   */
+  using retry_callback_t = std::function<void(const RetryableDataStoreProblem&)>;
+
+  /**
+   * @brief Writes the TriggerRecord into the DataStore asynchronously.
+   * The DataStore keeps the record until it has been written, retrying the
+   * write according to the RetryPolicy while retries are enabled. The
+   * returned future becomes ready, after on_completion has been called, when
+   * the write has succeeded or has been given up; it then rethrows the problem.
+   * This default implementation writes before returning, in the calling
+   * thread, so that DataStores without their own queue can be used this way.
+   * Asynchronous writes should not be mixed with concurrent calls to write().
+   * @param tr TriggerRecord to write.
+   * @param on_completion optional callback, see write_callback_t.
+   * @param on_retry optional callback, see retry_callback_t.
+   */
+  virtual std::future<void> write_async(std::shared_ptr<const daqdataformats::TriggerRecord> tr,
+                                        write_callback_t on_completion = nullptr,
+                                        retry_callback_t on_retry = nullptr)
+  {
+    std::promise<void> promise;
+    auto future = promise.get_future();
+    complete_write([this, &tr]() { write(*tr); }, on_completion, on_retry, promise);
+    return future;
+  }
+
+  /**
+   * @brief Writes the TimeSlice into the DataStore asynchronously, see the
+   * TriggerRecord version.
+   */
+  virtual std::future<void> write_async(std::shared_ptr<const daqdataformats::TimeSlice> ts,
+                                        write_callback_t on_completion = nullptr,
+                                        retry_callback_t on_retry = nullptr)
+  {
+    std::promise<void> promise;
+    auto future = promise.get_future();
+    complete_write([this, &ts]() { write(*ts); }, on_completion, on_retry, promise);
+    return future;
+  }
+
+  /**
+   * @brief Waits until all the asynchronous writes requested so far have
+   * completed. finish_with_run() is expected to do this before closing anything.
+   */
+  virtual void wait_for_async_writes() {}
+
+  /**
+   * @brief Sets the retry parameters of the asynchronous writes, to be called
+   * before any of them is requested.
+   */
+  void set_retry_policy(const RetryPolicy& policy) { m_retry_policy = policy; }
+
+  /**
+   * @brief Enables or disables the retries of the asynchronous writes. When
+   * disabled, for instance at the end of a run, writes in progress give up at
+   * their next RetryableDataStoreProblem and new writes are attempted once.
+   */
+  void enable_retries(bool enabled) { m_retries_enabled = enabled; }
+
   /**
    * @brief Informs the DataStore that writes or reads of data blocks associated
    * with the specified run number will soon be requested.
@@ -146,7 +261,54 @@ public:
    */
   virtual void finish_with_run(daqdataformats::run_number_t run_number) = 0;
 
+protected:
+  /**
+   * @brief Runs write_once, retrying it according to the RetryPolicy, then
+   * reports the outcome to on_completion and promise. Each attempt that is
+   * retried is reported to on_retry. Meant for the implementations of
+   * write_async.
+   */
+  void complete_write(const std::function<void()>& write_once,
+                      const write_callback_t& on_completion,
+                      const retry_callback_t& on_retry,
+                      std::promise<void>& promise) const
+  {
+    std::exception_ptr problem;
+    auto wait = m_retry_policy.min_wait;
+    while (true) {
+      try {
+        write_once();
+        break;
+      } catch (const RetryableDataStoreProblem& excpt) {
+        if (!m_retries_enabled.load()) {
+          problem = std::current_exception();
+          break;
+        }
+        if (on_retry)
+          on_retry(excpt);
+        else
+          ers::error(excpt);
+        std::this_thread::sleep_for(std::min(wait, m_retry_policy.max_wait));
+        wait = std::min(wait * m_retry_policy.increase_factor, m_retry_policy.max_wait);
+      } catch (...) { // NOLINT(runtime/exceptions)
+        // NOLINT here because the exception is handed over to the caller
+        problem = std::current_exception();
+        break;
+      }
+    }
+
+    if (on_completion)
+      on_completion(problem);
+    if (problem)
+      promise.set_exception(problem);
+    else
+      promise.set_value();
+  }
+
 private:
+  RetryPolicy m_retry_policy;
+  std::atomic<bool> m_retries_enabled{ true };
+
   DataStore(const DataStore&) = delete;
   DataStore& operator=(const DataStore&) = delete;
   DataStore(DataStore&&) = delete;
@@ -0,0 +1,65 @@
+/**
+ * @file TriggerDecisionTokenBatch.hpp
+ *
+ * A TriggerDecisionTokenBatch carries the completion of several
+ * TriggerDecisions from a single dataflow application to the DFO in one message,
+ * together with the size of the data received for them.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef DFMODULES_INCLUDE_DFMODULES_TRIGGERDECISIONTOKENBATCH_HPP_
+#define DFMODULES_INCLUDE_DFMODULES_TRIGGERDECISIONTOKENBATCH_HPP_
+
+#include "daqdataformats/SourceID.hpp"
+#include "dfmessages/ComponentRequest.hpp"
+#include "dfmessages/Types.hpp"
+#include "serialization/Serialization.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dunedaq {
+namespace dfmodules {
+
+/**
+ * @brief Bytes received from one SourceID for a completed trigger
+ */
+struct FragmentVolume
+{
+  dfmessages::trigger_number_t trigger_number{ dfmessages::TypeDefaults::s_invalid_trigger_number };
+  daqdataformats::SourceID source_id;
+  uint64_t bytes{ 0 }; // NOLINT(build/unsigned)
+
+  DUNE_DAQ_SERIALIZE(FragmentVolume, trigger_number, source_id, bytes);
+};
+
+/**
+ * @brief Batched equivalent of dfmessages::TriggerDecisionToken.
+ *
+ * A batch with run_number 0 and no trigger numbers announces the
+ * sending application to the DFO, like the (0, 0) TriggerDecisionToken does.
+ * The fragment volumes, when reported, are those of one of the completed
+ * triggers of the batch, sampled by the writer. The DFO uses them to learn
+ * the expected size of future TriggerRecords.
+ */
+struct TriggerDecisionTokenBatch
+{
+  dfmessages::run_number_t run_number{ dfmessages::TypeDefaults::s_invalid_run_number };
+  std::vector<dfmessages::trigger_number_t> trigger_numbers;
+  std::string decision_destination;
+  std::vector<FragmentVolume> fragment_volumes;
+
+  DUNE_DAQ_SERIALIZE(TriggerDecisionTokenBatch, run_number, trigger_numbers, decision_destination, fragment_volumes);
+};
+
+} // namespace dfmodules
+
+DUNE_DAQ_SERIALIZABLE(dfmodules::TriggerDecisionTokenBatch, "TriggerDecisionTokenBatch");
+
+} // namespace dunedaq
+
+#endif // DFMODULES_INCLUDE_DFMODULES_TRIGGERDECISIONTOKENBATCH_HPP_
@@ -16,15 +16,20 @@
 #include "iomanager/IOManager.hpp"
 #include "logging/Logging.hpp"
 
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
 #include <cstdlib>
 #include <future>
 #include <limits>
 #include <list>
 #include <map>
 #include <memory>
+#include <optional>
+#include <sstream>
 #include <string>
 #include <thread>
+#include <tuple>
 #include <utility>
 #include <vector>
 
@@ -47,8 +52,15 @@ namespace dunedaq::dfmodules {
 
 DFOModule::DFOModule(const std::string& name)
   : dunedaq::appfwk::DAQModule(name)
+  , m_occupancy(std::make_shared<DataflowOccupancy>())
   , m_queue_timeout(100)
   , m_run_number(0)
+  , m_decision_thread(std::bind(&DFOModule::do_receive_decisions, this, std::placeholders::_1))
+  , m_busy_thread(std::bind(&DFOModule::do_busy_evaluation, this, std::placeholders::_1))
+  , m_reclaim_thread(std::bind(&DFOModule::do_reclaim_stale_assignments, this, std::placeholders::_1))
+  , m_assignment_max_age(0)
+  , m_health_thread(std::bind(&DFOModule::do_health_evaluation, this, std::placeholders::_1))
+  , m_health_period(0)
 {
   register_command("conf", &DFOModule::do_conf);
   register_command("start", &DFOModule::do_start);
@@ -71,6 +83,9 @@ DFOModule::init(std::shared_ptr<appfwk::ModuleConfiguration> mcfg)
     if (con->get_data_type() == datatype_to_string<dfmessages::TriggerDecisionToken>()) {
       m_token_connection = con->UID();
     }
+    if (con->get_data_type() == datatype_to_string<TriggerDecisionTokenBatch>()) {
+      m_token_batch_connection = con->UID();
+    }
     if (con->get_data_type() == datatype_to_string<dfmessages::TriggerDecision>()) {
       m_td_connection = con->UID();
     }
@@ -81,7 +96,7 @@ DFOModule::init(std::shared_ptr<appfwk::ModuleConfiguration> mcfg)
     }
   }
 
-  if (m_token_connection == "") {
+  if (m_token_connection == "" && m_token_batch_connection == "") {
     throw appfwk::MissingConnection(
       ERS_HERE, get_name(), datatype_to_string<dfmessages::TriggerDecisionToken>(), "input");
   }
@@ -95,7 +110,12 @@ DFOModule::init(std::shared_ptr<appfwk::ModuleConfiguration> mcfg)
 
   m_dfo_conf = mdal->get_configuration();
   // these are just tests to check if the connections are ok
-  iom->get_receiver<dfmessages::TriggerDecisionToken>(m_token_connection);
+  if (m_token_connection != "") {
+    iom->get_receiver<dfmessages::TriggerDecisionToken>(m_token_connection);
+  }
+  if (m_token_batch_connection != "") {
+    iom->get_receiver<TriggerDecisionTokenBatch>(m_token_batch_connection);
+  }
   iom->get_receiver<dfmessages::TriggerDecision>(m_td_connection);
 
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting init() method";
@@ -107,14 +127,34 @@ DFOModule::do_conf(const data_t&)
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_conf() method";
 
   m_queue_timeout = std::chrono::milliseconds(m_dfo_conf->get_general_queue_timeout_ms());
-  m_stop_timeout = std::chrono::microseconds(m_dfo_conf->get_stop_timeout_ms());
+  m_stop_timeout = std::chrono::milliseconds(m_dfo_conf->get_stop_timeout_ms());
   m_busy_threshold = m_dfo_conf->get_busy_threshold();
   m_free_threshold = m_dfo_conf->get_free_threshold();
+  m_completion_sampling = m_dfo_conf->get_completion_event_fraction();
 
   m_td_send_retries = m_dfo_conf->get_td_send_retries();
+  m_volume_aware_assignment = m_dfo_conf->get_volume_aware_assignment();
+  m_decision_batch_size = std::max<size_t>(m_dfo_conf->get_decision_batch_size(), 1);
+  m_decision_batch.reserve(m_decision_batch_size);
+  m_assignment_max_age = std::chrono::milliseconds(m_dfo_conf->get_assignment_max_age_ms());
+  m_health_period = std::chrono::milliseconds(m_dfo_conf->get_health_evaluation_period_ms());
+  m_health_degraded_factor = m_dfo_conf->get_health_degraded_factor();
+  m_health_quarantine_factor = std::max(m_dfo_conf->get_health_quarantine_factor(), m_health_degraded_factor);
+  m_quarantine_time = std::chrono::milliseconds(m_dfo_conf->get_quarantine_time_ms());
+
+  auto horizon = std::chrono::milliseconds(m_dfo_conf->get_busy_prediction_horizon_ms());
+  if (horizon.count() > 0) {
+    auto dwell = std::chrono::milliseconds(m_dfo_conf->get_busy_min_dwell_ms());
+    m_busy_predictor = std::make_unique<BusyPredictor>(horizon, dwell);
+    m_busy_evaluation_period = (dwell.count() > 0 ? std::min(dwell, horizon) : horizon) / 2;
+    TLOG_DEBUG(TLVL_CONFIG) << get_name() << ": busy prediction enabled with horizon " << horizon.count()
+                            << " ms and minimum dwell " << dwell.count() << " ms";
+  } else {
+    m_busy_predictor.reset();
+  }
 
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_conf() method, there are "
-                                      << m_dataflow_availability.size() << " TRB apps defined";
+                                      << m_n_dataflow_apps.load() << " TRB apps defined";
 }
 
 void
@@ -123,20 +163,46 @@ DFOModule::do_start(const data_t& payload)
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_start() method";
 
   m_received_tokens = 0;
+  m_received_token_batches = 0;
   m_run_number = payload.value<dunedaq::daqdataformats::run_number_t>("run", 0);
 
   m_running_status.store(true);
   m_last_notified_busy.store(false);
-  m_last_assignement_it = m_dataflow_availability.end();
+  m_last_assigned_app = 0;
 
   m_last_token_received = m_last_td_received = std::chrono::steady_clock::now();
 
+  open_trace();
+
+  if (m_busy_predictor) {
+    m_busy_predictor->reset();
+    m_busy_thread.start_working_thread(get_name() + "-busy");
+  }
+  if (m_assignment_max_age.count() > 0) {
+    m_reclaim_thread.start_working_thread(get_name() + "-reclaim");
+  }
+  if (m_health_period.count() > 0) {
+    m_health_thread.start_working_thread(get_name() + "-health");
+  }
+
   auto iom = iomanager::IOManager::get();
-  iom->add_callback<dfmessages::TriggerDecisionToken>(
-    m_token_connection, std::bind(&DFOModule::receive_trigger_complete_token, this, std::placeholders::_1));
+  if (m_token_connection != "") {
+    iom->add_callback<dfmessages::TriggerDecisionToken>(
+      m_token_connection, std::bind(&DFOModule::receive_trigger_complete_token, this, std::placeholders::_1));
+  }
+  if (m_token_batch_connection != "") {
+    iom->add_callback<TriggerDecisionTokenBatch>(
+      m_token_batch_connection,
+      std::bind(&DFOModule::receive_trigger_complete_token_batch, this, std::placeholders::_1));
+  }
 
-  iom->add_callback<dfmessages::TriggerDecision>(
-    m_td_connection, std::bind(&DFOModule::receive_trigger_decision, this, std::placeholders::_1));
+  if (m_decision_batch_size > 1) {
+    m_decision_receiver = iom->get_receiver<dfmessages::TriggerDecision>(m_td_connection);
+    m_decision_thread.start_working_thread(get_name() + "-decisions");
+  } else {
+    iom->add_callback<dfmessages::TriggerDecision>(
+      m_td_connection, std::bind(&DFOModule::receive_trigger_decision, this, std::placeholders::_1));
+  }
 
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_start() method";
 }
@@ -149,22 +215,46 @@ DFOModule::do_stop(const data_t& /*args*/)
   m_running_status.store(false);
 
   auto iom = iomanager::IOManager::get();
-  iom->remove_callback<dfmessages::TriggerDecision>(m_td_connection);
+  if (m_decision_thread.thread_running()) {
+    m_decision_thread.stop_working_thread();
+  } else {
+    iom->remove_callback<dfmessages::TriggerDecision>(m_td_connection);
+  }
 
-  const int wait_steps = 20;
-  auto step_timeout = m_stop_timeout / wait_steps;
-  int step_counter = 0;
-  while (!is_empty() && step_counter < wait_steps) {
-    TLOG() << get_name() << ": stop delayed while waiting for " << used_slots() << " TDs to completed";
-    std::this_thread::sleep_for(step_timeout);
-    ++step_counter;
+  if (m_busy_thread.thread_running()) {
+    m_busy_thread.stop_working_thread();
+  }
+  if (m_reclaim_thread.thread_running()) {
+    m_reclaim_thread.stop_working_thread();
+  }
+  if (m_health_thread.thread_running()) {
+    m_health_thread.stop_working_thread();
   }
 
-  iom->remove_callback<dfmessages::TriggerDecisionToken>(m_token_connection);
+  auto drain_start = std::chrono::steady_clock::now();
+  {
+    std::unique_lock<std::mutex> lk(m_drain_mutex);
+    if (!is_empty()) {
+      TLOG() << get_name() << ": stop delayed while waiting for " << used_slots() << " TDs to complete";
+      m_drain_cv.wait_for(lk, m_stop_timeout, [this]() { return is_empty(); });
+    }
+  }
+  auto drain_time =
+    std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - drain_start);
+  m_drain_time.store(drain_time.count());
+  TLOG() << get_name() << ": waited " << drain_time.count() << " us for outstanding TDs, " << used_slots()
+         << " left";
+
+  if (m_token_connection != "") {
+    iom->remove_callback<dfmessages::TriggerDecisionToken>(m_token_connection);
+  }
+  if (m_token_batch_connection != "") {
+    iom->remove_callback<TriggerDecisionTokenBatch>(m_token_batch_connection);
+  }
 
   std::list<std::shared_ptr<AssignedTriggerDecision>> remnants;
-  for (auto& app : m_dataflow_availability) {
-    auto temp = app.second->flush();
+  for (size_t i = 0; i < m_n_dataflow_apps.load(); ++i) {
+    auto temp = m_dataflow_apps[i]->flush();
     for (auto& td : temp) {
       remnants.push_back(td);
     }
@@ -174,8 +264,13 @@ DFOModule::do_stop(const data_t& /*args*/)
     ers::error(IncompleteTriggerDecision(ERS_HERE, r->decision.trigger_number, m_run_number));
   }
 
-  std::lock_guard<std::mutex> guard(m_trigger_mutex);
-  m_trigger_counters.clear();
+  close_trace();
+
+  m_seen_trigger_types.store(0);
+  for (auto& counts : m_trigger_counters) {
+    counts.received.store(0);
+    counts.completed.store(0);
+  }
   
   TLOG() << get_name() << " successfully stopped";
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_stop() method";
@@ -186,14 +281,43 @@ DFOModule::do_scrap(const data_t& /*args*/)
 {
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_scrap() method";
 
-  m_dataflow_availability.clear();
+  {
+    std::lock_guard<std::mutex> lk(m_dataflow_app_ids_mutex);
+    m_n_dataflow_apps.store(0);
+    for (auto& app : m_dataflow_apps)
+      app.reset();
+    m_dataflow_app_ids.clear();
+  }
+  m_decision_senders.clear();
+  m_occupancy = std::make_shared<DataflowOccupancy>();
+  m_volume_estimator.clear();
 
   TLOG() << get_name() << " successfully scrapped";
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_scrap() method";
 }
 
 void
-DFOModule::receive_trigger_decision(const dfmessages::TriggerDecision& decision)
+DFOModule::receive_trigger_decision(dfmessages::TriggerDecision& decision)
+{
+  auto decision_received = std::chrono::steady_clock::now();
+  if (!accept_decision(decision))
+    return;
+
+  auto decision_assigned = assign_decision(decision);
+
+  notify_trigger(evaluate_busy());
+
+  m_waiting_for_decision +=
+    std::chrono::duration_cast<std::chrono::microseconds>(decision_received - m_last_td_received).count();
+  m_last_td_received = std::chrono::steady_clock::now();
+  m_deciding_destination +=
+    std::chrono::duration_cast<std::chrono::microseconds>(decision_assigned - decision_received).count();
+  m_forwarding_decision +=
+    std::chrono::duration_cast<std::chrono::microseconds>(m_last_td_received - decision_assigned).count();
+}
+
+bool
+DFOModule::accept_decision(const dfmessages::TriggerDecision& decision)
 {
   TLOG_DEBUG(TLVL_TRIGDEC_RECEIVED) << get_name() << " Received TriggerDecision for trigger_number "
                                     << decision.trigger_number << " and run " << decision.run_number
@@ -201,16 +325,21 @@ DFOModule::receive_trigger_decision(const dfmessages::TriggerDecision& decision)
   if (decision.run_number != m_run_number) {
     ers::error(DFOModuleRunNumberMismatch(
       ERS_HERE, decision.run_number, m_run_number, "MLT", decision.trigger_number));
-    return;
+    return false;
   }
 
-  auto decision_received = std::chrono::steady_clock::now();
   ++m_received_decisions;
-  auto trigger_types = unpack_types(decision.trigger_type);
-  for ( const auto t : trigger_types ) {
-    ++get_trigger_counter(t).received;
-  }
-  
+  count_received_types(decision.trigger_type);
+  if (m_trace)
+    m_trace->record(DFOTraceRecord::kDecision, decision.trigger_number);
+  if (m_busy_predictor)
+    m_busy_predictor->decision_received();
+  return true;
+}
+
+std::chrono::steady_clock::time_point
+DFOModule::assign_decision(dfmessages::TriggerDecision& decision)
+{
   std::chrono::steady_clock::time_point decision_assigned;
   do {
 
@@ -219,38 +348,237 @@ DFOModule::receive_trigger_decision(const dfmessages::TriggerDecision& decision)
     if (assignment == nullptr) { // this can happen if all application are in error state
       ers::error(UnableToAssign(ERS_HERE, decision.trigger_number));
       usleep(500);
-      notify_trigger(is_busy());
+      notify_trigger(evaluate_busy());
       continue;
     }
 
+    const auto& app = m_dataflow_apps[assignment->app_id];
     TLOG_DEBUG(TLVL_TRIGDEC_RECEIVED) << get_name() << " Slot found for trigger_number " << decision.trigger_number
-                                      << " on connection " << assignment->connection_name
+                                      << " on connection " << app->connection_name()
                                       << ", number of used slots is " << used_slots();
+    if (needs_volume_estimates())
+      assignment->estimated_bytes = m_volume_estimator.estimate(decision);
+
+    // the assignment exists before the decision is sent, as the token can
+    // come back before the send returns
+    try {
+      app->add_assignment(assignment);
+    } catch (const NoSlotsAvailable&) {
+      // the application went in error since the slot was found
+      continue;
+    }
+
     decision_assigned = std::chrono::steady_clock::now();
-    auto dispatch_successful = dispatch(assignment);
+    auto dispatch_successful = dispatch(assignment, decision);
 
+    // decision has been moved to the sender, the assignment holds the copy
+    const auto trigger_number = assignment->decision.trigger_number;
     if (dispatch_successful) {
-      assign_trigger_decision(assignment);
-      TLOG_DEBUG(TLVL_TRIGDEC_RECEIVED) << get_name() << " Assigned trigger_number " << decision.trigger_number
-                                        << " to connection " << assignment->connection_name;
+      if (m_trace)
+        m_trace->record(DFOTraceRecord::kAssignment, trigger_number, assignment->app_id, assignment->estimated_bytes);
+      TLOG_DEBUG(TLVL_TRIGDEC_RECEIVED) << get_name() << " Assigned trigger_number " << trigger_number
+                                        << " to connection " << app->connection_name();
       break;
     } else {
-      ers::error(
-        TRBModuleAppUpdate(ERS_HERE, assignment->connection_name, "Could not send Trigger Decision"));
-      m_dataflow_availability[assignment->connection_name]->set_in_error(true);
+      app->extract_assignment(trigger_number);
+      ers::error(TRBModuleAppUpdate(ERS_HERE, app->connection_name(), "Could not send Trigger Decision"));
+      app->set_in_error(true);
     }
 
   } while (m_running_status.load());
 
-  notify_trigger(is_busy());
+  return decision_assigned;
+}
+
+void
+DFOModule::do_receive_decisions(std::atomic<bool>& running_flag)
+{
+  while (running_flag.load()) {
+    m_decision_batch.clear();
+
+    std::optional<dfmessages::TriggerDecision> decision;
+    try {
+      decision = m_decision_receiver->try_receive(m_queue_timeout);
+    } catch (const ers::Issue& excpt) {
+      ers::error(excpt);
+    }
+    if (!decision)
+      continue;
+    m_decision_batch.push_back(std::move(*decision));
+
+    // during a burst, whatever is already queued is assigned in the same pass
+    while (m_decision_batch.size() < m_decision_batch_size) {
+      try {
+        decision = m_decision_receiver->try_receive(iomanager::Receiver::s_no_block);
+      } catch (const ers::Issue& excpt) {
+        ers::error(excpt);
+        decision.reset();
+      }
+      if (!decision)
+        break;
+      m_decision_batch.push_back(std::move(*decision));
+    }
+
+    receive_trigger_decisions(m_decision_batch);
+  }
+}
+
+void
+DFOModule::receive_trigger_decisions(std::vector<dfmessages::TriggerDecision>& decisions)
+{
+  auto batch_received = std::chrono::steady_clock::now();
+
+  size_t n_accepted = 0;
+  for (size_t i = 0; i < decisions.size(); ++i) {
+    if (!accept_decision(decisions[i]))
+      continue;
+    if (i != n_accepted)
+      decisions[n_accepted] = std::move(decisions[i]);
+    ++n_accepted;
+  }
+  decisions.erase(decisions.begin() + n_accepted, decisions.end());
+  if (decisions.empty())
+    return;
+  ++m_decision_batches;
+
+  plan_decision_batch(decisions);
+  auto batch_planned = std::chrono::steady_clock::now();
+
+  // the decisions are sent grouped by destination, in order within each group
+  for (size_t first = 0; first < decisions.size(); ++first) {
+    auto app_id = m_batch_plan[first];
+    if (app_id >= s_max_dataflow_apps)
+      continue;
+
+    const auto& app = m_dataflow_apps[app_id];
+    bool failed = false;   // a send failed, the application is put in error
+    bool rejected = false; // the application went in error since the plan was made
+    size_t n_assigned = 0;
+    for (size_t i = first; i < decisions.size(); ++i) {
+      if (m_batch_plan[i] != app_id)
+        continue;
+      if (failed || rejected) {
+        m_batch_plan[i] = s_assign_individually;
+        continue;
+      }
+
+      // the assignment exists before the decision is sent, as the token can
+      // come back before the send returns
+      auto assignment = app->make_assignment(decisions[i]);
+      assignment->estimated_bytes = m_batch_bytes[i];
+      try {
+        app->add_assignment(assignment);
+      } catch (const NoSlotsAvailable&) {
+        rejected = true;
+        m_batch_plan[i] = s_assign_individually;
+        continue;
+      }
+
+      if (dispatch(assignment, decisions[i])) {
+        m_batch_plan[i] = s_batch_done;
+        ++n_assigned;
+        if (m_trace)
+          m_trace->record(
+            DFOTraceRecord::kAssignment, assignment->decision.trigger_number, app_id, assignment->estimated_bytes);
+      } else {
+        app->extract_assignment(assignment->decision.trigger_number);
+        failed = true;
+        m_batch_plan[i] = s_assign_individually;
+      }
+    }
+
+    TLOG_DEBUG(TLVL_TRIGDEC_RECEIVED) << get_name() << " Assigned " << n_assigned << " decisions to connection "
+                                      << app->connection_name();
+
+    if (failed) {
+      ers::error(TRBModuleAppUpdate(ERS_HERE, app->connection_name(), "Could not send Trigger Decision"));
+      app->set_in_error(true);
+    }
+  }
+
+  // the decisions that found no destination in the snapshot, or whose destination
+  // failed, are assigned one by one against the current state
+  for (size_t i = 0; i < decisions.size() && m_running_status.load(); ++i) {
+    if (m_batch_plan[i] == s_assign_individually)
+      assign_decision(decisions[i]);
+  }
+
+  notify_trigger(evaluate_busy());
 
   m_waiting_for_decision +=
-    std::chrono::duration_cast<std::chrono::microseconds>(decision_received - m_last_td_received).count();
+    std::chrono::duration_cast<std::chrono::microseconds>(batch_received - m_last_td_received).count();
   m_last_td_received = std::chrono::steady_clock::now();
   m_deciding_destination +=
-    std::chrono::duration_cast<std::chrono::microseconds>(decision_assigned - decision_received).count();
+    std::chrono::duration_cast<std::chrono::microseconds>(batch_planned - batch_received).count();
   m_forwarding_decision +=
-    std::chrono::duration_cast<std::chrono::microseconds>(m_last_td_received - decision_assigned).count();
+    std::chrono::duration_cast<std::chrono::microseconds>(m_last_td_received - batch_planned).count();
+}
+
+void
+DFOModule::plan_decision_batch(const std::vector<dfmessages::TriggerDecision>& decisions)
+{
+  // the same choice as find_slot, or find_least_loaded_slot, made for all the
+  // decisions of the batch on one snapshot of the applications, which is
+  // updated locally as the decisions are placed
+
+  m_batch_plan.assign(decisions.size(), s_assign_individually);
+  m_batch_bytes.resize(decisions.size());
+
+  auto n_apps = m_n_dataflow_apps.load();
+  if (m_occupancy->apps_in_error.load() >= n_apps)
+    return;
+
+  m_batch_snapshot.resize(n_apps);
+  for (size_t i = 0; i < n_apps; ++i) {
+    const auto& app = m_dataflow_apps[i];
+    m_batch_snapshot[i] = AppSnapshot{
+      app->is_in_error(), app->is_quarantined(), app->free_slots(), app->used_slots(), app->outstanding_bytes()
+    };
+  }
+
+  for (size_t i = 0; i < decisions.size(); ++i) {
+    auto bytes = needs_volume_estimates() ? m_volume_estimator.estimate(decisions[i]) : 0;
+
+    // an available application wins over a busy one and a busy one over a
+    // quarantined one. Round-robin takes the first available application,
+    // the volume-aware assignment the one with the least outstanding bytes
+    size_t best = n_apps;
+    std::tuple<bool, bool, uint64_t, size_t> best_key{ true, true, 0, 0 }; // NOLINT(build/unsigned)
+    size_t candidate = m_last_assigned_app;
+    for (size_t counter = 0; counter < n_apps; ++counter) {
+      candidate = (candidate + 1) % n_apps;
+      const auto& app = m_batch_snapshot[candidate];
+      if (app.in_error)
+        continue;
+      if (!m_volume_aware_assignment && app.free_slots > 0) {
+        best = candidate;
+        break;
+      }
+      std::tuple<bool, bool, uint64_t, size_t> key{ // NOLINT(build/unsigned)
+        app.free_slots == 0, app.quarantined, m_volume_aware_assignment ? app.bytes : 0, app.used_slots
+      };
+      if (best == n_apps || key < best_key) {
+        best = candidate;
+        best_key = key;
+      }
+    }
+
+    if (best == n_apps)
+      continue;
+
+    auto& app = m_batch_snapshot[best];
+    if (app.free_slots == 0) {
+      ers::warning(AssignedToBusyApp(
+        ERS_HERE, decisions[i].trigger_number, m_dataflow_apps[best]->connection_name(), app.used_slots));
+    } else {
+      --app.free_slots;
+    }
+    ++app.used_slots;
+    app.bytes += bytes;
+    m_batch_plan[i] = best;
+    m_batch_bytes[i] = bytes;
+    m_last_assigned_app = best;
+  }
 }
 
 std::shared_ptr<AssignedTriggerDecision>
@@ -267,64 +595,123 @@ DFOModule::find_slot(const dfmessages::TriggerDecision& decision)
   // from the upper level code
 
   std::shared_ptr<AssignedTriggerDecision> output = nullptr;
-  auto minimum_occupied = m_dataflow_availability.end();
-  size_t minimum = std::numeric_limits<size_t>::max();
-  unsigned int counter = 0;
+  auto n_apps = m_n_dataflow_apps.load();
+  if (m_occupancy->apps_in_error.load() >= n_apps)
+    return output;
 
-  auto candidate_it = m_last_assignement_it;
-  if (candidate_it == m_dataflow_availability.end())
-    candidate_it = m_dataflow_availability.begin();
+  if (m_volume_aware_assignment)
+    return find_least_loaded_slot(decision);
+
+  size_t minimum_occupied = n_apps;
+  size_t minimum = std::numeric_limits<size_t>::max();
+  bool minimum_quarantined = true;
+  size_t candidate = m_last_assigned_app;
 
-  while (output == nullptr && counter < m_dataflow_availability.size()) {
+  for (size_t counter = 0; output == nullptr && counter < n_apps; ++counter) {
 
-    ++counter;
-    ++candidate_it;
-    if (candidate_it == m_dataflow_availability.end())
-      candidate_it = m_dataflow_availability.begin();
+    candidate = (candidate + 1) % n_apps;
+    const auto& app = m_dataflow_apps[candidate];
 
     // get rid of the applications in error state
-    if (candidate_it->second->is_in_error()) {
+    if (app->is_in_error()) {
       continue;
     }
 
-    // monitor
-    auto slots = candidate_it->second->used_slots();
-    if (slots < minimum) {
+    // monitor, quarantined applications are only used if no other is left
+    auto slots = app->used_slots();
+    bool quarantined = app->is_quarantined();
+    if (std::tie(quarantined, slots) < std::tie(minimum_quarantined, minimum)) {
       minimum = slots;
-      minimum_occupied = candidate_it;
+      minimum_quarantined = quarantined;
+      minimum_occupied = candidate;
     }
 
-    if (candidate_it->second->is_busy())
+    if (app->is_busy())
       continue;
 
-    output = candidate_it->second->make_assignment(decision);
-    m_last_assignement_it = candidate_it;
+    output = app->make_assignment(decision);
+    m_last_assigned_app = candidate;
   }
 
   if (!output) {
     // in this case all applications were busy
     // so we assign the decision to that with the lowest
     // number of assignments
-    if (minimum_occupied != m_dataflow_availability.end()) {
-      output = minimum_occupied->second->make_assignment(decision);
-      m_last_assignement_it = minimum_occupied;
-      ers::warning(AssignedToBusyApp(ERS_HERE, decision.trigger_number, minimum_occupied->first, minimum));
+    if (minimum_occupied != n_apps) {
+      const auto& app = m_dataflow_apps[minimum_occupied];
+      output = app->make_assignment(decision);
+      m_last_assigned_app = minimum_occupied;
+      ers::warning(AssignedToBusyApp(ERS_HERE, decision.trigger_number, app->connection_name(), minimum));
     }
   }
 
   if (output != nullptr) {
     TLOG_DEBUG(TLVL_WORK_STEPS) << "Assigned TriggerDecision with trigger number " << decision.trigger_number
-                                << " to TRB at connection " << output->connection_name;
+                                << " to TRB at connection " << m_dataflow_apps[output->app_id]->connection_name();
   }
   return output;
 }
 
+std::shared_ptr<AssignedTriggerDecision>
+DFOModule::find_least_loaded_slot(const dfmessages::TriggerDecision& decision)
+{
+  // this assigns the decision to the available application with the
+  // smallest predicted volume of outstanding data, the number of used slots
+  // breaking ties. The probing starts after the last assigned application
+  // so that equally loaded applications are used in turn.
+  // If all applications are busy, the least loaded one in any case is used
+
+  auto n_apps = m_n_dataflow_apps.load();
+  size_t best = n_apps;
+  bool best_is_busy = true;
+  bool best_is_quarantined = true;
+  uint64_t best_bytes = std::numeric_limits<uint64_t>::max(); // NOLINT(build/unsigned)
+  size_t best_slots = std::numeric_limits<size_t>::max();
+
+  size_t candidate = m_last_assigned_app;
+  for (size_t counter = 0; counter < n_apps; ++counter) {
+    candidate = (candidate + 1) % n_apps;
+    const auto& app = m_dataflow_apps[candidate];
+
+    if (app->is_in_error())
+      continue;
+
+    bool busy = app->is_busy();
+    bool quarantined = app->is_quarantined();
+    auto bytes = app->outstanding_bytes();
+    auto slots = app->used_slots();
+    // an available application always wins over a busy one, and a busy one over a quarantined one
+    if (std::tie(busy, quarantined, bytes, slots) <
+        std::tie(best_is_busy, best_is_quarantined, best_bytes, best_slots)) {
+      best = candidate;
+      best_is_busy = busy;
+      best_is_quarantined = quarantined;
+      best_bytes = bytes;
+      best_slots = slots;
+    }
+  }
+
+  if (best == n_apps)
+    return nullptr;
+
+  const auto& app = m_dataflow_apps[best];
+  if (best_is_busy)
+    ers::warning(AssignedToBusyApp(ERS_HERE, decision.trigger_number, app->connection_name(), best_slots));
+
+  m_last_assigned_app = best;
+  TLOG_DEBUG(TLVL_WORK_STEPS) << "Assigned TriggerDecision with trigger number " << decision.trigger_number
+                              << " to TRB at connection " << app->connection_name() << " with " << best_bytes
+                              << " outstanding bytes";
+  return app->make_assignment(decision);
+}
+
 void
 DFOModule::generate_opmon_data() 
 {
 
   opmon::DFOInfo info;
   info.set_tokens_received( m_received_tokens.exchange(0) );
+  info.set_token_batches_received(m_received_token_batches.exchange(0));
   info.set_decisions_sent(m_sent_decisions.exchange(0));
   info.set_decisions_received(m_received_decisions.exchange(0));
   info.set_waiting_for_decision(m_waiting_for_decision.exchange(0));
@@ -332,32 +719,32 @@ DFOModule::generate_opmon_data()
   info.set_forwarding_decision(m_forwarding_decision.exchange(0));
   info.set_waiting_for_token(m_waiting_for_token.exchange(0));
   info.set_processing_token(m_processing_token.exchange(0));
+  info.set_busy_notifications(m_busy_notifications.exchange(0));
+  info.set_decision_batches(m_decision_batches.exchange(0));
+  info.set_drain_time(m_drain_time.exchange(0));
+  if (m_busy_predictor) {
+    info.set_decision_rate(m_busy_predictor->decision_rate());
+    info.set_completion_rate(m_busy_predictor->completion_rate());
+    info.set_predicted_busy(m_busy_predictor->get_predicted_busy_count());
+  }
   publish( std::move(info) );
 
-  std::lock_guard<std::mutex>	guard(m_trigger_mutex);
-  for ( auto & [type, counts] : m_trigger_counters ) {
+  for_each_type( m_seen_trigger_types.load(), [this](size_t i) {
+    auto & counts = m_trigger_counters[i];
     opmon::TriggerInfo ti;
     ti.set_received(counts.received.exchange(0));
     ti.set_completed(counts.completed.exchange(0));
+    auto type = static_cast<trgdataformats::TriggerCandidateData::Type>(i);
     auto name = dunedaq::trgdataformats::get_trigger_candidate_type_names()[type];
     publish( std::move(ti), {{"type", name}} );
-   }
+  });
 }
 
 void
 DFOModule::receive_trigger_complete_token(const dfmessages::TriggerDecisionToken& token)
 {
   if (token.run_number == 0 && token.trigger_number == 0) {
-    if (m_dataflow_availability.count(token.decision_destination) == 0) {
-      TLOG_DEBUG(TLVL_CONFIG) << "Creating dataflow availability struct for uid " << token.decision_destination;
-      auto entry = m_dataflow_availability[token.decision_destination] =
-        std::make_shared<TriggerRecordBuilderData>(token.decision_destination, m_busy_threshold, m_free_threshold);
-      register_node(token.decision_destination, entry);
-    } else {
-      TLOG() << TRBModuleAppUpdate(ERS_HERE, token.decision_destination, "Has reconnected");
-      auto app_it = m_dataflow_availability.find(token.decision_destination);
-      app_it->second->set_in_error(false);
-    }
+    register_dataflow_app(token.decision_destination);
     return;
   }
 
@@ -373,9 +760,9 @@ DFOModule::receive_trigger_complete_token(const dfmessages::TriggerDecisionToken
     return;
   }
 
-  auto app_it = m_dataflow_availability.find(token.decision_destination);
+  auto app = find_dataflow_app(token.decision_destination);
   // check if application data exists;
-  if (app_it == m_dataflow_availability.end()) {
+  if (!app) {
     ers::error(UnknownTokenSource(ERS_HERE, token.decision_destination));
     return;
   }
@@ -384,22 +771,77 @@ DFOModule::receive_trigger_complete_token(const dfmessages::TriggerDecisionToken
   auto callback_start = std::chrono::steady_clock::now();
 
   try {
-    auto dec_ptr = app_it->second->complete_assignment(token.trigger_number, m_metadata_function);
-    auto trigger_types = unpack_types(dec_ptr->decision.trigger_type);
-    for ( const auto t : trigger_types ) ++ get_trigger_counter(t).completed;
+    auto dec_ptr = app->complete_assignment(token.trigger_number, m_metadata_function);
+    if (dec_ptr) { // nullptr for a late token of a reclaimed assignment
+      count_completed_types(dec_ptr->decision.trigger_type);
+      if (m_trace)
+        m_trace->record(DFOTraceRecord::kCompletion, token.trigger_number, app->app_id());
+      if (m_busy_predictor)
+        m_busy_predictor->decisions_completed(1);
+    }
   } catch (AssignedTriggerDecisionNotFound const& err) {
     ers::error(err);
   }
 
-  if (app_it->second->is_in_error()) {
-    TLOG() << TRBModuleAppUpdate(ERS_HERE, token.decision_destination, "Has reconnected");
-    app_it->second->set_in_error(false);
+  update_app_after_completion(app);
+
+  m_waiting_for_token +=
+    std::chrono::duration_cast<std::chrono::microseconds>(callback_start - m_last_token_received).count();
+  m_last_token_received = std::chrono::steady_clock::now();
+  m_processing_token +=
+    std::chrono::duration_cast<std::chrono::microseconds>(m_last_token_received - callback_start).count();
+}
+
+void
+DFOModule::receive_trigger_complete_token_batch(const TriggerDecisionTokenBatch& batch)
+{
+  if (batch.run_number == 0 && batch.trigger_numbers.empty()) {
+    register_dataflow_app(batch.decision_destination);
+    return;
   }
 
-  if (!app_it->second->is_busy()) {
-    notify_trigger(false);
+  TLOG_DEBUG(TLVL_TDTOKEN_RECEIVED) << get_name() << " Received TriggerDecisionTokenBatch with "
+                                    << batch.trigger_numbers.size() << " trigger numbers and run "
+                                    << batch.run_number << " (current run is " << m_run_number << ")";
+  if (batch.run_number != m_run_number) {
+    std::ostringstream oss_source;
+    oss_source << "TRB at connection " << batch.decision_destination;
+    ers::error(DFOModuleRunNumberMismatch(ERS_HERE,
+                                          batch.run_number,
+                                          m_run_number,
+                                          oss_source.str(),
+                                          batch.trigger_numbers.empty() ? 0 : batch.trigger_numbers.front()));
+    return;
+  }
+
+  auto app = find_dataflow_app(batch.decision_destination);
+  if (!app) {
+    ers::error(UnknownTokenSource(ERS_HERE, batch.decision_destination));
+    return;
   }
 
+  ++m_received_token_batches;
+  m_received_tokens += batch.trigger_numbers.size();
+  auto callback_start = std::chrono::steady_clock::now();
+
+  auto& completed = m_completed_batch;
+  app->complete_assignments(batch.trigger_numbers, completed, m_metadata_function);
+  for (const auto& dec_ptr : completed) {
+    count_completed_types(dec_ptr->decision.trigger_type);
+  }
+  if (m_trace) {
+    for (const auto& dec_ptr : completed)
+      m_trace->record(DFOTraceRecord::kCompletion, dec_ptr->decision.trigger_number, app->app_id());
+  }
+  if (m_busy_predictor)
+    m_busy_predictor->decisions_completed(completed.size());
+  if (!batch.fragment_volumes.empty() && needs_volume_estimates())
+    learn_fragment_volumes(completed, batch.fragment_volumes);
+  // the assignment objects go back to the pool of the application
+  completed.clear();
+
+  update_app_after_completion(app);
+
   m_waiting_for_token +=
     std::chrono::duration_cast<std::chrono::microseconds>(callback_start - m_last_token_received).count();
   m_last_token_received = std::chrono::steady_clock::now();
@@ -407,34 +849,312 @@ DFOModule::receive_trigger_complete_token(const dfmessages::TriggerDecisionToken
     std::chrono::duration_cast<std::chrono::microseconds>(m_last_token_received - callback_start).count();
 }
 
+void
+DFOModule::register_dataflow_app(const std::string& connection_name)
+{
+  std::lock_guard<std::mutex> lk(m_dataflow_app_ids_mutex);
+  auto id_it = m_dataflow_app_ids.find(connection_name);
+  if (id_it != m_dataflow_app_ids.end()) {
+    TLOG() << TRBModuleAppUpdate(ERS_HERE, connection_name, "Has reconnected");
+    m_dataflow_apps[id_it->second]->set_in_error(false);
+    return;
+  }
+
+  auto app_id = m_n_dataflow_apps.load();
+  if (app_id >= s_max_dataflow_apps) {
+    ers::error(TRBModuleAppUpdate(ERS_HERE, connection_name, "Too many dataflow applications, ignored"));
+    return;
+  }
+
+  TLOG_DEBUG(TLVL_CONFIG) << "Creating dataflow availability struct for uid " << connection_name << " with id "
+                          << app_id;
+  auto entry =
+    std::make_shared<TriggerRecordBuilderData>(connection_name, m_busy_threshold, m_free_threshold, app_id);
+  entry->set_occupancy(m_occupancy);
+  entry->set_completion_sampling(m_completion_sampling);
+  register_node(connection_name, entry);
+  m_dataflow_apps[app_id] = entry;
+  m_dataflow_app_ids[connection_name] = app_id;
+  if (m_trace)
+    m_trace->add_app(connection_name);
+  // makes the new application visible to the decision thread
+  m_n_dataflow_apps.store(app_id + 1);
+}
+
+DFOModule::trbd_ptr_t
+DFOModule::find_dataflow_app(const std::string& connection_name) const
+{
+  std::lock_guard<std::mutex> lk(m_dataflow_app_ids_mutex);
+  auto id_it = m_dataflow_app_ids.find(connection_name);
+  if (id_it == m_dataflow_app_ids.end())
+    return nullptr;
+  return m_dataflow_apps[id_it->second];
+}
+
+void
+DFOModule::learn_fragment_volumes(const std::vector<std::shared_ptr<AssignedTriggerDecision>>& completed,
+                                  const std::vector<FragmentVolume>& volumes)
+{
+  // a batch reports the volumes of a single sampled record, so a linear
+  // search of the completed decisions is enough
+  const dfmessages::TriggerDecision* decision = nullptr;
+  for (const auto& volume : volumes) {
+    if (decision == nullptr || decision->trigger_number != volume.trigger_number) {
+      auto dec_it = std::find_if(completed.begin(), completed.end(), [&volume](const auto& dec_ptr) {
+        return dec_ptr->decision.trigger_number == volume.trigger_number;
+      });
+      decision = dec_it == completed.end() ? nullptr : &(*dec_it)->decision;
+    }
+    if (decision == nullptr)
+      continue;
+    for (const auto& component : decision->components) {
+      if (component.component == volume.source_id) {
+        m_volume_estimator.update(
+          volume.source_id, DataVolumeEstimator::window_ticks(component), volume.bytes);
+        break;
+      }
+    }
+  }
+}
+
+void
+DFOModule::open_trace()
+{
+  auto prefix = m_dfo_conf->get_trace_file();
+  if (prefix.empty())
+    return;
+
+  auto file_name = prefix + "_run" + std::to_string(m_run_number) + ".dfotrace";
+  try {
+    m_trace = std::make_unique<DFOTraceWriter>(file_name);
+  } catch (const DFOTraceFileProblem& e) {
+    ers::warning(e);
+    return;
+  }
+
+  std::lock_guard<std::mutex> lk(m_dataflow_app_ids_mutex);
+  for (size_t i = 0; i < m_n_dataflow_apps.load(); ++i)
+    m_trace->add_app(m_dataflow_apps[i]->connection_name());
+  TLOG() << get_name() << ": recording DFO trace to " << file_name;
+}
+
+void
+DFOModule::close_trace()
+{
+  if (!m_trace)
+    return;
+  // a write problem has already been reported by the trace writer
+  m_trace->flush();
+  m_trace.reset();
+}
+
+void
+DFOModule::update_app_after_completion(const trbd_ptr_t& app)
+{
+  if (is_empty()) {
+    // wakes up do_stop if it is waiting for the last assignments
+    std::lock_guard<std::mutex> lk(m_drain_mutex);
+    m_drain_cv.notify_all();
+  }
+
+  if (app->is_in_error()) {
+    TLOG() << TRBModuleAppUpdate(ERS_HERE, app->connection_name(), "Has reconnected");
+    app->set_in_error(false);
+  }
+
+  if (m_busy_predictor) {
+    notify_trigger(evaluate_busy());
+  } else if (!app->is_busy()) {
+    notify_trigger(false);
+  }
+}
+
 bool
 DFOModule::is_busy() const
 {
-  for (auto& dfapp : m_dataflow_availability) {
-    if (!dfapp.second->is_busy())
-      return false;
-  }
-  return true;
+  return m_occupancy->available_apps.load() == 0;
 }
 
 bool
 DFOModule::is_empty() const
 {
-  for (auto& dfapp : m_dataflow_availability) {
-    if (dfapp.second->used_slots() != 0)
-      return false;
-  }
-  return true;
+  return m_occupancy->used_slots.load() == 0;
 }
 
 size_t
 DFOModule::used_slots() const
 {
-  size_t total = 0;
-  for (auto& dfapp : m_dataflow_availability) {
-    total += dfapp.second->used_slots();
+  return m_occupancy->used_slots.load();
+}
+
+bool
+DFOModule::evaluate_busy()
+{
+  if (!m_busy_predictor)
+    return is_busy();
+
+  // free capacity of the applications that can take decisions, each up to its
+  // busy limit, which is lower for the degraded ones
+  size_t free_capacity = 0;
+  auto n_apps = m_n_dataflow_apps.load();
+  for (size_t i = 0; i < n_apps; ++i) {
+    const auto& app = m_dataflow_apps[i];
+    auto capacity = app->capacity();
+    auto used = app->used_slots();
+    if (capacity > used)
+      free_capacity += capacity - used;
+  }
+  return m_busy_predictor->evaluate(is_busy(), free_capacity);
+}
+
+void
+DFOModule::do_busy_evaluation(std::atomic<bool>& running_flag)
+{
+  // without this, a predicted busy could only be released by the arrival of a token
+  const auto period = std::max(m_busy_evaluation_period, std::chrono::milliseconds(1));
+  while (running_flag.load()) {
+    std::this_thread::sleep_for(period);
+    notify_trigger(evaluate_busy());
+  }
+}
+
+void
+DFOModule::do_reclaim_stale_assignments(std::atomic<bool>& running_flag)
+{
+  const auto period = std::clamp(m_assignment_max_age / 4,
+                                 std::chrono::milliseconds(10),
+                                 std::chrono::milliseconds(1000));
+  auto next_check = std::chrono::steady_clock::now() + period;
+  std::vector<std::shared_ptr<AssignedTriggerDecision>> reclaimed;
+  while (running_flag.load()) {
+    // sleep in short steps so that the stop is not delayed
+    std::this_thread::sleep_for(std::min(period, std::chrono::milliseconds(10)));
+    if (std::chrono::steady_clock::now() < next_check)
+      continue;
+    next_check += period;
+
+    bool reclaimed_any = false;
+    for (size_t i = 0; i < m_n_dataflow_apps.load(); ++i) {
+      const auto& app = m_dataflow_apps[i];
+      app->reclaim_stale_assignments(reclaimed, m_assignment_max_age);
+      if (reclaimed.empty())
+        continue;
+      reclaimed_any = true;
+      ers::warning(StaleAssignmentsReclaimed(ERS_HERE,
+                                             reclaimed.size(),
+                                             app->connection_name(),
+                                             m_assignment_max_age.count(),
+                                             reclaimed.front()->decision.trigger_number,
+                                             reclaimed.back()->decision.trigger_number));
+    }
+    reclaimed.clear();
+
+    if (reclaimed_any)
+      notify_trigger(evaluate_busy());
+  }
+}
+
+void
+DFOModule::do_health_evaluation(std::atomic<bool>& running_flag)
+{
+  // an application is scored by the 90th percentile of its recent completion
+  // latencies divided by the median of the same percentile over the
+  // applications. Past m_health_degraded_factor it gets half of its slots,
+  // past m_health_quarantine_factor it gets no new decisions for
+  // m_quarantine_time, after which it is back on probation as degraded.
+  // It is healthy again when its score falls below the degraded factor
+  // with some margin.
+  constexpr double latency_percentile = 0.9;
+  constexpr size_t min_samples = 10;
+  constexpr size_t min_scored_apps = 3; // with fewer, the median says nothing about the others
+  constexpr double recovery_margin = 0.8;
+  const auto window = 5 * m_health_period;
+
+  std::vector<std::chrono::steady_clock::time_point> quarantine_end(s_max_dataflow_apps);
+  std::vector<std::chrono::steady_clock::time_point> scored_since(s_max_dataflow_apps);
+  auto next_check = std::chrono::steady_clock::now() + m_health_period;
+
+  while (running_flag.load()) {
+    // sleep in short steps so that the stop is not delayed
+    std::this_thread::sleep_for(std::min(m_health_period, std::chrono::milliseconds(10)));
+    auto now = std::chrono::steady_clock::now();
+    if (now < next_check)
+      continue;
+    next_check += m_health_period;
+
+    auto n_apps = m_n_dataflow_apps.load();
+    std::vector<std::optional<double>> latencies(n_apps);
+    std::vector<double> scored;
+    size_t quarantined = 0;
+    for (size_t i = 0; i < n_apps; ++i) {
+      const auto& app = m_dataflow_apps[i];
+      if (app->is_quarantined())
+        ++quarantined;
+      if (app->is_in_error() || app->is_quarantined())
+        continue;
+      auto latency = app->latency_percentile(latency_percentile, std::max(now - window, scored_since[i]), min_samples);
+      if (latency) {
+        latencies[i] = latency->count();
+        scored.push_back(latency->count());
+      }
+    }
+
+    double median = 0.;
+    if (scored.size() >= min_scored_apps) {
+      std::nth_element(scored.begin(), scored.begin() + scored.size() / 2, scored.end());
+      median = std::max(scored[scored.size() / 2], 1.);
+    }
+
+    bool changed = false;
+    for (size_t i = 0; i < n_apps; ++i) {
+      const auto& app = m_dataflow_apps[i];
+      auto health = app->health();
+      auto new_health = health;
+      double score = app->health_score();
+
+      if (health == TriggerRecordBuilderData::Health::kQuarantined) {
+        if (now < quarantine_end[i])
+          continue;
+        new_health = TriggerRecordBuilderData::Health::kDegraded;
+        scored_since[i] = now; // the latencies that led to the quarantine are not counted again
+      } else if (latencies[i] && median > 0.) {
+        score = *latencies[i] / median;
+        if (score >= m_health_quarantine_factor && quarantined < (n_apps - 1) / 2) {
+          new_health = TriggerRecordBuilderData::Health::kQuarantined;
+          quarantine_end[i] = now + m_quarantine_time;
+          ++quarantined;
+        } else if (score >= m_health_degraded_factor) {
+          new_health = TriggerRecordBuilderData::Health::kDegraded;
+        } else if (score < m_health_degraded_factor * recovery_margin) {
+          new_health = TriggerRecordBuilderData::Health::kHealthy;
+        }
+      } else if (median == 0.) {
+        // not enough applications with data to compare them
+        new_health = health == TriggerRecordBuilderData::Health::kDegraded ? TriggerRecordBuilderData::Health::kHealthy
+                                                                          : health;
+      }
+
+      app->set_health(new_health, score);
+      if (new_health == health)
+        continue;
+
+      changed = true;
+      bool recovering = new_health < health;
+      std::ostringstream message;
+      message << (new_health == TriggerRecordBuilderData::Health::kQuarantined ? "Quarantined"
+                  : health == TriggerRecordBuilderData::Health::kQuarantined   ? "Reinstated on probation"
+                  : recovering                                                 ? "Healthy again"
+                                                                               : "Degraded")
+              << ", completion time score " << score;
+      if (recovering)
+        TLOG() << TRBModuleAppUpdate(ERS_HERE, app->connection_name(), message.str());
+      else
+        ers::warning(TRBModuleAppUpdate(ERS_HERE, app->connection_name(), message.str()));
+    }
+
+    if (changed)
+      notify_trigger(evaluate_busy());
   }
-  return total;
 }
 
 void
@@ -444,6 +1164,11 @@ DFOModule::notify_trigger(bool busy) const
   if (busy == m_last_notified_busy.load())
     return;
 
+  // decision, token and busy evaluation threads can all get here
+  std::lock_guard<std::mutex> lk(m_notify_mutex);
+  if (busy == m_last_notified_busy.load())
+    return;
+
   bool wasSentSuccessfully = false;
 
   do {
@@ -451,6 +1176,9 @@ DFOModule::notify_trigger(bool busy) const
       dfmessages::TriggerInhibit message{ busy, m_run_number };
       m_busy_sender->send(std::move(message), m_queue_timeout);
       wasSentSuccessfully = true;
+      ++m_busy_notifications;
+      if (m_trace)
+        m_trace->record(DFOTraceRecord::kBusy, 0, busy ? 1 : 0);
       TLOG_DEBUG(TLVL_NOTIFY_TRIGGER) << get_name() << " Sent BUSY status " << busy << " to trigger in run "
                                       << m_run_number;
     } catch (const ers::Issue& excpt) {
@@ -465,30 +1193,31 @@ DFOModule::notify_trigger(bool busy) const
 }
 
 bool
-DFOModule::dispatch(const std::shared_ptr<AssignedTriggerDecision>& assignment)
+DFOModule::dispatch(const std::shared_ptr<AssignedTriggerDecision>& assignment,
+                    dfmessages::TriggerDecision& decision)
 {
 
-  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering dispatch() method. assignment->connection_name: "
-                                      << assignment->connection_name;
+  const auto& connection_name = m_dataflow_apps[assignment->app_id]->connection_name();
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering dispatch() method. connection_name: "
+                                      << connection_name;
 
   bool wasSentSuccessfully = false;
   int retries = m_td_send_retries;
-  auto iom = iomanager::IOManager::get();
   do {
 
     try {
-      auto decision_copy = dfmessages::TriggerDecision(assignment->decision);
-      iom->get_sender<dfmessages::TriggerDecision>(assignment->connection_name)
-        ->send(std::move(decision_copy), m_queue_timeout);
+      m_decision_senders.get(connection_name)->send(std::move(decision), m_queue_timeout);
       wasSentSuccessfully = true;
       ++m_sent_decisions;
       TLOG_DEBUG(TLVL_DISPATCH_TO_TRB) << get_name() << " Sent TriggerDecision for trigger_number "
-                                       << decision_copy.trigger_number << " to TRB at connection "
-                                       << assignment->connection_name << " for run number " << decision_copy.run_number;
+                                       << assignment->decision.trigger_number << " to TRB at connection "
+                                       << connection_name << " for run number " << assignment->decision.run_number;
     } catch (const ers::Issue& excpt) {
       std::ostringstream oss_warn;
-      oss_warn << "Send to connection \"" << assignment->connection_name << "\" failed";
+      oss_warn << "Send to connection \"" << connection_name << "\" failed";
       ers::warning(iomanager::OperationFailed(ERS_HERE, oss_warn.str(), excpt));
+      // the sender may have consumed it
+      decision = assignment->decision;
     }
 
     retries--;
@@ -499,12 +1228,6 @@ DFOModule::dispatch(const std::shared_ptr<AssignedTriggerDecision>& assignment)
   return wasSentSuccessfully;
 }
 
-void
-DFOModule::assign_trigger_decision(const std::shared_ptr<AssignedTriggerDecision>& assignment)
-{
-  m_dataflow_availability[assignment->connection_name]->add_assignment(assignment);
-}
-
 } // namespace dunedaq::dfmodules
 
 DEFINE_DUNE_DAQ_MODULE(dunedaq::dfmodules::DFOModule)
@@ -9,6 +9,11 @@
 #ifndef DFMODULES_PLUGINS_DATAFLOWORCHESTRATOR_HPP_
 #define DFMODULES_PLUGINS_DATAFLOWORCHESTRATOR_HPP_
 
+#include "dfmodules/BusyPredictor.hpp"
+#include "dfmodules/DFOTrace.hpp"
+#include "dfmodules/DataVolumeEstimator.hpp"
+#include "dfmodules/SenderCache.hpp"
+#include "dfmodules/TriggerDecisionTokenBatch.hpp"
 #include "dfmodules/TriggerRecordBuilderData.hpp"
 
 #include "appmodel/DFOConf.hpp"
@@ -20,14 +25,20 @@
 #include "dfmessages/TriggerInhibit.hpp"
 #include "trgdataformats/TriggerCandidateData.hpp"
 
+#include "iomanager/Receiver.hpp"
 #include "iomanager/Sender.hpp"
 
 #include "appfwk/DAQModule.hpp"
 #include "logging/Logging.hpp"
+#include "utilities/WorkerThread.hpp"
 
+#include <array>
+#include <atomic>
+#include <condition_variable>
 #include <map>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 #include <mutex>
@@ -63,6 +74,13 @@ ERS_DECLARE_ISSUE(dfmodules,
                   "TriggerDecision " << trigger_number << " was assigned to DF app " << app << " that was busy with "
                                      << used_slots << " TDs",
                   ((uint32_t)trigger_number)((std::string)app)((size_t)used_slots)) // NOLINT(build/unsigned)
+ERS_DECLARE_ISSUE(dfmodules,
+                  StaleAssignmentsReclaimed,
+                  n_decisions << " TriggerDecisions assigned to DF app " << app << " were not completed within "
+                              << max_age_ms << " ms and have been reclaimed (trigger numbers " << first << " to "
+                              << last << ")",
+                  ((size_t)n_decisions)((std::string)app)((size_t)max_age_ms)((uint64_t)first)( // NOLINT(build/unsigned)
+                    (uint64_t)last))                                                             // NOLINT(build/unsigned)
 // Re-enable coverage checking LCOV_EXCL_STOP
 
 namespace dfmodules {
@@ -90,12 +108,24 @@ public:
 
 protected:
   virtual std::shared_ptr<AssignedTriggerDecision> find_slot(const dfmessages::TriggerDecision& decision);
-  // find_slot operates on a round-robin logic
+  // find_slot operates on a round-robin logic, or on the outstanding data volume if so configured
+  std::shared_ptr<AssignedTriggerDecision> find_least_loaded_slot(const dfmessages::TriggerDecision& decision);
 
   using trbd_ptr_t = std::shared_ptr<TriggerRecordBuilderData>;
-  using data_structure_t = std::map<std::string, trbd_ptr_t>;
-  data_structure_t m_dataflow_availability;
-  data_structure_t::iterator m_last_assignement_it;
+  // Dataflow applications are interned at registration: the application with
+  // id i is m_dataflow_apps[i], for i < m_n_dataflow_apps. Entries are only
+  // appended while running, so that the decision path can index them without locking.
+  static constexpr size_t s_max_dataflow_apps = 1024;
+  std::array<trbd_ptr_t, s_max_dataflow_apps> m_dataflow_apps;
+  std::atomic<size_t> m_n_dataflow_apps{ 0 };
+  std::unordered_map<std::string, dataflow_app_id_t> m_dataflow_app_ids; // only needed to resolve tokens
+  mutable std::mutex m_dataflow_app_ids_mutex;
+  size_t m_last_assigned_app{ 0 };
+  std::shared_ptr<DataflowOccupancy> m_occupancy; // aggregate over m_dataflow_apps
+  DataVolumeEstimator m_volume_estimator;
+  bool m_volume_aware_assignment{ false };
+  // the estimator is only used, and only learns, for the volume-aware assignment and the trace
+  bool needs_volume_estimates() const { return m_volume_aware_assignment || m_trace; }
   std::function<void(nlohmann::json&)> m_metadata_function;
 
 private:
@@ -108,53 +138,124 @@ private:
   void generate_opmon_data() override;
 
   virtual void receive_trigger_complete_token(const dfmessages::TriggerDecisionToken&);
-  void receive_trigger_decision(const dfmessages::TriggerDecision&);
+  void receive_trigger_complete_token_batch(const TriggerDecisionTokenBatch&);
+  void register_dataflow_app(const std::string& connection_name);
+  trbd_ptr_t find_dataflow_app(const std::string& connection_name) const; // nullptr if not registered
+  void update_app_after_completion(const trbd_ptr_t& app);
+  void learn_fragment_volumes(const std::vector<std::shared_ptr<AssignedTriggerDecision>>& completed,
+                              const std::vector<FragmentVolume>& volumes);
+  void receive_trigger_decision(dfmessages::TriggerDecision&);
+  // assigns the decisions in one pass over a snapshot of the occupancy, see do_receive_decisions
+  void receive_trigger_decisions(std::vector<dfmessages::TriggerDecision>&);
+  bool accept_decision(const dfmessages::TriggerDecision&); // run number check and counting
+  // assigns and sends one decision, retrying until it succeeds or the run stops, returns when the slot was found
+  std::chrono::steady_clock::time_point assign_decision(dfmessages::TriggerDecision& decision);
+  void plan_decision_batch(const std::vector<dfmessages::TriggerDecision>& decisions);
   virtual bool is_busy() const;
   bool is_empty() const;
   size_t used_slots() const;
+  bool evaluate_busy(); // is_busy(), or the predicted state when busy prediction is enabled
   void notify_trigger(bool busy) const;
-  bool dispatch(const std::shared_ptr<AssignedTriggerDecision>& assignment);
-  virtual void assign_trigger_decision(const std::shared_ptr<AssignedTriggerDecision>& assignment);
+  // sends the received decision itself, restoring it from the assignment if the send fails
+  bool dispatch(const std::shared_ptr<AssignedTriggerDecision>& assignment, dfmessages::TriggerDecision& decision);
 
   // Configuration
   const appmodel::DFOConf* m_dfo_conf;
   std::chrono::milliseconds m_queue_timeout;
-  std::chrono::microseconds m_stop_timeout;
+  std::chrono::milliseconds m_stop_timeout;
   dunedaq::daqdataformats::run_number_t m_run_number;
 
   // Connections
   std::shared_ptr<iomanager::SenderConcept<dfmessages::TriggerInhibit>> m_busy_sender;
+  SenderCache<dfmessages::TriggerDecision> m_decision_senders;
   std::string m_token_connection;
+  std::string m_token_batch_connection;
   std::string m_td_connection;
   size_t m_td_send_retries;
   size_t m_busy_threshold;
   size_t m_free_threshold;
+  double m_completion_sampling{ 1. }; // fraction of the completions published as TRCompleteInfo
+  std::unique_ptr<BusyPredictor> m_busy_predictor; // only set when busy_prediction_horizon_ms > 0
+  std::chrono::milliseconds m_busy_evaluation_period;
 
   // Coordination
   std::atomic<bool> m_running_status{ false };
   mutable std::atomic<bool> m_last_notified_busy{ false };
+  mutable std::mutex m_notify_mutex;
+  mutable std::atomic<uint64_t> m_busy_notifications{ 0 }; // NOLINT (build/unsigned)
+
+  // Threading, used when decision_batch_size > 1 to take the decisions already
+  // queued in the connection and to assign them together. Otherwise the decisions
+  // are received one by one by a callback
+  dunedaq::utilities::WorkerThread m_decision_thread;
+  void do_receive_decisions(std::atomic<bool>&);
+  size_t m_decision_batch_size{ 1 };
+  std::shared_ptr<iomanager::ReceiverConcept<dfmessages::TriggerDecision>> m_decision_receiver;
+  // working space of the decision thread, reused from batch to batch
+  struct AppSnapshot
+  {
+    bool in_error;
+    bool quarantined;
+    size_t free_slots;
+    size_t used_slots;
+    uint64_t bytes; // NOLINT(build/unsigned)
+  };
+  static constexpr size_t s_assign_individually = s_max_dataflow_apps; // values of m_batch_plan that are not app ids
+  static constexpr size_t s_batch_done = s_max_dataflow_apps + 1;
+  std::vector<dfmessages::TriggerDecision> m_decision_batch;
+  std::vector<AppSnapshot> m_batch_snapshot;
+  std::vector<size_t> m_batch_plan;    // destination of each decision of the batch
+  std::vector<uint64_t> m_batch_bytes; // NOLINT(build/unsigned) estimated volume of each decision of the batch
+  std::atomic<uint64_t> m_decision_batches{ 0 }; // NOLINT (build/unsigned)
+  std::vector<std::shared_ptr<AssignedTriggerDecision>> m_completed_batch; // reused by the token batches
+
+  // Threading, used to re-evaluate the predicted busy state while no decisions or tokens arrive
+  dunedaq::utilities::WorkerThread m_busy_thread;
+  void do_busy_evaluation(std::atomic<bool>&);
+
+  // Optional trace of decisions, assignments and completions, see DFOTrace.hpp.
+  // Applications are added to the trace in id order, so trace indices are the dataflow_app_id_t
+  std::unique_ptr<DFOTraceWriter> m_trace;
+  void open_trace();
+  void close_trace();
+
+  // Threading, used to reclaim the assignments whose token never came
+  dunedaq::utilities::WorkerThread m_reclaim_thread;
+  void do_reclaim_stale_assignments(std::atomic<bool>&);
+  std::chrono::milliseconds m_assignment_max_age; // 0 disables the reclaim
+
+  // Threading, used to score the applications by their completion latency
+  // and to quarantine the slow ones
+  dunedaq::utilities::WorkerThread m_health_thread;
+  void do_health_evaluation(std::atomic<bool>&);
+  std::chrono::milliseconds m_health_period; // 0 disables the scoring
+  double m_health_degraded_factor;
+  double m_health_quarantine_factor;
+  std::chrono::milliseconds m_quarantine_time;
   std::chrono::steady_clock::time_point m_last_token_received;
   std::chrono::steady_clock::time_point m_last_td_received;
+  std::mutex m_drain_mutex; // used with m_drain_cv to wait for the outstanding assignments at stop
+  std::condition_variable m_drain_cv;
 
-  // Struct for statistic
-  struct TriggerData {
+  // Struct for statistic, one cache line each so that the decision and token
+  // threads updating counters of different trigger types do not share lines
+  struct alignas(64) TriggerData {
     std::atomic<uint64_t> received{0};
     std::atomic<uint64_t> completed{0};
   };
-  static std::set<trgdataformats::TriggerCandidateData::Type>
-  unpack_types( decltype(dfmessages::TriggerDecision::trigger_type) t) {
-    std::set<trgdataformats::TriggerCandidateData::Type> results;
-    if (t == dfmessages::TypeDefaults::s_invalid_trigger_type)
-      return results;
-    const std::bitset<64> bits(t);
-    for( size_t i = 0; i < bits.size(); ++i ) {
-      if ( bits[i] ) results.insert((trgdataformats::TriggerCandidateData::Type)i);
+  using trigger_type_t = decltype(dfmessages::TriggerDecision::trigger_type);
+  static constexpr size_t s_max_trigger_types = 64; // trigger types are bit positions in trigger_type_t
+  template<typename Function>
+  static void for_each_type( uint64_t bits, Function f ) { // NOLINT (build/unsigned)
+    while ( bits != 0 ) {
+      f( static_cast<size_t>(__builtin_ctzll(bits)) );
+      bits &= bits - 1;
     }
-    return results;
   }
-  
+
   // Statistics
   std::atomic<uint64_t> m_received_tokens{ 0 };      // NOLINT (build/unsigned)
+  std::atomic<uint64_t> m_received_token_batches{ 0 }; // NOLINT (build/unsigned)
   std::atomic<uint64_t> m_sent_decisions{ 0 };       // NOLINT (build/unsigned)
   std::atomic<uint64_t> m_received_decisions{ 0 };   // NOLINT (build/unsigned)
   std::atomic<uint64_t> m_waiting_for_decision{ 0 }; // NOLINT (build/unsigned)
@@ -162,16 +263,21 @@ private:
   std::atomic<uint64_t> m_forwarding_decision{ 0 };  // NOLINT (build/unsigned)
   std::atomic<uint64_t> m_waiting_for_token{ 0 };    // NOLINT (build/unsigned)
   std::atomic<uint64_t> m_processing_token{ 0 };     // NOLINT (build/unsigned)
-  std::map<dunedaq::trgdataformats::TriggerCandidateData::Type, TriggerData> m_trigger_counters;
-  std::mutex m_trigger_mutex;  // used to safely handle the map above
-  TriggerData & get_trigger_counter(trgdataformats::TriggerCandidateData::Type type) {
-    auto it = m_trigger_counters.find(type);
-    if (it != m_trigger_counters.end()) return it->second;
-    
-    std::lock_guard<std::mutex> guard(m_trigger_mutex);
-    return m_trigger_counters[type];
+  std::atomic<uint64_t> m_drain_time{ 0 };           // NOLINT (build/unsigned)
+  std::array<TriggerData, s_max_trigger_types> m_trigger_counters;
+  std::atomic<uint64_t> m_seen_trigger_types{ 0 }; // NOLINT (build/unsigned) bit mask of types counted in this run
+  void count_received_types(trigger_type_t t) {
+    if (t == dfmessages::TypeDefaults::s_invalid_trigger_type)
+      return;
+    m_seen_trigger_types.fetch_or(t, std::memory_order_relaxed);
+    for_each_type(t, [this](size_t i) { m_trigger_counters[i].received.fetch_add(1, std::memory_order_relaxed); });
+  }
+  void count_completed_types(trigger_type_t t) {
+    if (t == dfmessages::TypeDefaults::s_invalid_trigger_type)
+      return;
+    m_seen_trigger_types.fetch_or(t, std::memory_order_relaxed);
+    for_each_type(t, [this](size_t i) { m_trigger_counters[i].completed.fetch_add(1, std::memory_order_relaxed); });
   }
-  
 };
 } // namespace dfmodules
 } // namespace dunedaq
@@ -26,6 +26,7 @@
 #include <algorithm>
 #include <cstdlib>
 #include <memory>
+#include <optional>
 #include <string>
 #include <thread>
 #include <utility>
@@ -52,6 +53,8 @@ DataWriterModule::DataWriterModule(const std::string& name)
   , m_queue_timeout(100)
   , m_data_storage_is_enabled(true)
   , m_thread(std::bind(&DataWriterModule::do_work, this, std::placeholders::_1))
+  , m_write_queue_capacity(0)
+  , m_token_thread(std::bind(&DataWriterModule::do_send_tokens, this, std::placeholders::_1))
 {
   register_command("conf", &DataWriterModule::do_conf);
   register_command("start", &DataWriterModule::do_start);
@@ -87,7 +90,8 @@ DataWriterModule::init(std::shared_ptr<appfwk::ModuleConfiguration> mcfg)
   if (inputs[0]->get_data_type() != datatype_to_string<std::unique_ptr<daqdataformats::TriggerRecord>>()) {
     throw InvalidQueueFatalError(ERS_HERE, get_name(), "TriggerRecord Input queue"); 
   }
-  if (outputs[0]->get_data_type() != datatype_to_string<dfmessages::TriggerDecisionToken>()) {
+  if (outputs[0]->get_data_type() != datatype_to_string<dfmessages::TriggerDecisionToken>() &&
+      outputs[0]->get_data_type() != datatype_to_string<TriggerDecisionTokenBatch>()) {
     throw InvalidQueueFatalError(ERS_HERE, get_name(), "TriggerDecisionToken Output queue"); 
   }
 
@@ -115,7 +119,12 @@ DataWriterModule::init(std::shared_ptr<appfwk::ModuleConfiguration> mcfg)
   // try to create the receiver to see test the connection anyway
   m_tr_receiver = iom -> get_receiver<std::unique_ptr<daqdataformats::TriggerRecord>>(m_trigger_record_connection);
 
-  m_token_output = iom->get_sender<dfmessages::TriggerDecisionToken>(outputs[0]->UID());
+  // the data type of the token connection selects between single and batched tokens
+  if (outputs[0]->get_data_type() == datatype_to_string<TriggerDecisionTokenBatch>()) {
+    m_token_batch_output = iom->get_sender<TriggerDecisionTokenBatch>(outputs[0]->UID());
+  } else {
+    m_token_output = iom->get_sender<dfmessages::TriggerDecisionToken>(outputs[0]->UID());
+  }
   
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting init() method";
 }
@@ -132,6 +141,22 @@ DataWriterModule::generate_opmon_data() {
 //   dwi.bytes_output = m_bytes_output_tot.load();  MR: byte writing to be delegated to DataStorage
 //   dwi.new_bytes_output = m_bytes_output.exchange(0);  
   dwi.set_writing_time_us(m_writing_us.exchange(0));
+  if (m_write_queue_capacity > 0) {
+    size_t records = 0;
+    size_t bytes = 0;
+    for (const auto& lane : m_lanes) {
+      records += lane->queue.size();
+      bytes += lane->queue.bytes();
+    }
+    dwi.set_write_queue_records(records);
+    dwi.set_write_queue_bytes(bytes);
+    dwi.set_token_queue_records(m_token_queue.size());
+    dwi.set_receive_blocked_time_us(m_receive_blocked_us.exchange(0));
+    dwi.set_write_queue_time_us(m_write_queue_us.exchange(0));
+    dwi.set_token_queue_time_us(m_token_queue_us.exchange(0));
+    dwi.set_token_sending_time_us(m_token_sending_us.exchange(0));
+    dwi.set_early_tokens(m_early_tokens.exchange(0));
+  }
 
   publish(std::move(dwi));
 }
@@ -150,21 +175,63 @@ DataWriterModule::do_conf(const data_t&)
   }
   m_max_write_retry_time_usec = m_data_writer_conf->get_max_write_retry_time_ms() * 1000;
   m_write_retry_time_increase_factor = m_data_writer_conf->get_write_retry_time_increase_factor();
+  m_token_batch_size = m_data_writer_conf->get_token_batch_size();
+  if (m_token_batch_size < 1) {
+    m_token_batch_size = 1;
+  }
+  m_token_batch_timeout = std::chrono::milliseconds(m_data_writer_conf->get_token_batch_timeout_ms());
+  m_report_fragment_volumes = m_token_batch_output && m_data_writer_conf->get_report_fragment_volumes();
+  if (m_token_batch_output) {
+    TLOG_DEBUG(TLVL_CONFIG) << get_name() << ": tokens are batched, up to " << m_token_batch_size
+                            << " per message or " << m_token_batch_timeout.count() << " ms";
+  }
+  m_write_queue_capacity = m_data_writer_conf->get_write_queue_capacity_bytes();
+  m_write_batch_size = std::max<size_t>(m_data_writer_conf->get_write_batch_size(), 1);
+  m_early_token_release = m_write_queue_capacity > 0 && m_data_writer_conf->get_early_token_release();
+  if (m_write_queue_capacity > 0) {
+    TLOG_DEBUG(TLVL_CONFIG) << get_name() << ": pipelined mode, up to " << m_write_queue_capacity
+                            << " bytes of records waiting to be written in each lane"
+                            << (m_early_token_release ? ", tokens sent when the records are queued" : "");
+  } else if (m_data_writer_conf->get_early_token_release()) {
+    TLOG() << get_name() << ": early token release ignored, it needs write_queue_capacity_bytes to be set";
+  }
 
-  // create the DataStore instance here
-  try {
-    m_data_writer = make_data_store(m_data_writer_conf->get_data_store_params()->get_type(),
-                                    m_data_writer_conf->get_data_store_params()->UID(),
-                                    m_module_configuration, m_writer_identifier);
-    register_node("data_writer", m_data_writer);
-  } catch (const ers::Issue& excpt) {
-    throw UnableToConfigure(ERS_HERE, get_name(), excpt);
+  // each lane has its own DataStore configuration, hence its own output directory.
+  // Without lanes, the single DataStore of the module is used
+  std::vector<const appmodel::DataStoreConf*> lane_params = m_data_writer_conf->get_lane_data_store_params();
+  if (lane_params.empty()) {
+    lane_params.push_back(m_data_writer_conf->get_data_store_params());
+  }
+  if (lane_params.size() > 1 && m_write_queue_capacity == 0) {
+    throw InvalidWriterLanes(ERS_HERE, get_name(), lane_params.size());
   }
+  m_least_loaded_lane = m_data_writer_conf->get_lane_assignment() == "least_loaded";
+
+  // create the DataStore instances here
+  m_lanes.clear();
+  for (size_t i = 0; i < lane_params.size(); ++i) {
+    auto lane = std::make_unique<WriterLane>();
+    // the writer identifier ends up in the file names, it must differ between lanes
+    auto identifier = lane_params.size() > 1 ? m_writer_identifier + "_lane" + std::to_string(i) : m_writer_identifier;
+    try {
+      lane->data_store =
+        make_data_store(lane_params[i]->get_type(), lane_params[i]->UID(), m_module_configuration, identifier);
+      register_node(i == 0 ? std::string("data_writer") : "data_writer_lane" + std::to_string(i), lane->data_store);
+    } catch (const ers::Issue& excpt) {
+      throw UnableToConfigure(ERS_HERE, get_name(), excpt);
+    }
 
-  // ensure that we have a valid dataWriter instance
-  if (m_data_writer.get() == nullptr) {
-    throw InvalidDataWriterModule(ERS_HERE, get_name());
+    // ensure that we have a valid dataWriter instance
+    if (lane->data_store.get() == nullptr) {
+      throw InvalidDataWriterModule(ERS_HERE, get_name());
+    }
+
+    lane->queue.set_capacity(m_write_queue_capacity);
+    lane->thread = std::make_unique<dunedaq::utilities::WorkerThread>(
+      std::bind(&DataWriterModule::do_write, this, i, std::placeholders::_1));
+    m_lanes.push_back(std::move(lane));
   }
+  TLOG_DEBUG(TLVL_CONFIG) << get_name() << ": " << m_lanes.size() << " writer lane(s)";
 
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_conf() method";
 }
@@ -184,14 +251,25 @@ DataWriterModule::do_start(const data_t& payload)
   token.trigger_number = 0;
   token.decision_destination = m_trigger_decision_connection;
 
+  // an empty batch with run number 0 is the batched equivalent of the (0, 0) token
+  TriggerDecisionTokenBatch announcement;
+  announcement.run_number = 0;
+  announcement.decision_destination = m_trigger_decision_connection;
+
   int wasSentSuccessfully = 5;
   do {
     try {
-      m_token_output->send(std::move(token), m_queue_timeout);
+      if (m_token_batch_output) {
+        m_token_batch_output->send(std::move(announcement), m_queue_timeout);
+      } else {
+        m_token_output->send(std::move(token), m_queue_timeout);
+      }
       wasSentSuccessfully = 0;
     } catch (const ers::Issue& excpt) {
       std::ostringstream oss_warn;
-      oss_warn << "Send with sender \"" << m_token_output->get_name() << "\" failed";
+      oss_warn << "Send with sender \""
+               << (m_token_batch_output ? m_token_batch_output->get_name() : m_token_output->get_name())
+               << "\" failed";
       ers::warning(iomanager::OperationFailed(ERS_HERE, oss_warn.str(), excpt));
       wasSentSuccessfully--;
       std::this_thread::sleep_for(std::chrono::microseconds(5000));
@@ -205,20 +283,35 @@ DataWriterModule::do_start(const data_t& payload)
   if (m_data_storage_is_enabled) {
 
     // ensure that we have a valid dataWriter instance
-    if (m_data_writer.get() == nullptr) {
+    if (m_lanes.empty()) {
       // this check is done essentially to notify the user
       // in case the "start" has been called before the "conf"
       ers::fatal(InvalidDataWriterModule(ERS_HERE, get_name()));
     }
     
-    try {
-      m_data_writer->prepare_for_run(m_run_number, (start_params.production_vs_test == "TEST"));
-    } catch (const ers::Issue& excpt) {
-      throw UnableToStart(ERS_HERE, get_name(), m_run_number, excpt);
+    // a lane that fails to prepare does not leave the lanes prepared before
+    // it with a run in progress
+    for (size_t i = 0; i < m_lanes.size(); ++i) {
+      try {
+        m_lanes[i]->data_store->prepare_for_run(m_run_number, (start_params.production_vs_test == "TEST"));
+      } catch (const ers::Issue& excpt) {
+        for (size_t j = 0; j < i; ++j) {
+          try {
+            m_lanes[j]->data_store->finish_with_run(m_run_number);
+          } catch (const std::exception& finish_excpt) {
+            ers::error(ProblemDuringStop(ERS_HERE, get_name(), m_run_number, finish_excpt));
+          }
+        }
+        throw UnableToStart(ERS_HERE, get_name(), m_run_number, excpt);
+      }
     }
   }
 
   m_seqno_counts.clear();
+  m_volume_sample_wanted = m_report_fragment_volumes;
+  m_pending_token_batch.trigger_numbers.clear();
+  m_pending_token_batch.trigger_numbers.reserve(m_token_batch_size);
+  m_pending_token_batch.fragment_volumes.clear();
   
   m_records_received = 0;
   m_records_received_tot = 0;
@@ -226,9 +319,20 @@ DataWriterModule::do_start(const data_t& payload)
   m_records_written_tot = 0;
   m_bytes_output = 0;
   m_bytes_output_tot = 0;
+  m_receive_blocked_us = 0;
+  m_write_queue_us = 0;
+  m_token_queue_us = 0;
+  m_token_sending_us = 0;
+  m_early_tokens = 0;
 
   m_running.store(true);
 
+  if (m_write_queue_capacity > 0) {
+    m_token_thread.start_working_thread(get_name() + "-tokens");
+    for (size_t i = 0; i < m_lanes.size(); ++i) {
+      m_lanes[i]->thread->start_working_thread(get_name() + "-writer" + std::to_string(i));
+    }
+  }
   m_thread.start_working_thread(get_name());
   //iomanager::IOManager::get()->add_callback<std::unique_ptr<daqdataformats::TriggerRecord>>( m_trigger_record_connection,
   //											     bind( &DataWriterModule::receive_trigger_record, this, std::placeholders::_1) );
@@ -244,16 +348,28 @@ DataWriterModule::do_stop(const data_t& /*args*/)
 
   m_running.store(false);
   m_thread.stop_working_thread(); 
+  // the pipeline stages finish the records already received, in order
+  for (auto& lane : m_lanes) {
+    if (lane->thread->thread_running()) {
+      lane->thread->stop_working_thread();
+    }
+  }
+  if (m_token_thread.thread_running()) {
+    m_token_thread.stop_working_thread();
+  }
   //iomanager::IOManager::get()->remove_callback<std::unique_ptr<daqdataformats::TriggerRecord>>( m_trigger_record_connection );
 
   // 04-Feb-2021, KAB: added this call to allow DataStore to finish up with this run.
   // I've put this call fairly late in this method so that any draining of queues
   // (or whatever) can take place before we finalize things in the DataStore.
   if (m_data_storage_is_enabled) {
-    try {
-      m_data_writer->finish_with_run(m_run_number);
-    } catch (const std::exception& excpt) {
-      ers::error(ProblemDuringStop(ERS_HERE, get_name(), m_run_number, excpt));
+    // each lane is finished, whatever happened to the others
+    for (auto& lane : m_lanes) {
+      try {
+        lane->data_store->finish_with_run(m_run_number);
+      } catch (const std::exception& excpt) {
+        ers::error(ProblemDuringStop(ERS_HERE, get_name(), m_run_number, excpt));
+      }
     }
   }
 
@@ -267,83 +383,191 @@ DataWriterModule::do_scrap(const data_t& /*payload*/)
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_scrap() method";
 
   // clear/reset the DataStore instance here
-  m_data_writer.reset();
+  m_lanes.clear();
 
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_scrap() method";
 }
 
 void
 DataWriterModule::receive_trigger_record(std::unique_ptr<daqdataformats::TriggerRecord> & trigger_record_ptr)
+{
+  if (!accept_trigger_record(*trigger_record_ptr))
+    return;
+
+  if (should_write_trigger_record())
+    write_trigger_record(*trigger_record_ptr, *m_lanes.front()->data_store);
+
+  const auto& header = trigger_record_ptr->get_header_ref();
+  if (take_volume_sample(*trigger_record_ptr)) {
+    fragment_volumes_t volumes;
+    collect_fragment_volumes(*trigger_record_ptr, volumes);
+    add_volume_sample(header.get_trigger_number(), volumes);
+  }
+  complete_trigger_record(header.get_trigger_number(), header.get_max_sequence_number());
+
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": operations completed for TR";
+}
+
+bool
+DataWriterModule::accept_trigger_record(const daqdataformats::TriggerRecord& trigger_record)
 {
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": receiving a new TR ptr";
 
   ++m_records_received;
   ++m_records_received_tot;
   TLOG_DEBUG(TLVL_WORK_STEPS) << get_name() << ": Obtained the TriggerRecord for trigger number "
-			      << trigger_record_ptr->get_header_ref().get_trigger_number() << "."
-			      << trigger_record_ptr->get_header_ref().get_sequence_number()
-			      << ", run number " << trigger_record_ptr->get_header_ref().get_run_number()
+			      << trigger_record.get_header_ref().get_trigger_number() << "."
+			      << trigger_record.get_header_ref().get_sequence_number()
+			      << ", run number " << trigger_record.get_header_ref().get_run_number()
 			      << " off the input connection";
 
-  if (trigger_record_ptr->get_header_ref().get_run_number() != m_run_number) {
-    ers::error(InvalidRunNumber(ERS_HERE, get_name(), "TriggerRecord", trigger_record_ptr->get_header_ref().get_run_number(),
-                                m_run_number, trigger_record_ptr->get_header_ref().get_trigger_number(),
-                                trigger_record_ptr->get_header_ref().get_sequence_number()));
-    return;
+  if (trigger_record.get_header_ref().get_run_number() != m_run_number) {
+    ers::error(InvalidRunNumber(ERS_HERE, get_name(), "TriggerRecord", trigger_record.get_header_ref().get_run_number(),
+                                m_run_number, trigger_record.get_header_ref().get_trigger_number(),
+                                trigger_record.get_header_ref().get_sequence_number()));
+    return false;
   }
+  return true;
+}
 
+bool
+DataWriterModule::should_write_trigger_record() const
+{
   // 03-Feb-2021, KAB: adding support for a data-storage prescale.
   // In this "if" statement, I deliberately compare the result of (N mod prescale) to 1
   // instead of zero, since I think that it would be nice to always get the first event
   // written out.
-  if (m_data_storage_prescale <= 1 || ((m_records_received_tot.load() % m_data_storage_prescale) == 1)) {
-    
-    if (m_data_storage_is_enabled) {
-
-      std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
-      
-      bool should_retry = true;
-      size_t retry_wait_usec = m_min_write_retry_time_usec;
-      do {
-	should_retry = false;
-	try {
-	  m_data_writer->write(*trigger_record_ptr);
-	  ++m_records_written;
-	  ++m_records_written_tot;
-	  m_bytes_output += trigger_record_ptr->get_total_size_bytes();
-	  m_bytes_output_tot += trigger_record_ptr->get_total_size_bytes();
-	} catch (const RetryableDataStoreProblem& excpt) {
-	  should_retry = true;
-	  ers::error(DataWritingProblem(ERS_HERE,
-					get_name(),
-					trigger_record_ptr->get_header_ref().get_trigger_number(),
-					trigger_record_ptr->get_header_ref().get_sequence_number(),
-					trigger_record_ptr->get_header_ref().get_run_number(),
-					excpt));
-	  if (retry_wait_usec > m_max_write_retry_time_usec) {
-	    retry_wait_usec = m_max_write_retry_time_usec;
-	  }
-	  usleep(retry_wait_usec);
-	  retry_wait_usec *= m_write_retry_time_increase_factor;
-	} catch (const std::exception& excpt) {
-	  ers::error(DataWritingProblem(ERS_HERE,
-					get_name(),
-					trigger_record_ptr->get_header_ref().get_trigger_number(),
-					trigger_record_ptr->get_header_ref().get_sequence_number(),
-					trigger_record_ptr->get_header_ref().get_run_number(),
-					excpt));
-	}
-      } while (should_retry && m_running.load());
-
-      std::chrono::steady_clock::time_point end_time = std::chrono::steady_clock::now();
-      auto writing_time = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
-      m_writing_us += writing_time.count();
-    } //  if m_data_storage_is_enabled
+  return m_data_storage_is_enabled &&
+         (m_data_storage_prescale <= 1 || ((m_records_received_tot.load() % m_data_storage_prescale) == 1));
+}
+
+void
+DataWriterModule::write_trigger_record(const daqdataformats::TriggerRecord& trigger_record, DataStore& data_store)
+{
+  std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+  bool should_retry = true;
+  size_t retry_wait_usec = m_min_write_retry_time_usec;
+  do {
+    should_retry = false;
+    try {
+      data_store.write(trigger_record);
+      ++m_records_written;
+      ++m_records_written_tot;
+      m_bytes_output += trigger_record.get_total_size_bytes();
+      m_bytes_output_tot += trigger_record.get_total_size_bytes();
+    } catch (const RetryableDataStoreProblem& excpt) {
+      should_retry = true;
+      ers::error(DataWritingProblem(ERS_HERE,
+                                    get_name(),
+                                    trigger_record.get_header_ref().get_trigger_number(),
+                                    trigger_record.get_header_ref().get_sequence_number(),
+                                    trigger_record.get_header_ref().get_run_number(),
+                                    excpt));
+      if (retry_wait_usec > m_max_write_retry_time_usec) {
+        retry_wait_usec = m_max_write_retry_time_usec;
+      }
+      usleep(retry_wait_usec);
+      retry_wait_usec *= m_write_retry_time_increase_factor;
+    } catch (const std::exception& excpt) {
+      ers::error(DataWritingProblem(ERS_HERE,
+                                    get_name(),
+                                    trigger_record.get_header_ref().get_trigger_number(),
+                                    trigger_record.get_header_ref().get_sequence_number(),
+                                    trigger_record.get_header_ref().get_run_number(),
+                                    excpt));
+    }
+  } while (should_retry && m_running.load());
+
+  std::chrono::steady_clock::time_point end_time = std::chrono::steady_clock::now();
+  auto writing_time = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
+  m_writing_us += writing_time.count();
+}
+
+void
+DataWriterModule::write_trigger_records(std::vector<const daqdataformats::TriggerRecord*>& records,
+                                        DataStore& data_store)
+{
+  std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+  // the records written are removed from the front, the retries are for the remaining ones
+  size_t retry_wait_usec = m_min_write_retry_time_usec;
+  while (!records.empty()) {
+    const auto& first = records.front()->get_header_ref();
+    try {
+      auto written = data_store.write_batch(records);
+      for (size_t i = 0; i < written; ++i) {
+        ++m_records_written;
+        ++m_records_written_tot;
+        m_bytes_output += records[i]->get_total_size_bytes();
+        m_bytes_output_tot += records[i]->get_total_size_bytes();
+      }
+      records.erase(records.begin(), records.begin() + written);
+      retry_wait_usec = m_min_write_retry_time_usec;
+    } catch (const RetryableDataStoreProblem& excpt) {
+      ers::error(DataWritingProblem(ERS_HERE,
+                                    get_name(),
+                                    first.get_trigger_number(),
+                                    first.get_sequence_number(),
+                                    first.get_run_number(),
+                                    excpt));
+      if (!m_running.load())
+        break;
+      if (retry_wait_usec > m_max_write_retry_time_usec) {
+        retry_wait_usec = m_max_write_retry_time_usec;
+      }
+      usleep(retry_wait_usec);
+      retry_wait_usec *= m_write_retry_time_increase_factor;
+    } catch (const std::exception& excpt) {
+      // as for a single record, a record that cannot be written is given up
+      ers::error(DataWritingProblem(ERS_HERE,
+                                    get_name(),
+                                    first.get_trigger_number(),
+                                    first.get_sequence_number(),
+                                    first.get_run_number(),
+                                    excpt));
+      records.erase(records.begin());
+    }
   }
-  
+
+  std::chrono::steady_clock::time_point end_time = std::chrono::steady_clock::now();
+  auto writing_time = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
+  m_writing_us += writing_time.count();
+}
+
+void
+DataWriterModule::collect_fragment_volumes(const daqdataformats::TriggerRecord& trigger_record,
+                                           fragment_volumes_t& volumes) const
+{
+  // the data volume of each SourceID is reported to the DFO with the token
+  for (const auto& fragment : trigger_record.get_fragments_ref()) {
+    volumes[fragment->get_element_id()] += fragment->get_size();
+  }
+}
+
+bool
+DataWriterModule::take_volume_sample(const daqdataformats::TriggerRecord& trigger_record)
+{
+  // the flag is only exchanged when set, records are not sampled most of the time
+  return m_report_fragment_volumes && trigger_record.get_header_ref().get_max_sequence_number() == 0 &&
+         m_volume_sample_wanted.load(std::memory_order_relaxed) && m_volume_sample_wanted.exchange(false);
+}
+
+void
+DataWriterModule::add_volume_sample(daqdataformats::trigger_number_t trigger_number, const fragment_volumes_t& volumes)
+{
+  // added before the token of the record, so that both are in the same batch
+  for (const auto& [source_id, bytes] : volumes) {
+    m_pending_token_batch.fragment_volumes.push_back(FragmentVolume{ trigger_number, source_id, bytes });
+  }
+}
+
+void
+DataWriterModule::complete_trigger_record(daqdataformats::trigger_number_t trigno,
+                                          daqdataformats::sequence_number_t max_sequence_number)
+{
   bool send_trigger_complete_message = m_running.load();
-  if (trigger_record_ptr->get_header_ref().get_max_sequence_number() > 0) {
-    daqdataformats::trigger_number_t trigno = trigger_record_ptr->get_header_ref().get_trigger_number();
+  if (max_sequence_number > 0) {
     if (m_seqno_counts.count(trigno) > 0) {
       ++m_seqno_counts[trigno];
     } else {
@@ -351,7 +575,7 @@ DataWriterModule::receive_trigger_record(std::unique_ptr<daqdataformats::Trigger
     }
     // in the following comparison GT (>) is used since the counts are one-based and the
     // max sequence number is zero-based.
-    if (m_seqno_counts[trigno] > trigger_record_ptr->get_header_ref().get_max_sequence_number()) {
+    if (m_seqno_counts[trigno] > max_sequence_number) {
       m_seqno_counts.erase(trigno);
     } else {
       // Using const .count and .at to avoid reintroducing element to map
@@ -362,43 +586,225 @@ DataWriterModule::receive_trigger_record(std::unique_ptr<daqdataformats::Trigger
     }
   }
   if (send_trigger_complete_message) {
-    TLOG_DEBUG(TLVL_WORK_STEPS) << get_name() << ": Pushing the TriggerDecisionToken for trigger number "
-				<< trigger_record_ptr->get_header_ref().get_trigger_number()
-				<< " onto the relevant output queue";
-    dfmessages::TriggerDecisionToken token;
-    token.run_number = m_run_number;
-    token.trigger_number = trigger_record_ptr->get_header_ref().get_trigger_number();
-    token.decision_destination = m_trigger_decision_connection;
-
-    bool wasSentSuccessfully = false;
-    do { 
-      try {
-	m_token_output -> send( std::move(token), m_queue_timeout );
-	wasSentSuccessfully = true;
-      } catch (const ers::Issue& excpt) {
-	std::ostringstream oss_warn;
-	oss_warn << "Send with sender \"" << m_token_output -> get_name() << "\" failed";
-	ers::warning(iomanager::OperationFailed(ERS_HERE, oss_warn.str(), excpt));
-      }
-    } while (!wasSentSuccessfully && m_running.load());
+    send_token(trigno);
+  }
+}
 
+void
+DataWriterModule::send_token(daqdataformats::trigger_number_t trigger_number)
+{
+  if (m_token_batch_output) {
+    if (m_pending_token_batch.trigger_numbers.empty()) {
+      m_pending_token_batch_start = std::chrono::steady_clock::now();
+    }
+    m_pending_token_batch.trigger_numbers.push_back(trigger_number);
+    if (m_pending_token_batch.trigger_numbers.size() >= m_token_batch_size) {
+      flush_token_batch();
+    }
+    return;
   }
-  
-  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": operations completed for TR";
-} // NOLINT(readability/fn_size)
+
+  TLOG_DEBUG(TLVL_WORK_STEPS) << get_name() << ": Pushing the TriggerDecisionToken for trigger number "
+                              << trigger_number << " onto the relevant output queue";
+  dfmessages::TriggerDecisionToken token;
+  token.run_number = m_run_number;
+  token.trigger_number = trigger_number;
+  token.decision_destination = m_trigger_decision_connection;
+
+  bool wasSentSuccessfully = false;
+  do { 
+    try {
+      m_token_output -> send( std::move(token), m_queue_timeout );
+      wasSentSuccessfully = true;
+    } catch (const ers::Issue& excpt) {
+      std::ostringstream oss_warn;
+      oss_warn << "Send with sender \"" << m_token_output -> get_name() << "\" failed";
+      ers::warning(iomanager::OperationFailed(ERS_HERE, oss_warn.str(), excpt));
+    }
+  } while (!wasSentSuccessfully && m_running.load());
+}
+
+void
+DataWriterModule::flush_token_batch()
+{
+  if (m_pending_token_batch.trigger_numbers.empty()) {
+    return;
+  }
+
+  TLOG_DEBUG(TLVL_WORK_STEPS) << get_name() << ": Pushing a TriggerDecisionTokenBatch with "
+                              << m_pending_token_batch.trigger_numbers.size()
+                              << " trigger numbers onto the relevant output queue";
+  m_pending_token_batch.run_number = m_run_number;
+  m_pending_token_batch.decision_destination = m_trigger_decision_connection;
+  bool carried_sample = !m_pending_token_batch.fragment_volumes.empty();
+
+  bool wasSentSuccessfully = false;
+  do {
+    try {
+      m_token_batch_output->send(std::move(m_pending_token_batch), m_queue_timeout);
+      wasSentSuccessfully = true;
+    } catch (const ers::Issue& excpt) {
+      std::ostringstream oss_warn;
+      oss_warn << "Send with sender \"" << m_token_batch_output->get_name() << "\" failed";
+      ers::warning(iomanager::OperationFailed(ERS_HERE, oss_warn.str(), excpt));
+    }
+  } while (!wasSentSuccessfully && m_running.load());
+
+  m_pending_token_batch.trigger_numbers.clear();
+  m_pending_token_batch.trigger_numbers.reserve(m_token_batch_size);
+  m_pending_token_batch.fragment_volumes.clear();
+  if (carried_sample) {
+    m_volume_sample_wanted = true;
+  }
+}
 
 void
 DataWriterModule::do_work(std::atomic<bool>& running_flag) {
   while (running_flag.load()) {
 	  try {
 		std::unique_ptr<daqdataformats::TriggerRecord> tr = m_tr_receiver-> receive(std::chrono::milliseconds(10));   
-                receive_trigger_record(tr);
+		if (m_write_queue_capacity == 0) {
+		  receive_trigger_record(tr);
+		} else if (accept_trigger_record(*tr)) {
+		  // the decision to write is taken here, where the records are counted
+		  auto bytes = tr->get_total_size_bytes();
+		  std::optional<TokenItem> token;
+		  if (m_early_token_release)
+		    token = make_token_item(*tr);
+		  WriteItem item{ std::move(tr), should_write_trigger_record(), std::chrono::steady_clock::now() };
+		  m_receive_blocked_us += select_lane(*item.record).queue.push(std::move(item), bytes).count();
+		  // once the record is in the write-behind buffer its slot is released. When the
+		  // buffer is full the push above waits, and so does the token
+		  if (token) {
+		    token->queued = std::chrono::steady_clock::now();
+		    m_token_queue.push(std::move(*token), 1);
+		    ++m_early_tokens;
+		  }
+		}
 	  }
 	  catch(const iomanager::TimeoutExpired& excpt) {
 	  }
 	  catch(const ers::Issue & excpt) {
 		ers::warning(excpt);
 	  }
+
+	  if (m_write_queue_capacity == 0) {
+		flush_token_batch_if_old();
+	  }
+  }
+
+  if (m_token_batch_output && m_write_queue_capacity == 0) {
+	  flush_token_batch();
+  }
+}
+
+void
+DataWriterModule::flush_token_batch_if_old()
+{
+  // batched tokens are also flushed when the oldest one has waited long enough
+  if (m_token_batch_output && !m_pending_token_batch.trigger_numbers.empty() &&
+      std::chrono::steady_clock::now() - m_pending_token_batch_start >= m_token_batch_timeout) {
+    flush_token_batch();
+  }
+}
+
+DataWriterModule::WriterLane&
+DataWriterModule::select_lane(const daqdataformats::TriggerRecord& trigger_record)
+{
+  if (m_lanes.size() == 1)
+    return *m_lanes.front();
+
+  if (m_least_loaded_lane) {
+    // the sequences of a trigger may be written by different lanes, the token
+    // thread still sends the token only when all of them are done
+    auto lane_it = std::min_element(m_lanes.begin(), m_lanes.end(), [](const auto& a, const auto& b) {
+      return a->queue.bytes() < b->queue.bytes();
+    });
+    return **lane_it;
+  }
+  return *m_lanes[trigger_record.get_header_ref().get_trigger_number() % m_lanes.size()];
+}
+
+void
+DataWriterModule::do_write(size_t lane_index, std::atomic<bool>& running_flag)
+{
+  auto& lane = *m_lanes[lane_index];
+  std::vector<WriteItem> batch;
+  std::vector<const daqdataformats::TriggerRecord*> records;
+  batch.reserve(m_write_batch_size);
+  records.reserve(m_write_batch_size);
+
+  // the records already received are written even after the stop, this thread
+  // is stopped after the receiving one
+  while (running_flag.load() || !lane.queue.empty()) {
+    auto item = lane.queue.pop(std::chrono::milliseconds(10));
+    if (!item)
+      continue;
+
+    // when records are backing up, those already queued are written together
+    batch.clear();
+    batch.push_back(std::move(*item));
+    while (batch.size() < m_write_batch_size) {
+      item = lane.queue.pop(std::chrono::milliseconds(0));
+      if (!item)
+        break;
+      batch.push_back(std::move(*item));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    records.clear();
+    for (const auto& queued : batch) {
+      m_write_queue_us += std::chrono::duration_cast<std::chrono::microseconds>(start - queued.queued).count();
+      if (queued.write)
+        records.push_back(queued.record.get());
+    }
+    if (records.size() == 1) {
+      write_trigger_record(*records.front(), *lane.data_store);
+    } else if (!records.empty()) {
+      write_trigger_records(records, *lane.data_store);
+    }
+
+    if (m_early_token_release)
+      continue;
+
+    for (auto& written : batch) {
+      auto token = make_token_item(*written.record);
+      written.record.reset();
+      token.queued = std::chrono::steady_clock::now();
+      m_token_queue.push(std::move(token), 1);
+    }
+  }
+}
+
+DataWriterModule::TokenItem
+DataWriterModule::make_token_item(const daqdataformats::TriggerRecord& trigger_record)
+{
+  const auto& header = trigger_record.get_header_ref();
+  TokenItem token{ header.get_trigger_number(), header.get_max_sequence_number(), {}, {} };
+  if (take_volume_sample(trigger_record))
+    collect_fragment_volumes(trigger_record, token.volumes);
+  return token;
+}
+
+void
+DataWriterModule::do_send_tokens(std::atomic<bool>& running_flag)
+{
+  while (running_flag.load() || !m_token_queue.empty()) {
+    auto item = m_token_queue.pop(std::chrono::milliseconds(10));
+    if (item) {
+      auto start = std::chrono::steady_clock::now();
+      m_token_queue_us += std::chrono::duration_cast<std::chrono::microseconds>(start - item->queued).count();
+      if (!item->volumes.empty())
+        add_volume_sample(item->trigger_number, item->volumes);
+      complete_trigger_record(item->trigger_number, item->max_sequence_number);
+      m_token_sending_us +=
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+    flush_token_batch_if_old();
+  }
+
+  if (m_token_batch_output) {
+    flush_token_batch();
   }
 }
 
@@ -9,7 +9,9 @@
 #ifndef DFMODULES_PLUGINS_DATAWRITER_HPP_
 #define DFMODULES_PLUGINS_DATAWRITER_HPP_
 
+#include "dfmodules/BoundedQueue.hpp"
 #include "dfmodules/DataStore.hpp"
+#include "dfmodules/TriggerDecisionTokenBatch.hpp"
 
 #include "appfwk/DAQModule.hpp"
 #include "appmodel/DataWriterConf.hpp"
@@ -59,6 +61,31 @@ private:
   void receive_trigger_record(std::unique_ptr<daqdataformats::TriggerRecord>&);
   std::atomic<bool> m_running = false;
 
+  // Stages of the handling of a record, run in sequence by receive_trigger_record
+  // or by separate threads in the pipelined mode
+  bool accept_trigger_record(const daqdataformats::TriggerRecord&); // run number check and counting
+  bool should_write_trigger_record() const;                           // storage enabled and prescale
+  void write_trigger_record(const daqdataformats::TriggerRecord&, DataStore&); // with retries
+  // with DataStore::write_batch, the records written are removed from records
+  void write_trigger_records(std::vector<const daqdataformats::TriggerRecord*>& records, DataStore&);
+  using fragment_volumes_t = std::map<daqdataformats::SourceID, uint64_t>; // NOLINT(build/unsigned)
+  void collect_fragment_volumes(const daqdataformats::TriggerRecord&, fragment_volumes_t& volumes) const;
+  void complete_trigger_record(daqdataformats::trigger_number_t trigger_number,
+                               daqdataformats::sequence_number_t max_sequence_number);
+
+  // Token handling
+  void send_token(daqdataformats::trigger_number_t trigger_number);
+  void flush_token_batch();
+
+  // With batched tokens, the fragment volumes of one record per batch can be
+  // sent to the DFO for its data volume estimates. Only the records made of a
+  // single sequence are sampled, so that their volumes are complete. The next
+  // sample is taken once a batch carrying one has been sent
+  bool m_report_fragment_volumes{ false };
+  std::atomic<bool> m_volume_sample_wanted{ false };
+  bool take_volume_sample(const daqdataformats::TriggerRecord&);
+  void add_volume_sample(daqdataformats::trigger_number_t trigger_number, const fragment_volumes_t& volumes);
+
   // Configuration
   std::shared_ptr<appfwk::ModuleConfiguration> m_module_configuration;
   const appmodel::DataWriterConf* m_data_writer_conf;
@@ -72,6 +99,8 @@ private:
   size_t m_min_write_retry_time_usec;
   size_t m_max_write_retry_time_usec;
   int m_write_retry_time_increase_factor;
+  size_t m_token_batch_size;
+  std::chrono::milliseconds m_token_batch_timeout;
 
   // Connections
   std::string m_trigger_record_connection;
@@ -80,13 +109,58 @@ private:
 
   using token_sender_t = iomanager::SenderConcept<dfmessages::TriggerDecisionToken>;
   std::shared_ptr<token_sender_t> m_token_output;
+  using token_batch_sender_t = iomanager::SenderConcept<TriggerDecisionTokenBatch>;
+  std::shared_ptr<token_batch_sender_t> m_token_batch_output;
   std::string m_trigger_decision_connection;
 
   // Worker(s)
   dunedaq::utilities::WorkerThread m_thread;
   void do_work(std::atomic<bool>&);
 
-  std::shared_ptr<DataStore> m_data_writer;
+  // Pipelined mode, used when write_queue_capacity_bytes > 0: m_thread only
+  // receives the records, the writer thread of a lane writes them and the token
+  // thread sends the tokens, so that a slow write does not hold the input connection
+  struct WriteItem
+  {
+    std::unique_ptr<daqdataformats::TriggerRecord> record;
+    bool write;
+    std::chrono::steady_clock::time_point queued;
+  };
+  struct TokenItem
+  {
+    daqdataformats::trigger_number_t trigger_number;
+    daqdataformats::sequence_number_t max_sequence_number;
+    fragment_volumes_t volumes; // only filled for the volume sample, see take_volume_sample()
+    std::chrono::steady_clock::time_point queued;
+  };
+  size_t m_write_queue_capacity; // in bytes and per lane, 0 for the serial mode
+  // with early token release, the token of a record is sent when the record
+  // enters the write queue instead of when it has been written. The write
+  // queues are then a write-behind buffer, their capacity bounding the memory
+  bool m_early_token_release{ false };
+  size_t m_write_batch_size{ 1 }; // most records written at once by a lane when its queue has backlog
+  TokenItem make_token_item(const daqdataformats::TriggerRecord&);
+  BoundedQueue<TokenItem> m_token_queue;
+  dunedaq::utilities::WorkerThread m_token_thread;
+  void do_send_tokens(std::atomic<bool>&);
+  void flush_token_batch_if_old();
+
+  // Writer lanes: each one has its own DataStore, usually writing to its own
+  // disk, and in the pipelined mode its own queue and writer thread. The
+  // serial mode has a single lane. The tokens of all the lanes go through
+  // m_token_queue, so that the sequence numbers of a trigger are counted in one place.
+  // HDF5DataStore serialises the HDF5 calls of all its instances when the HDF5
+  // library is not thread-safe, which makes concurrent lanes safe
+  struct WriterLane
+  {
+    std::shared_ptr<DataStore> data_store;
+    BoundedQueue<WriteItem> queue;
+    std::unique_ptr<dunedaq::utilities::WorkerThread> thread;
+  };
+  std::vector<std::unique_ptr<WriterLane>> m_lanes;
+  bool m_least_loaded_lane{ false }; // otherwise the lane is chosen by trigger number
+  WriterLane& select_lane(const daqdataformats::TriggerRecord&);
+  void do_write(size_t lane, std::atomic<bool>&);
 
   // Metrics
   std::atomic<uint64_t> m_records_received = { 0 };     // NOLINT(build/unsigned)
@@ -96,10 +170,17 @@ private:
   std::atomic<uint64_t> m_bytes_output = { 0 };         // NOLINT(build/unsigned)
   std::atomic<uint64_t> m_bytes_output_tot = { 0 };     // NOLINT(build/unsigned)
   std::atomic<uint64_t> m_writing_us = { 0 };           // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_receive_blocked_us = { 0 };   // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_write_queue_us = { 0 };       // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_token_queue_us = { 0 };       // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_token_sending_us = { 0 };     // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_early_tokens = { 0 };         // NOLINT(build/unsigned)
 
   
   // Other
   std::map<daqdataformats::trigger_number_t, size_t> m_seqno_counts;
+  TriggerDecisionTokenBatch m_pending_token_batch;
+  std::chrono::steady_clock::time_point m_pending_token_batch_start;
 
   inline double elapsed_seconds(std::chrono::steady_clock::time_point then,
                                 std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now()) const
@@ -117,6 +198,14 @@ ERS_DECLARE_ISSUE_BASE(dfmodules,
                        ((std::string)name),
                        ERS_EMPTY)
 
+ERS_DECLARE_ISSUE_BASE(dfmodules,
+                       InvalidWriterLanes,
+                       appfwk::GeneralDAQModuleIssue,
+                       n_lanes << " writer lanes are configured, but they need the pipelined mode: "
+                               << "write_queue_capacity_bytes must be set",
+                       ((std::string)name),
+                       ((size_t)n_lanes))
+
 ERS_DECLARE_ISSUE_BASE(dfmodules,
                        DataWritingProblem,
                        appfwk::GeneralDAQModuleIssue,
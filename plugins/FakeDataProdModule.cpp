@@ -119,6 +119,7 @@ FakeDataProdModule::do_stop(const data_t& /*args*/)
 
   auto iom = iomanager::IOManager::get();
   iom->remove_callback<dfmessages::DataRequest>(m_data_request_id);
+  m_fragment_senders.clear();
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_stop() method";
 }
 
@@ -203,8 +204,7 @@ FakeDataProdModule::process_data_request(dfmessages::DataRequest& data_request)
   }
 
   try {
-    auto iom = iomanager::IOManager::get();
-    iom->get_sender<std::unique_ptr<daqdataformats::Fragment>>(data_request.data_destination)
+    m_fragment_senders.get(data_request.data_destination)
       ->send(std::move(data_fragment_ptr), std::chrono::milliseconds(1000));
   } catch (ers::Issue& e) {
     ers::warning(FragmentTransmissionFailed(ERS_HERE, get_name(), data_request.trigger_number, e));
@@ -12,6 +12,8 @@
 #include "daqdataformats/Fragment.hpp"
 #include "dfmessages/DataRequest.hpp"
 
+#include "dfmodules/SenderCache.hpp"
+
 #include "appmodel/FakeDataProdConf.hpp"
 #include "appfwk/DAQModule.hpp"
 #include "utilities/WorkerThread.hpp"
@@ -90,6 +92,7 @@ private:
 
   std::string m_data_request_id;
   std::string m_timesync_id;
+  SenderCache<std::unique_ptr<daqdataformats::Fragment>> m_fragment_senders;
 
   std::atomic<uint64_t> m_received_requests{ 0 }; // NOLINT (build/unsigned)
   std::atomic<uint64_t> m_sent_fragments{ 0 };    // NOLINT (build/unsigned)
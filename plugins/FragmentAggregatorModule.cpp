@@ -88,6 +88,8 @@ FragmentAggregatorModule::do_stop(const data_t& /* args */)
   iom->remove_callback<dfmessages::DataRequest>(m_data_req_input);
   iom->remove_callback<std::unique_ptr<daqdataformats::Fragment>>(m_fragment_input);
   m_data_req_map.clear();
+  m_data_request_senders.clear();
+  m_fragment_senders.clear();
 }
 
 void
@@ -113,9 +115,8 @@ FragmentAggregatorModule::process_data_request(dfmessages::DataRequest& data_req
                                                           data_request.sequence_number));
     } else {
       TLOG_DEBUG(30) << "Send data request to " << uid_elem->second;
-      auto sender = get_iom_sender<dfmessages::DataRequest>(uid_elem->second);
       data_request.data_destination = m_fragment_input;
-      sender->send(std::move(data_request), iomanager::Sender::s_no_block);
+      m_data_request_senders.get(uid_elem->second)->send(std::move(data_request), iomanager::Sender::s_no_block);
     }
   } catch (const ers::Issue& excpt) {
     ers::warning(excpt);
@@ -147,8 +148,7 @@ FragmentAggregatorModule::process_fragment(std::unique_ptr<daqdataformats::Fragm
                    << fragment->get_sequence_number() << " and SourceID "
                    << fragment->get_element_id() << " to "
                    << trb_identifier;
-    auto sender = get_iom_sender<std::unique_ptr<daqdataformats::Fragment>>(trb_identifier);
-    sender->send(std::move(fragment), iomanager::Sender::s_no_block);
+    m_fragment_senders.get(trb_identifier)->send(std::move(fragment), iomanager::Sender::s_no_block);
   } catch (const ers::Issue& excpt) {
     ers::warning(excpt);
   }
@@ -14,6 +14,8 @@
 #include "daqdataformats/SourceID.hpp"
 #include "dfmessages/DataRequest.hpp"
 
+#include "dfmodules/SenderCache.hpp"
+
 #include "appfwk/DAQModule.hpp"
 
 #include "iomanager/Receiver.hpp"
@@ -66,6 +68,10 @@ private:
   std::string m_fragment_input;
   std::map<int, std::string> m_producer_conn_ids;
 
+  // Output senders, resolved on first use
+  SenderCache<dfmessages::DataRequest> m_data_request_senders;
+  SenderCache<std::unique_ptr<daqdataformats::Fragment>> m_fragment_senders;
+
   // Stats
   std::atomic<int> m_packets_processed{ 0 };
 
@@ -13,7 +13,10 @@
 #define DFMODULES_PLUGINS_HDF5DATASTORE_HPP_
 
 #include "HDF5FileUtils.hpp"
+#include "dfmodules/BoundedQueue.hpp"
 #include "dfmodules/DataStore.hpp"
+#include "dfmodules/FragmentCompressor.hpp"
+#include "dfmodules/FreeSpaceTracker.hpp"
 #include "dfmodules/opmon/DataStore.pb.h"
 
 #include "hdf5libs/HDF5RawDataFile.hpp"
@@ -25,13 +28,22 @@
 
 #include "appfwk/DAQModule.hpp"
 #include "logging/Logging.hpp"
+#include "utilities/WorkerThread.hpp"
 
 #include "boost/date_time/posix_time/posix_time.hpp"
 #include "boost/lexical_cast.hpp"
 
+#include <charconv>
+#include <condition_variable>
 #include <cstdlib>
+#include <filesystem>
 #include <functional>
+#include <future>
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <sys/statvfs.h>
 #include <utility>
@@ -83,6 +95,14 @@ ERS_DECLARE_ISSUE_BASE(dfmodules,
                        ((std::string)name),
                        ((std::string)path)((size_t)free_bytes)((size_t)needed_bytes)((std::string)criteria))
 
+ERS_DECLARE_ISSUE_BASE(dfmodules,
+                       InvalidCompressionLevel,
+                       appfwk::GeneralDAQModuleIssue,
+                       "The compression level \"" << setting
+                                                  << "\" is not valid, the expected form is <fragment type>:<1 to 9>",
+                       ((std::string)name),
+                       ((std::string)setting))
+
 ERS_DECLARE_ISSUE_BASE(dfmodules,
                        EmptyDataBlockList,
                        appfwk::GeneralDAQModuleIssue,
@@ -121,6 +141,8 @@ public:
     , m_open_flags_of_open_file(0)
     , m_run_number(0)
     , m_writer_identifier(writer_name)
+    , m_file_thread(std::bind(&HDF5DataStore::do_file_lifecycle, this, std::placeholders::_1))
+    , m_async_thread(std::bind(&HDF5DataStore::do_async_writes, this, std::placeholders::_1))
   {
     TLOG_DEBUG(TLVL_BASIC) << get_name();
 
@@ -139,10 +161,46 @@ public:
       m_free_space_safety_factor_for_write = 1.1;
     }
 
+    // the free space is sampled periodically and decremented by the bytes
+    // written in between; it is checked exactly once it gets within one
+    // file of what a write needs
+    m_free_space = std::make_unique<FreeSpaceTracker>(
+      [this]() { return get_free_space(m_path); },
+      std::chrono::milliseconds(m_config_params->get_free_space_sampling_period_ms()),
+      m_max_file_size);
+
     m_file_index = 0;
     m_recorded_size = 0;
     m_current_record_number = std::numeric_limits<size_t>::max();
 
+    // the payloads of the fragment types with a compression level are
+    // compressed on a pool of threads before being written
+    FragmentCompressor::levels_t compression_levels;
+    for (const auto& setting : m_config_params->get_compression_levels()) {
+      auto separator = setting.rfind(':');
+      int level = 0;
+      daqdataformats::FragmentType type = daqdataformats::FragmentType::kUnknown;
+      if (separator != std::string::npos) {
+        type = daqdataformats::string_to_fragment_type(setting.substr(0, separator));
+        level = std::atoi(setting.c_str() + separator + 1);
+      }
+      if (type == daqdataformats::FragmentType::kUnknown || level < 1 || level > 9) {
+        throw InvalidCompressionLevel(ERS_HERE, get_name(), setting);
+      }
+      compression_levels[type] = level;
+    }
+    if (!compression_levels.empty() && m_config_params->get_compression_threads() > 0) {
+      m_compressor = std::make_unique<FragmentCompressor>(compression_levels, m_config_params->get_compression_threads());
+    }
+
+    hbool_t hdf5_threadsafe = false;
+    m_hdf5_threadsafe = H5is_library_threadsafe(&hdf5_threadsafe) >= 0 && hdf5_threadsafe;
+    if (!m_hdf5_threadsafe) {
+      TLOG_DEBUG(TLVL_BASIC) << get_name()
+                             << ": the HDF5 library is not thread-safe, the HDF5 calls of all the HDF5DataStores"
+                             << " of the process are serialised";
+    }
+
     if (m_operation_mode != "one-event-per-file"
         //&& m_operation_mode != "one-fragment-per-file"
         && m_operation_mode != "all-per-file") {
@@ -170,51 +228,71 @@ public:
   {
 
     // check if there is sufficient space for this record
-    size_t current_free_space = get_free_space(m_path);
     size_t tr_size = tr.get_total_size_bytes();
-    if (current_free_space < (m_free_space_safety_factor_for_write * tr_size)) {
-      std::ostringstream msg_oss;
-      msg_oss << "a safety factor of " << m_free_space_safety_factor_for_write << " times the trigger record size";
-      InsufficientDiskSpace issue(ERS_HERE,
-                                  get_name(),
-                                  m_path,
-                                  current_free_space,
-                                  (m_free_space_safety_factor_for_write * tr_size),
-                                  msg_oss.str());
-      std::string msg =
-        "writing a trigger record to file" + (m_file_handle ? " " + m_file_handle->get_file_name() : "");
-      throw RetryableDataStoreProblem(ERS_HERE, get_name(), msg, issue);
-    }
+    check_free_space_for_records(tr_size, "the trigger record size", "writing a trigger record to file");
 
     // check if a new file should be opened for this record
-    if (! increment_file_index_if_needed(tr_size)) {
-      if (m_operation_mode == "one-event-per-file") {
-        if (m_current_record_number != std::numeric_limits<size_t>::max() &&
-            tr.get_header_ref().get_trigger_number() != m_current_record_number) {
-          ++m_file_index;
-        }
-      }
+    select_file_for_record(tr_size, tr.get_header_ref().get_trigger_number());
+
+    write_record(tr);
+    m_recorded_size = get_recorded_size();
+
+    m_new_bytes += tr_size;
+    ++m_new_objects;
+  }
+
+  /**
+   * @brief HDF5DataStore write_batch()
+   * Writes several trigger records with a single free space check. In the
+   * all-per-file mode, a batch that fits in a file is written to a single
+   * file, so that the file size is also checked once.
+   */
+  virtual size_t write_batch(const std::vector<const daqdataformats::TriggerRecord*>& records)
+  {
+    if (records.empty()) {
+      return 0;
     }
-    m_current_record_number = tr.get_header_ref().get_trigger_number();
 
-    // determine the filename from Storage Key + configuration parameters
-    std::string full_filename = get_file_name(tr.get_header_ref().get_run_number());
+    size_t batch_size = 0;
+    for (const auto* tr : records) {
+      batch_size += tr->get_total_size_bytes();
+    }
+    check_free_space_for_records(
+      batch_size, "the size of a batch of trigger records", "writing a batch of trigger records to file");
 
-    try {
-      open_file_if_needed(full_filename, HighFive::File::OpenOrCreate);
-    } catch (std::exception const& excpt) {
-      throw FileOperationProblem(ERS_HERE, get_name(), full_filename, excpt);
-    } catch (...) { // NOLINT(runtime/exceptions)
-      // NOLINT here because we *ARE* re-throwing the exception!
-      throw FileOperationProblem(ERS_HERE, get_name(), full_filename);
+    bool one_file = m_operation_mode != "one-event-per-file" && batch_size <= m_max_file_size;
+    if (one_file) {
+      increment_file_index_if_needed(batch_size);
     }
 
-    // write the record
-    m_file_handle->write(tr);
-    m_recorded_size = m_file_handle->get_recorded_size();
+    size_t written = 0;
+    size_t written_bytes = 0;
+    try {
+      for (const auto* tr : records) {
+        size_t tr_size = tr->get_total_size_bytes();
+        if (one_file) {
+          m_current_record_number = tr->get_header_ref().get_trigger_number();
+        } else {
+          select_file_for_record(tr_size, tr->get_header_ref().get_trigger_number());
+        }
+        write_record(*tr);
+        if (!one_file) {
+          m_recorded_size = get_recorded_size();
+        }
+        ++written;
+        written_bytes += tr_size;
+      }
+    } catch (const std::exception&) {
+      // the remaining records are left to the caller, which retries them
+      if (written == 0) {
+        throw;
+      }
+    }
+    m_recorded_size = get_recorded_size();
 
-    m_new_bytes += tr_size;
-    ++m_new_objects;
+    m_new_bytes += written_bytes;
+    m_new_objects += written;
+    return written;
   }
 
   /**
@@ -228,8 +306,8 @@ public:
   {
 
     // check if there is sufficient space for this record
-    size_t current_free_space = get_free_space(m_path);
     size_t ts_size = ts.get_total_size_bytes();
+    size_t current_free_space = m_free_space->free_space(m_free_space_safety_factor_for_write * ts_size);
     if (current_free_space < (m_free_space_safety_factor_for_write * ts_size)) {
       std::ostringstream msg_oss;
       msg_oss << "a safety factor of " << m_free_space_safety_factor_for_write << " times the time slice size";
@@ -239,7 +317,7 @@ public:
                                   current_free_space,
                                   (m_free_space_safety_factor_for_write * ts_size),
                                   msg_oss.str());
-      std::string msg = "writing a time slice to file " + m_file_handle->get_file_name();
+      std::string msg = "writing a time slice to file " + open_file_name();
       throw RetryableDataStoreProblem(ERS_HERE, get_name(), msg, issue);
     }
 
@@ -255,10 +333,10 @@ public:
     m_current_record_number = ts.get_header().timeslice_number;
 
     // determine the filename from Storage Key + configuration parameters
-    std::string full_filename = get_file_name(ts.get_header().run_number);
+    const std::string& full_filename = current_file_name(ts.get_header().run_number);
 
     try {
-      open_file_if_needed(full_filename, HighFive::File::OpenOrCreate);
+      open_file_if_needed(full_filename, HighFive::File::OpenOrCreate, ts.get_header().run_number);
     } catch (std::exception const& excpt) {
       throw FileOperationProblem(ERS_HERE, get_name(), full_filename, excpt);
     } catch (...) { // NOLINT(runtime/exceptions)
@@ -268,10 +346,12 @@ public:
 
     // write the record
     try {
+      auto lk = lock_hdf5();
       m_file_handle->write(ts);
-      m_recorded_size = m_file_handle->get_recorded_size();
+      m_recorded_size = get_recorded_size();
+      m_free_space->record_written(ts_size);
     } catch (hdf5libs::TimeSliceAlreadyExists const& excpt) {
-      std::string msg = "writing a time slice to file " + m_file_handle->get_file_name();
+      std::string msg = "writing a time slice to file " + open_file_name();
       throw IgnorableDataStoreProblem(ERS_HERE, get_name(), msg, excpt);
     }
 
@@ -315,6 +395,10 @@ public:
     m_file_index = 0;
     m_recorded_size = 0;
     m_current_record_number = std::numeric_limits<size_t>::max();
+    m_current_file_name.clear();
+
+    prepare_run_constants();
+    m_free_space->start();
   }
 
   /**
@@ -326,9 +410,16 @@ public:
    */
   void finish_with_run(daqdataformats::run_number_t /*run_number*/)
   {
+    wait_for_async_writes();
+    m_free_space->stop();
+    stop_file_thread();
+    m_run_constants_ready = false;
+
     if (m_file_handle.get() != nullptr) {
-      std::string open_filename = m_file_handle->get_file_name();
+      std::string open_filename = open_file_name();
       try {
+        forget_open_file_id();
+        auto lk = lock_hdf5();
         m_file_handle.reset();
         m_run_number = 0;
       } catch (std::exception const& excpt) {
@@ -342,6 +433,42 @@ public:
     }
   }
 
+  ~HDF5DataStore()
+  {
+    if (m_async_thread.thread_running())
+      m_async_thread.stop_working_thread();
+    stop_file_thread();
+    if (m_file_handle) {
+      forget_open_file_id();
+      close_file(std::move(m_file_handle));
+    }
+  }
+
+  /**
+   * @brief The asynchronous writes are done in order by a dedicated thread,
+   * started by the first of them, so that the caller can go on while the
+   * data is written and while the writes are retried.
+   */
+  std::future<void> write_async(std::shared_ptr<const daqdataformats::TriggerRecord> tr,
+                                write_callback_t on_completion = nullptr,
+                                retry_callback_t on_retry = nullptr) override
+  {
+    return queue_async_write([this, tr]() { write(*tr); }, std::move(on_completion), std::move(on_retry));
+  }
+
+  std::future<void> write_async(std::shared_ptr<const daqdataformats::TimeSlice> ts,
+                                write_callback_t on_completion = nullptr,
+                                retry_callback_t on_retry = nullptr) override
+  {
+    return queue_async_write([this, ts]() { write(*ts); }, std::move(on_completion), std::move(on_retry));
+  }
+
+  void wait_for_async_writes() override
+  {
+    std::unique_lock<std::mutex> lk(m_async_mutex);
+    m_async_done.wait(lk, [this]() { return m_async_outstanding == 0; });
+  }
+
 protected:
   void generate_opmon_data() override
   {
@@ -352,6 +479,22 @@ protected:
     info.set_new_written_object(m_new_objects.exchange(0));
     info.set_bytes_in_file(m_recorded_size.load());
     info.set_written_files(m_file_index.load());
+    info.set_free_space_samples(m_free_space->take_samples());
+    info.set_free_space_synchronous_samples(m_free_space->take_synchronous_samples());
+    info.set_free_space_sampling_time(m_free_space->take_sampling_us());
+    info.set_free_space_estimate(m_free_space->estimate());
+    info.set_rollovers(m_file_rollovers.exchange(0));
+    info.set_precreated_files_used(m_precreated_files_used.exchange(0));
+    info.set_rollover_stall_time(m_rollover_stall_us.exchange(0));
+    if (m_compressor) {
+      auto bytes_in = m_compressor->take_bytes_in();
+      auto bytes_out = m_compressor->take_bytes_out();
+      info.set_compression_bytes_in(bytes_in);
+      info.set_compression_bytes_out(bytes_out);
+      info.set_compression_cpu_time(m_compressor->take_cpu_us());
+      if (bytes_out > 0)
+        info.set_compression_ratio(static_cast<double>(bytes_in) / bytes_out);
+    }
     publish(std::move(info), { { "path", m_path } });
   }
 
@@ -361,6 +504,8 @@ private:
   HDF5DataStore(HDF5DataStore&&) = delete;
   HDF5DataStore& operator=(HDF5DataStore&&) = delete;
 
+  static constexpr const char* s_inprogress_suffix = ".writing";
+
   std::unique_ptr<hdf5libs::HDF5RawDataFile> m_file_handle;
   const appmodel::HDF5FileLayoutParams* m_file_layout_params;
   std::string m_basic_name_of_open_file;
@@ -378,6 +523,18 @@ private:
   // Total size of data being written
   std::atomic<size_t> m_recorded_size;
 
+  // File name for the current file index and run, see current_file_name()
+  std::string m_current_file_name;
+  size_t m_current_file_name_index;
+  daqdataformats::run_number_t m_current_file_name_run;
+
+  // Parts of the file names that do not depend on the file index, see get_file_name()
+  std::string m_file_name_prefix;
+  std::string m_file_name_suffix;
+  daqdataformats::run_number_t m_file_name_prefix_run;
+  size_t m_file_index_digits;
+  std::string m_file_name;
+
   // Record number for the record that is currently being written out
   // This is only useful for long-readout windows, in which there may
   // be multiple calls to write()
@@ -394,36 +551,154 @@ private:
   size_t m_max_file_size;
   bool m_disable_unique_suffix;
   float m_free_space_safety_factor_for_write;
+  std::unique_ptr<FreeSpaceTracker> m_free_space;
+  std::unique_ptr<FragmentCompressor> m_compressor; // null when no fragment is compressed
+
+  // Current file as seen by the HDF5 C API, and bytes of the compressed
+  // fragments written to it, see replace_placeholders()
+  hid_t m_open_file_id{ H5I_INVALID_HID };
+  size_t m_compressed_bytes_in_file{ 0 };
+
+  // Constant for the files of a run, see prepare_run_constants(). m_file_thread
+  // only reads them after a request from the writer
+  hdf5libs::HDF5SourceIDHandler::source_id_geo_id_map_t m_source_id_geo_id_map;
+  std::string m_run_was_for_test_purposes_attribute;
+  bool m_run_constants_ready{ false };
+
+  // File lifecycle: m_file_thread closes and renames the finished files, and
+  // creates the next file of the run ahead of time, so that a rollover only
+  // swaps the file handles in the writer
+  struct PreparedFile
+  {
+    std::string basic_name; // as given to open_file_if_needed()
+    std::string unique_name;
+    unsigned open_flags;
+    std::unique_ptr<hdf5libs::HDF5RawDataFile> handle;
+  };
+  struct FileRequest
+  {
+    std::string basic_name;
+    size_t file_index;
+    daqdataformats::run_number_t run_number;
+  };
+  BoundedQueue<std::unique_ptr<hdf5libs::HDF5RawDataFile>> m_files_to_close;
+  std::mutex m_prepared_mutex;
+  std::condition_variable m_file_prepared;
+  std::optional<FileRequest> m_file_request;  // protected by m_prepared_mutex
+  std::optional<PreparedFile> m_prepared_file; // protected by m_prepared_mutex
+  bool m_preparing_file{ false };              // protected by m_prepared_mutex
+  bool m_hdf5_threadsafe{ false };
+  utilities::WorkerThread m_file_thread;
+
+  std::atomic<uint64_t> m_file_rollovers{ 0 };       // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_precreated_files_used{ 0 }; // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_rollover_stall_us{ 0 };    // NOLINT(build/unsigned)
+
+  // Asynchronous writes, see write_async(). The memory held by the queue is
+  // bounded by the callers, which own the records until they are written
+  struct AsyncWrite
+  {
+    std::function<void()> write_once;
+    write_callback_t on_completion;
+    retry_callback_t on_retry;
+    std::promise<void> promise;
+  };
+  BoundedQueue<AsyncWrite> m_async_writes;
+  utilities::WorkerThread m_async_thread;
+  std::mutex m_async_mutex;
+  std::condition_variable m_async_done;
+  size_t m_async_outstanding{ 0 }; // queued or being written, protected by m_async_mutex
+
+  std::future<void> queue_async_write(std::function<void()> write_once,
+                                      write_callback_t on_completion,
+                                      retry_callback_t on_retry)
+  {
+    AsyncWrite job{ std::move(write_once), std::move(on_completion), std::move(on_retry), {} };
+    auto future = job.promise.get_future();
+    {
+      std::lock_guard<std::mutex> lk(m_async_mutex);
+      if (!m_async_thread.thread_running())
+        m_async_thread.start_working_thread("hdf5-writer");
+      ++m_async_outstanding;
+    }
+    m_async_writes.push(std::move(job), 1);
+    return future;
+  }
+
+  void do_async_writes(std::atomic<bool>& running_flag)
+  {
+    while (running_flag.load() || !m_async_writes.empty()) {
+      auto job = m_async_writes.pop(std::chrono::milliseconds(10));
+      if (!job)
+        continue;
+      complete_write(job->write_once, job->on_completion, job->on_retry, job->promise);
+      {
+        std::lock_guard<std::mutex> lk(m_async_mutex);
+        --m_async_outstanding;
+      }
+      m_async_done.notify_all();
+    }
+  }
 
   // std::unique_ptr<HDF5KeyTranslator> m_key_translator_ptr;
 
   /**
    * @brief Translates the specified input parameters into the appropriate filename.
+   * Only the file index is formatted for each call, the parts of the name
+   * before and after it are kept for the run. The returned name is valid
+   * until the next call.
    */
-  std::string get_file_name(daqdataformats::run_number_t run_number)
+  const std::string& get_file_name(daqdataformats::run_number_t run_number, size_t file_index)
   {
-    std::ostringstream work_oss;
-    work_oss << m_config_params->get_directory_path();
-    if (work_oss.str().length() > 0) {
-      work_oss << "/";
-    }
-    work_oss << m_operational_environment + "_" + m_config_params->get_filename_params()->get_file_type_prefix();
-    if (work_oss.str().length() > 0) {
+    if (m_file_name_suffix.empty() || m_file_name_prefix_run != run_number) {
+      std::ostringstream work_oss;
+      work_oss << m_config_params->get_directory_path();
+      if (work_oss.str().length() > 0) {
+        work_oss << "/";
+      }
+      work_oss << m_operational_environment + "_" + m_config_params->get_filename_params()->get_file_type_prefix();
+      if (work_oss.str().length() > 0) {
+        work_oss << "_";
+      }
+
+      work_oss << m_config_params->get_filename_params()->get_run_number_prefix();
+      work_oss << std::setw(m_config_params->get_filename_params()->get_digits_for_run_number()) << std::setfill('0')
+               << run_number;
       work_oss << "_";
+
+      work_oss << m_config_params->get_filename_params()->get_file_index_prefix();
+      m_file_name_prefix = work_oss.str();
+      m_file_name_prefix_run = run_number;
+      m_file_index_digits = m_config_params->get_filename_params()->get_digits_for_file_index();
+      m_file_name_suffix = "_" + m_writer_identifier + ".hdf5";
     }
 
-    work_oss << m_config_params->get_filename_params()->get_run_number_prefix();
-    work_oss << std::setw(m_config_params->get_filename_params()->get_digits_for_run_number()) << std::setfill('0')
-             << run_number;
-    work_oss << "_";
+    char digits[std::numeric_limits<size_t>::digits10 + 1];
+    auto digits_end = std::to_chars(std::begin(digits), std::end(digits), file_index).ptr;
+    size_t digit_count = digits_end - digits;
 
-    work_oss << m_config_params->get_filename_params()->get_file_index_prefix();
-    work_oss << std::setw(m_config_params->get_filename_params()->get_digits_for_file_index()) << std::setfill('0')
-             << m_file_index;
+    m_file_name.assign(m_file_name_prefix);
+    if (digit_count < m_file_index_digits) {
+      m_file_name.append(m_file_index_digits - digit_count, '0');
+    }
+    m_file_name.append(digits, digit_count);
+    m_file_name.append(m_file_name_suffix);
+    return m_file_name;
+  }
 
-    work_oss << "_" << m_writer_identifier;
-    work_oss << ".hdf5";
-    return work_oss.str();
+  /**
+   * @brief File name for the current file index and run, only translated
+   * again when one of them changes
+   */
+  const std::string& current_file_name(daqdataformats::run_number_t run_number)
+  {
+    if (m_current_file_name.empty() || m_current_file_name_index != m_file_index ||
+        m_current_file_name_run != run_number) {
+      m_current_file_name = get_file_name(run_number, m_file_index);
+      m_current_file_name_index = m_file_index;
+      m_current_file_name_run = run_number;
+    }
+    return m_current_file_name;
   }
 
   bool increment_file_index_if_needed(size_t size_of_next_write)
@@ -436,78 +711,389 @@ private:
     return false;
   }
 
-  void open_file_if_needed(const std::string& file_name, unsigned open_flags = HighFive::File::ReadOnly)
+  void open_file_if_needed(const std::string& file_name,
+                           unsigned open_flags = HighFive::File::ReadOnly,
+                           daqdataformats::run_number_t run_number = 0)
   {
 
     if (m_file_handle.get() == nullptr || m_basic_name_of_open_file.compare(file_name) ||
         m_open_flags_of_open_file != open_flags) {
+      auto start_time = std::chrono::steady_clock::now();
+      if (!m_run_constants_ready)
+        prepare_run_constants();
 
-      // 04-Feb-2021, KAB: adding unique substrings to the filename
-      std::string unique_filename = file_name;
-      time_t now = time(0);
-      std::string file_creation_timestamp = boost::posix_time::to_iso_string(boost::posix_time::from_time_t(now));
-      if (!m_disable_unique_suffix) {
-        // timestamp substring
-        size_t ufn_len = unique_filename.length();
-        if (ufn_len > 6) { // len GT 6 gives us some confidence that we have at least x.hdf5
-          std::string timestamp_substring = "_" + file_creation_timestamp;
-          TLOG_DEBUG(TLVL_BASIC) << get_name() << ": timestamp substring for filename: " << timestamp_substring;
-          unique_filename.insert(ufn_len - 5, timestamp_substring);
-        }
-      }
+      // a file created ahead of time by m_file_thread only has to be swapped in
+      auto prepared = take_prepared_file(file_name, open_flags);
 
-      // close an existing open file
+      // the finished file is flushed, closed and renamed by m_file_thread
       if (m_file_handle.get() != nullptr) {
-        std::string open_filename = m_file_handle->get_file_name();
-        try {
-          m_file_handle.reset();
-        } catch (std::exception const& excpt) {
-          throw FileOperationProblem(ERS_HERE, get_name(), open_filename, excpt);
-        } catch (...) { // NOLINT(runtime/exceptions)
-          // NOLINT here because we *ARE* re-throwing the exception!
-          throw FileOperationProblem(ERS_HERE, get_name(), open_filename);
-        }
+        start_file_thread_if_needed();
+        forget_open_file_id();
+        m_files_to_close.push(std::move(m_file_handle), 1);
       }
 
       // opening file for the first time OR something changed in the name or the way of opening the file
-      TLOG_DEBUG(TLVL_BASIC) << get_name() << ": going to open file " << unique_filename << " with open_flags "
-                             << std::to_string(open_flags);
       m_basic_name_of_open_file = file_name;
       m_open_flags_of_open_file = open_flags;
-      try {
-        m_file_handle.reset(
-          new hdf5libs::HDF5RawDataFile(unique_filename,
-                                        m_run_number,
-                                        m_file_index,
-                                        m_writer_identifier,
-                                        m_file_layout_params,
-                                        hdf5libs::HDF5SourceIDHandler::make_source_id_geo_id_map(m_session),
-                                        ".writing",
-                                        open_flags));
-      } catch (std::exception const& excpt) {
-        throw FileOperationProblem(ERS_HERE, get_name(), unique_filename, excpt);
-      } catch (...) { // NOLINT(runtime/exceptions)
-        // NOLINT here because we *ARE* re-throwing the exception!
-        throw FileOperationProblem(ERS_HERE, get_name(), unique_filename);
-      }
-
-      if (open_flags == HighFive::File::ReadOnly) {
-        TLOG_DEBUG(TLVL_BASIC) << get_name() << "Opened HDF5 file read-only.";
+      if (prepared) {
+        TLOG_DEBUG(TLVL_BASIC) << get_name() << ": using file " << prepared->unique_name << " created ahead of time";
+        m_file_handle = std::move(prepared->handle);
+        ++m_precreated_files_used;
       } else {
-        TLOG_DEBUG(TLVL_BASIC) << get_name() << "Created HDF5 file (" << unique_filename << ").";
+        m_file_handle = std::move(create_file(file_name, m_file_index, open_flags, m_run_number).handle);
+      }
 
-        // write attributes that aren't being handled by the HDF5RawDataFile right now
-        // m_file_handle->write_attribute("data_format_version",(int)m_key_translator_ptr->get_current_version());
-        m_file_handle->write_attribute("operational_environment", (std::string)m_operational_environment);
-        m_file_handle->write_attribute("offline_data_stream", (std::string)m_offline_data_stream);
-        m_file_handle->write_attribute("run_was_for_test_purposes", (std::string)(m_run_is_for_test_purposes ? "true" : "false"));
+      // the next file of the run is created while this one is written
+      if (open_flags != HighFive::File::ReadOnly) {
+        request_next_file(get_file_name(run_number, m_file_index + 1), m_file_index + 1);
       }
+
+      ++m_file_rollovers;
+      m_rollover_stall_us +=
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
     } else {
       TLOG_DEBUG(TLVL_BASIC) << get_name() << ": Pointer file to  " << m_basic_name_of_open_file
                              << " was already opened with open_flags " << std::to_string(m_open_flags_of_open_file);
     }
   }
 
+  /**
+   * @brief Creates or opens the file, adding the unique suffix to its name
+   */
+  PreparedFile create_file(const std::string& file_name,
+                           size_t file_index,
+                           unsigned open_flags,
+                           daqdataformats::run_number_t run_number)
+  {
+    // 04-Feb-2021, KAB: adding unique substrings to the filename
+    std::string unique_filename = file_name;
+    time_t now = time(0);
+    std::string file_creation_timestamp = boost::posix_time::to_iso_string(boost::posix_time::from_time_t(now));
+    if (!m_disable_unique_suffix) {
+      // timestamp substring
+      size_t ufn_len = unique_filename.length();
+      if (ufn_len > 6) { // len GT 6 gives us some confidence that we have at least x.hdf5
+        std::string timestamp_substring = "_" + file_creation_timestamp;
+        TLOG_DEBUG(TLVL_BASIC) << get_name() << ": timestamp substring for filename: " << timestamp_substring;
+        unique_filename.insert(ufn_len - 5, timestamp_substring);
+      }
+    }
+
+    TLOG_DEBUG(TLVL_BASIC) << get_name() << ": going to open file " << unique_filename << " with open_flags "
+                           << std::to_string(open_flags);
+    PreparedFile file{ file_name, unique_filename, open_flags, nullptr };
+    auto lk = lock_hdf5();
+    try {
+      file.handle.reset(new hdf5libs::HDF5RawDataFile(unique_filename,
+                                                      run_number,
+                                                      file_index,
+                                                      m_writer_identifier,
+                                                      m_file_layout_params,
+                                                      m_source_id_geo_id_map,
+                                                      s_inprogress_suffix,
+                                                      open_flags));
+    } catch (std::exception const& excpt) {
+      throw FileOperationProblem(ERS_HERE, get_name(), unique_filename, excpt);
+    } catch (...) { // NOLINT(runtime/exceptions)
+      // NOLINT here because we *ARE* re-throwing the exception!
+      throw FileOperationProblem(ERS_HERE, get_name(), unique_filename);
+    }
+
+    if (open_flags == HighFive::File::ReadOnly) {
+      TLOG_DEBUG(TLVL_BASIC) << get_name() << "Opened HDF5 file read-only.";
+    } else {
+      TLOG_DEBUG(TLVL_BASIC) << get_name() << "Created HDF5 file (" << unique_filename << ").";
+
+      // write attributes that aren't being handled by the HDF5RawDataFile right now
+      // m_file_handle->write_attribute("data_format_version",(int)m_key_translator_ptr->get_current_version());
+      file.handle->write_attribute("operational_environment", (std::string)m_operational_environment);
+      file.handle->write_attribute("offline_data_stream", (std::string)m_offline_data_stream);
+      file.handle->write_attribute("run_was_for_test_purposes", m_run_was_for_test_purposes_attribute);
+      if (m_compressor) {
+        // informative only, the compressed fragments are read back through the HDF5 deflate filter
+        file.handle->write_attribute("compressed_fragment_types", m_compressor->get_compressed_types());
+      }
+    }
+    return file;
+  }
+
+  /**
+   * @brief Takes the file created ahead of time if it is the requested one,
+   * waiting for its creation if it is in progress
+   */
+  std::optional<PreparedFile> take_prepared_file(const std::string& file_name, unsigned open_flags)
+  {
+    std::unique_lock<std::mutex> lk(m_prepared_mutex);
+    m_file_request.reset(); // too late if not started yet
+    m_file_prepared.wait(lk, [this]() { return !m_preparing_file; });
+
+    std::optional<PreparedFile> prepared;
+    if (m_prepared_file && m_prepared_file->basic_name == file_name && m_prepared_file->open_flags == open_flags) {
+      prepared = std::move(m_prepared_file);
+      m_prepared_file.reset();
+    }
+    return prepared;
+  }
+
+  /**
+   * @brief Computes what every file of the run uses, so that opening a file
+   * does not walk the session configuration again
+   */
+  void prepare_run_constants()
+  {
+    m_source_id_geo_id_map = hdf5libs::HDF5SourceIDHandler::make_source_id_geo_id_map(m_session);
+    m_run_was_for_test_purposes_attribute = m_run_is_for_test_purposes ? "true" : "false";
+    m_run_constants_ready = true;
+  }
+
+  void request_next_file(const std::string& file_name, size_t file_index)
+  {
+    start_file_thread_if_needed();
+    std::lock_guard<std::mutex> lk(m_prepared_mutex);
+    m_file_request = FileRequest{ file_name, file_index, m_run_number };
+  }
+
+  void start_file_thread_if_needed()
+  {
+    if (!m_file_thread.thread_running())
+      m_file_thread.start_working_thread("hdf5-files");
+  }
+
+  /**
+   * @brief Stops m_file_thread once the finished files are closed, and
+   * removes the file created ahead of time if it has not been used
+   */
+  void stop_file_thread()
+  {
+    if (m_file_thread.thread_running())
+      m_file_thread.stop_working_thread();
+
+    std::optional<PreparedFile> unused;
+    {
+      std::lock_guard<std::mutex> lk(m_prepared_mutex);
+      m_file_request.reset();
+      unused = std::move(m_prepared_file);
+      m_prepared_file.reset();
+    }
+    if (unused)
+      discard_file(std::move(*unused));
+  }
+
+  void do_file_lifecycle(std::atomic<bool>& running_flag)
+  {
+    while (running_flag.load() || !m_files_to_close.empty()) {
+      auto finished = m_files_to_close.pop(std::chrono::milliseconds(10));
+      if (finished) {
+        close_file(std::move(*finished));
+      } else if (running_flag.load()) {
+        prepare_requested_file();
+      }
+    }
+  }
+
+  void prepare_requested_file()
+  {
+    std::optional<FileRequest> request;
+    std::optional<PreparedFile> stale;
+    {
+      std::lock_guard<std::mutex> lk(m_prepared_mutex);
+      if (!m_file_request)
+        return;
+      request = std::move(m_file_request);
+      m_file_request.reset();
+      stale = std::move(m_prepared_file);
+      m_prepared_file.reset();
+      m_preparing_file = true;
+    }
+    if (stale)
+      discard_file(std::move(*stale));
+
+    std::optional<PreparedFile> prepared;
+    try {
+      prepared = create_file(request->basic_name, request->file_index, HighFive::File::OpenOrCreate, request->run_number);
+    } catch (const ers::Issue& excpt) {
+      // the writer creates the file itself when it needs it
+      ers::warning(excpt);
+    }
+
+    {
+      std::lock_guard<std::mutex> lk(m_prepared_mutex);
+      m_prepared_file = std::move(prepared);
+      m_preparing_file = false;
+    }
+    m_file_prepared.notify_all();
+  }
+
+  void close_file(std::unique_ptr<hdf5libs::HDF5RawDataFile> file)
+  {
+    auto lk = lock_hdf5();
+    std::string filename = file->get_file_name();
+    try {
+      file.reset();
+    } catch (std::exception const& excpt) {
+      ers::error(FileOperationProblem(ERS_HERE, get_name(), filename, excpt));
+    } catch (...) { // NOLINT(runtime/exceptions)
+      // NOLINT here because the problem is reported instead
+      ers::error(FileOperationProblem(ERS_HERE, get_name(), filename));
+    }
+  }
+
+  // a file created ahead of time but not used holds no data, it is removed once closed
+  void discard_file(PreparedFile&& file)
+  {
+    TLOG_DEBUG(TLVL_BASIC) << get_name() << ": removing unused file " << file.unique_name;
+    close_file(std::move(file.handle));
+    std::error_code ec;
+    std::filesystem::remove(file.unique_name, ec);
+    std::filesystem::remove(file.unique_name + s_inprogress_suffix, ec);
+  }
+
+  // The HDF5 calls are serialised, unless the HDF5 library is thread-safe.
+  // The lock is shared by all the HDF5DataStores of the process, as the
+  // library state is: the writer lanes of a DataWriterModule, or a
+  // TPStreamWriterModule in the same application, each have their own
+  // DataStore, and each DataStore has its m_file_thread
+  std::unique_lock<std::mutex> lock_hdf5()
+  {
+    static std::mutex hdf5_mutex;
+    return m_hdf5_threadsafe ? std::unique_lock<std::mutex>() : std::unique_lock<std::mutex>(hdf5_mutex);
+  }
+
+  // name of the current file, for the messages
+  std::string open_file_name()
+  {
+    auto lk = lock_hdf5();
+    return m_file_handle->get_file_name();
+  }
+
+  /**
+   * @brief Throws a RetryableDataStoreProblem if the disk does not have room for the given
+   * size with the safety factor
+   */
+  void check_free_space_for_records(size_t size, const std::string& what, const std::string& operation)
+  {
+    size_t current_free_space = m_free_space->free_space(m_free_space_safety_factor_for_write * size);
+    if (current_free_space < (m_free_space_safety_factor_for_write * size)) {
+      std::ostringstream msg_oss;
+      msg_oss << "a safety factor of " << m_free_space_safety_factor_for_write << " times " << what;
+      InsufficientDiskSpace issue(ERS_HERE,
+                                  get_name(),
+                                  m_path,
+                                  current_free_space,
+                                  (m_free_space_safety_factor_for_write * size),
+                                  msg_oss.str());
+      std::string msg = operation + (m_file_handle ? " " + open_file_name() : "");
+      throw RetryableDataStoreProblem(ERS_HERE, get_name(), msg, issue);
+    }
+  }
+
+  /**
+   * @brief Moves to the next file if the record does not fit in the current one, or
+   * if it belongs to another trigger in the one-event-per-file mode
+   */
+  void select_file_for_record(size_t size, size_t record_number)
+  {
+    if (!increment_file_index_if_needed(size)) {
+      if (m_operation_mode == "one-event-per-file") {
+        if (m_current_record_number != std::numeric_limits<size_t>::max() && record_number != m_current_record_number) {
+          ++m_file_index;
+        }
+      }
+    }
+    m_current_record_number = record_number;
+  }
+
+  /**
+   * @brief Writes the record to the current file, opening it if needed
+   */
+  void write_record(const daqdataformats::TriggerRecord& tr)
+  {
+    // determine the filename from Storage Key + configuration parameters
+    auto run_number = tr.get_header_ref().get_run_number();
+    const std::string& full_filename = current_file_name(run_number);
+
+    try {
+      open_file_if_needed(full_filename, HighFive::File::OpenOrCreate, run_number);
+    } catch (std::exception const& excpt) {
+      throw FileOperationProblem(ERS_HERE, get_name(), full_filename, excpt);
+    } catch (...) { // NOLINT(runtime/exceptions)
+      // NOLINT here because we *ARE* re-throwing the exception!
+      throw FileOperationProblem(ERS_HERE, get_name(), full_filename);
+    }
+
+    // write the record, its fragments being compressed beforehand if configured
+    if (!m_compressor) {
+      auto lk = lock_hdf5();
+      m_file_handle->write(tr);
+    } else {
+      auto compressed = m_compressor->compress(tr);
+      auto lk = lock_hdf5();
+      m_file_handle->write(*compressed.record);
+      replace_placeholders(compressed.fragments);
+    }
+    m_free_space->record_written(tr.get_total_size_bytes());
+  }
+
+  /**
+   * @brief Replaces the placeholders of the fragments compressed by
+   * m_compressor, which hdf5libs has just written with the rest of the record,
+   * by datasets made of a single chunk compressed by the HDF5 deflate filter.
+   * hdf5libs has recorded the metadata of the fragments with the record, so
+   * that they are found as the others. To be called with the HDF5 lock held.
+   */
+  void replace_placeholders(const std::vector<FragmentCompressor::CompressedFragment>& fragments)
+  {
+    if (fragments.empty()) {
+      return;
+    }
+
+    // hdf5libs does not give access to its file identifier, the file it is
+    // writing is opened again, which shares its state
+    auto file_name = m_file_handle->get_file_name();
+    if (m_open_file_id < 0) {
+      if (std::filesystem::exists(file_name + s_inprogress_suffix)) {
+        file_name += s_inprogress_suffix;
+      }
+      m_open_file_id = HDF5FileUtils::reopen_file(file_name);
+      if (m_open_file_id < 0) {
+        throw FileOperationProblem(ERS_HERE, get_name(), file_name);
+      }
+    }
+
+    // the placeholder found at the path checks that it is the one hdf5libs wrote
+    const auto& layout = m_file_handle->get_file_layout();
+    for (const auto& fragment : fragments) {
+      auto path = layout.get_path_string(fragment.header);
+      if (!HDF5FileUtils::replace_with_deflated_dataset(m_open_file_id,
+                                                        path,
+                                                        sizeof(daqdataformats::FragmentHeader),
+                                                        fragment.header.size,
+                                                        fragment.level,
+                                                        fragment.data)) {
+        throw InvalidHDF5Dataset(ERS_HERE, get_name(), path, file_name);
+      }
+      m_compressed_bytes_in_file += fragment.data.size();
+    }
+  }
+
+  // to be called before m_file_handle is closed or replaced, hdf5libs closing
+  // the file only once this identifier is closed too
+  void forget_open_file_id()
+  {
+    if (m_open_file_id >= 0) {
+      auto lk = lock_hdf5();
+      H5Fclose(m_open_file_id);
+    }
+    m_open_file_id = H5I_INVALID_HID;
+    m_compressed_bytes_in_file = 0;
+  }
+
+  /**
+   * @brief Bytes written to the current file, counting the compressed
+   * fragments, of which hdf5libs only knows the placeholders
+   */
+  size_t get_recorded_size() const { return m_file_handle->get_recorded_size() + m_compressed_bytes_in_file; }
+
   size_t get_free_space(const std::string& the_path)
   {
     struct statvfs vfs_results;
@@ -16,6 +16,8 @@
 
 #include "highfive/H5File.hpp"
 
+#include "hdf5.h"
+
 #include <filesystem>
 #include <memory>
 #include <regex>
@@ -122,6 +124,68 @@ get_all_dataset_paths(const HighFive::File* hdf_file_ptr)
   return path_list;
 }
 
+/**
+ * @brief Opens again, for reading and writing, a file that may already be open
+ * in this process. HDF5 then returns a new identifier for the same open file,
+ * through which what was written with the other identifiers is seen.
+ * @return the identifier, to be closed by the caller, or a negative value
+ */
+hid_t
+reopen_file(const std::string& file_name)
+{
+  return H5Fopen(file_name.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
+}
+
+/**
+ * @brief Replaces a DataSet of chars of the given size by a DataSet of
+ * decompressed_size chars made of a single chunk, compressed by the deflate
+ * filter. The chunk is given already compressed and is written as it is, the
+ * readers getting the original bytes back through the filter.
+ * @return false if there is no DataSet of placeholder_size chars at the path,
+ * or if the new DataSet could not be written
+ */
+bool
+replace_with_deflated_dataset(hid_t file_id,
+                              const std::string& dataset_path,
+                              hsize_t placeholder_size,
+                              hsize_t decompressed_size,
+                              unsigned level,
+                              const std::vector<char>& deflated)
+{
+  if (H5Lexists(file_id, dataset_path.c_str(), H5P_DEFAULT) <= 0) {
+    return false;
+  }
+  hid_t placeholder = H5Dopen2(file_id, dataset_path.c_str(), H5P_DEFAULT);
+  if (placeholder < 0) {
+    return false;
+  }
+  hid_t placeholder_space = H5Dget_space(placeholder);
+  auto placeholder_elements = H5Sget_simple_extent_npoints(placeholder_space);
+  H5Sclose(placeholder_space);
+  H5Dclose(placeholder);
+  if (placeholder_elements < 0 || static_cast<hsize_t>(placeholder_elements) != placeholder_size ||
+      H5Ldelete(file_id, dataset_path.c_str(), H5P_DEFAULT) < 0) {
+    return false;
+  }
+
+  hid_t space = H5Screate_simple(1, &decompressed_size, nullptr);
+  hid_t dataset_props = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(dataset_props, 1, &decompressed_size);
+  H5Pset_deflate(dataset_props, level);
+
+  hid_t dataset =
+    H5Dcreate2(file_id, dataset_path.c_str(), H5T_NATIVE_CHAR, space, H5P_DEFAULT, dataset_props, H5P_DEFAULT);
+  herr_t status = -1;
+  if (dataset >= 0) {
+    hsize_t offset = 0;
+    status = H5Dwrite_chunk(dataset, H5P_DEFAULT, 0, &offset, deflated.size(), deflated.data());
+    H5Dclose(dataset);
+  }
+  H5Pclose(dataset_props);
+  H5Sclose(space);
+  return status >= 0;
+}
+
 /**
  * @brief Fetches the list of files in the specified directory that have
  * filenames that match the specified search pattern.  The search pattern uses regex
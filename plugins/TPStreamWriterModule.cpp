@@ -24,6 +24,9 @@
 #include "boost/date_time/posix_time/posix_time.hpp"
 
 #include <chrono>
+#include <deque>
+#include <exception>
+#include <future>
 #include <memory>
 #include <sstream>
 #include <string>
@@ -131,6 +134,7 @@ TPStreamWriterModule::do_start(const nlohmann::json& payload)
     throw UnableToStart(ERS_HERE, get_name(), m_run_number, excpt);
   }
 
+  m_data_writer->enable_retries(true);
   m_thread.start_working_thread(get_name());
 
   TLOG() << get_name() << " successfully started for run number " << m_run_number;
@@ -141,6 +145,10 @@ void
 TPStreamWriterModule::do_stop(const nlohmann::json& /*payload*/)
 {
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_stop() method";
+
+  // as when the writes were done by do_work, the TimeSlices written from now
+  // on are given up at their first retryable problem, so that the stop does not hang
+  m_data_writer->enable_retries(false);
   m_thread.stop_working_thread();
 
   // 06-Mar-2022, KAB: added this call to allow DataStore to finish up with this run.
@@ -182,6 +190,7 @@ TPStreamWriterModule::do_work(std::atomic<bool>& running_flag)
 
   bool possible_pending_data = true;
   size_t largest_timeslice_number = 0;
+  std::deque<std::future<void>> pending_writes;
   while (running_flag.load() || possible_pending_data) {
     trigger::TPSet tpset;
     try {
@@ -228,61 +237,33 @@ TPStreamWriterModule::do_work(std::atomic<bool>& running_flag)
       largest_timeslice_number = std::max(timeslice_ptr->get_header().timeslice_number, largest_timeslice_number);
     }
 
-    // attempt to write out each TimeSlice
+    // hand each TimeSlice to the DataStore, which writes it, retrying if needed,
+    // while this thread goes on receiving TPSets
     for (auto& timeslice_ptr : list_of_timeslices) {
       daqdataformats::SourceID sid(daqdataformats::SourceID::Subsystem::kTRBuilder, m_source_id);
       timeslice_ptr->set_element_id(sid);
 
-      // write the TSH and the fragments as a set of data blocks
-      bool should_retry = true;
-      size_t retry_wait_usec = 1000;
-      do {
-        should_retry = false;
-        try {
-          m_data_writer->write(*timeslice_ptr);
-	  ++m_timeslices_written;
-	  m_bytes_output += timeslice_ptr->get_total_size_bytes();
-          size_t number_of_tps_written = (timeslice_ptr->get_sum_of_fragment_payload_sizes() / sizeof(trgdataformats::TriggerPrimitive));
-          m_tps_written += number_of_tps_written;
-          m_total_tps_written += number_of_tps_written;
-        } catch (const RetryableDataStoreProblem& excpt) {
-          should_retry = true;
+      std::shared_ptr<const daqdataformats::TimeSlice> timeslice(std::move(timeslice_ptr));
+      pending_writes.push_back(m_data_writer->write_async(
+        timeslice,
+        [this, timeslice, largest_timeslice_number](std::exception_ptr problem) {
+          complete_timeslice(*timeslice, largest_timeslice_number, problem);
+        },
+        [this, timeslice](const RetryableDataStoreProblem& excpt) {
           ers::error(DataWritingProblem(ERS_HERE,
                                         get_name(),
-                                        timeslice_ptr->get_header().timeslice_number,
-                                        timeslice_ptr->get_header().run_number,
+                                        timeslice->get_header().timeslice_number,
+                                        timeslice->get_header().run_number,
                                         excpt));
-          if (retry_wait_usec > 1000000) {
-            retry_wait_usec = 1000000;
-          }
-          usleep(retry_wait_usec);
-          retry_wait_usec *= 2;
-        } catch (const IgnorableDataStoreProblem& excpt) {
-          int timeslice_number_diff = largest_timeslice_number - timeslice_ptr->get_header().timeslice_number;
-          double seconds_too_late = m_accumulation_interval_seconds * timeslice_number_diff;
-          m_tardy_timeslice_max_seconds = std::max(m_tardy_timeslice_max_seconds.load(), seconds_too_late);
-          if (m_warn_user_when_tardy_tps_are_discarded) {
-            std::ostringstream sid_list;
-            bool first_frag = true;
-            for (auto const& frag_ptr : timeslice_ptr->get_fragments_ref()) {
-              if (first_frag) {first_frag = false;}
-              else {sid_list << ",";}
-              sid_list << frag_ptr->get_element_id().to_string();
-            }
-            ers::warning(TardyTPsDiscarded(ERS_HERE,
-                                           get_name(),
-                                           sid_list.str(),
-                                           timeslice_ptr->get_header().timeslice_number,
-                                           seconds_too_late));
-          }
-        } catch (const std::exception& excpt) {
-          ers::error(DataWritingProblem(ERS_HERE,
-                                        get_name(),
-                                        timeslice_ptr->get_header().timeslice_number,
-                                        timeslice_ptr->get_header().run_number,
-                                        excpt));
-        }
-      } while (should_retry && running_flag.load());
+        }));
+    }
+
+    // the receiving is held back when too many TimeSlices are waiting to be written
+    while (!pending_writes.empty() &&
+           (pending_writes.size() > s_max_pending_writes ||
+            pending_writes.front().wait_for(std::chrono::seconds(0)) == std::future_status::ready)) {
+      pending_writes.front().wait();
+      pending_writes.pop_front();
     }
 
     if (first_timestamp == 0) {
@@ -291,6 +272,9 @@ TPStreamWriterModule::do_work(std::atomic<bool>& running_flag)
     last_timestamp = tpset.start_time;
   } // while(running)
 
+  for (auto& pending : pending_writes)
+    pending.wait();
+
   auto end_time = steady_clock::now();
   auto time_ms = duration_cast<milliseconds>(end_time - start_time).count();
   float rate_hz = 1e3 * static_cast<float>(n_tpset_received) / time_ms;
@@ -301,6 +285,51 @@ TPStreamWriterModule::do_work(std::atomic<bool>& running_flag)
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_work() method";
 } // NOLINT Function length
 
+void
+TPStreamWriterModule::complete_timeslice(const daqdataformats::TimeSlice& timeslice,
+                                         size_t largest_timeslice_number,
+                                         std::exception_ptr problem)
+{
+  if (!problem) {
+    ++m_timeslices_written;
+    m_bytes_output += timeslice.get_total_size_bytes();
+    size_t number_of_tps_written =
+      (timeslice.get_sum_of_fragment_payload_sizes() / sizeof(trgdataformats::TriggerPrimitive));
+    m_tps_written += number_of_tps_written;
+    m_total_tps_written += number_of_tps_written;
+    return;
+  }
+
+  try {
+    std::rethrow_exception(problem);
+  } catch (const IgnorableDataStoreProblem& excpt) {
+    int timeslice_number_diff = largest_timeslice_number - timeslice.get_header().timeslice_number;
+    double seconds_too_late = m_accumulation_interval_seconds * timeslice_number_diff;
+    m_tardy_timeslice_max_seconds = std::max(m_tardy_timeslice_max_seconds.load(), seconds_too_late);
+    if (m_warn_user_when_tardy_tps_are_discarded) {
+      std::ostringstream sid_list;
+      bool first_frag = true;
+      for (auto const& frag_ptr : timeslice.get_fragments_ref()) {
+        if (first_frag) {first_frag = false;}
+        else {sid_list << ",";}
+        sid_list << frag_ptr->get_element_id().to_string();
+      }
+      ers::warning(TardyTPsDiscarded(ERS_HERE,
+                                     get_name(),
+                                     sid_list.str(),
+                                     timeslice.get_header().timeslice_number,
+                                     seconds_too_late));
+    }
+  } catch (const std::exception& excpt) {
+    // including a RetryableDataStoreProblem whose retries were stopped at the end of the run
+    ers::error(DataWritingProblem(ERS_HERE,
+                                  get_name(),
+                                  timeslice.get_header().timeslice_number,
+                                  timeslice.get_header().run_number,
+                                  excpt));
+  }
+}
+
 } // namespace dfmodules
 } // namespace dunedaq
 
@@ -20,6 +20,7 @@
 #include "trigger/TPSet.hpp"
 #include "utilities/WorkerThread.hpp"
 
+#include <exception>
 #include <memory>
 #include <string>
 
@@ -57,6 +58,12 @@ private:
   dunedaq::utilities::WorkerThread m_thread;
   void do_work(std::atomic<bool>&);
 
+  // Called by the DataStore when the asynchronous write of a TimeSlice has completed
+  void complete_timeslice(const daqdataformats::TimeSlice& timeslice,
+                          size_t largest_timeslice_number,
+                          std::exception_ptr problem);
+  static constexpr size_t s_max_pending_writes = 100; // TimeSlices handed to the DataStore and not yet written
+
   // Configuration
 
   std::shared_ptr<appfwk::ModuleConfiguration> m_module_configuration;
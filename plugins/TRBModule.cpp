@@ -197,6 +197,8 @@ TRBModule::do_scrap(const data_t& /*args*/)
 {
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_scrap() method";
 
+  m_mon_senders.clear();
+
   TLOG() << get_name() << " successfully scrapped";
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_scrap() method";
 }
@@ -671,7 +673,6 @@ TRBModule::send_trigger_record(const TriggerId& id, std::atomic<bool>& running)
     while (it != m_mon_requests.end()) {
       // send TR to mon if correct trigger type
       if (it->trigger_type == temp_record->get_header_data().trigger_type) {
-        auto iom = iomanager::IOManager::get();
         bool wasSentSuccessfully = false;
         do {
           try {
@@ -679,7 +680,7 @@ TRBModule::send_trigger_record(const TriggerId& id, std::atomic<bool>& running)
             auto trigger_record_bytes =
               serialization::serialize(temp_record, serialization::SerializationType::kMsgPack);
             trigger_record_ptr_t record_copy = serialization::deserialize<trigger_record_ptr_t>(trigger_record_bytes);
-            iom->get_sender<trigger_record_ptr_t>(it->data_destination)->send(std::move(record_copy), m_queue_timeout);
+            m_mon_senders.get(it->data_destination)->send(std::move(record_copy), m_queue_timeout);
             ++m_trmon_sent_counter;
             wasSentSuccessfully = true;
           } catch (const ers::Issue& excpt) {
@@ -20,6 +20,7 @@
 #include "dfmessages/TRMonRequest.hpp"
 #include "dfmessages/TriggerDecision.hpp"
 #include "dfmessages/Types.hpp"
+#include "dfmodules/SenderCache.hpp"
 
 #include "appfwk/DAQModule.hpp"
 #include "utilities/WorkerThread.hpp"
@@ -259,6 +260,7 @@ private:
   std::mutex m_mon_mutex;
   std::shared_ptr<iomanager::ReceiverConcept<dfmessages::TRMonRequest>> m_mon_receiver;
   std::list<dfmessages::TRMonRequest> m_mon_requests;
+  SenderCache<trigger_record_ptr_t> m_mon_senders;
 
   // book related metrics
   using metric_counter_type = uint64_t; // decltype(triggerrecordbuilderinfo::Info::pending_trigger_decisions);
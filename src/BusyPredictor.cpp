@@ -0,0 +1,101 @@
+/**
+ * @file BusyPredictor.cpp BusyPredictor Class Implementation
+ *
+ * The BusyPredictor class decides the busy state advertised by the DFO
+ * by combining the rate of incoming TriggerDecisions with the rate of
+ * completions reported by the dataflow applications.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/BusyPredictor.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace dunedaq {
+namespace dfmodules {
+
+BusyPredictor::BusyPredictor(std::chrono::milliseconds horizon, std::chrono::milliseconds min_dwell, double smoothing)
+  : m_horizon(horizon)
+  , m_min_dwell(min_dwell)
+  , m_window(std::max<clock_t::duration>(horizon / 4, std::chrono::milliseconds(1)))
+  , m_smoothing(std::clamp(smoothing, 0.01, 1.))
+  , m_window_start(clock_t::now())
+  , m_last_transition(m_window_start)
+{}
+
+void
+BusyPredictor::reset(clock_t::time_point now)
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+  m_decisions.store(0);
+  m_completions.store(0);
+  m_decision_rate.store(0.);
+  m_completion_rate.store(0.);
+  m_predicted_busy.store(0);
+  m_window_start = m_last_transition = now;
+  m_busy = false;
+}
+
+void
+BusyPredictor::update_rates(clock_t::time_point now)
+{
+  // called with m_mutex held
+  auto elapsed = now - m_window_start;
+  if (elapsed < m_window)
+    return;
+
+  double seconds = std::chrono::duration<double>(elapsed).count();
+  double decision_sample = m_decisions.exchange(0) / seconds;
+  double completion_sample = m_completions.exchange(0) / seconds;
+
+  // windows in which nothing was evaluated count as additional smoothing steps,
+  // so that rates decay while the DFO is idle
+  double steps = std::floor(elapsed / m_window);
+  double weight = 1. - std::pow(1. - m_smoothing, steps);
+
+  m_decision_rate.store(m_decision_rate.load() + weight * (decision_sample - m_decision_rate.load()));
+  m_completion_rate.store(m_completion_rate.load() + weight * (completion_sample - m_completion_rate.load()));
+  m_window_start = now;
+}
+
+bool
+BusyPredictor::evaluate(bool hard_busy, size_t free_slots, clock_t::time_point now)
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+  update_rates(now);
+
+  if (hard_busy) {
+    if (!m_busy) {
+      m_busy = true;
+      m_last_transition = now;
+    }
+    return true;
+  }
+
+  // time until the free slots are exhausted if the current rates persist
+  double excess = m_decision_rate.load() - m_completion_rate.load();
+  double time_to_full =
+    excess > 0. ? free_slots / excess : std::numeric_limits<double>::infinity();
+
+  if (now - m_last_transition < m_min_dwell)
+    return m_busy;
+
+  if (!m_busy && time_to_full < m_horizon.count()) {
+    m_busy = true;
+    m_last_transition = now;
+    ++m_predicted_busy;
+  } else if (m_busy && time_to_full > 2 * m_horizon.count()) {
+    m_busy = false;
+    m_last_transition = now;
+  }
+
+  return m_busy;
+}
+
+} // namespace dfmodules
+} // namespace dunedaq
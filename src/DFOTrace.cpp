@@ -0,0 +1,199 @@
+/**
+ * @file DFOTrace.cpp DFOTraceWriter and DFOTraceReader Classes Implementation
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/DFOTrace.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace dunedaq {
+namespace dfmodules {
+
+DFOTraceWriter::DFOTraceWriter(const std::string& file_name, size_t buffer_records)
+  : m_file_name(file_name)
+  , m_buffer_records(std::max<size_t>(buffer_records, 1))
+  , m_start(std::chrono::steady_clock::now())
+  , m_file(file_name, std::ios::binary | std::ios::trunc)
+{
+  if (!m_file.is_open())
+    throw DFOTraceFileProblem(ERS_HERE, file_name, "unable to open the file for writing");
+  m_file.write(s_magic, sizeof(s_magic));
+  m_buffer.records.reserve(m_buffer_records);
+  m_writer = std::thread(&DFOTraceWriter::do_write, this);
+}
+
+DFOTraceWriter::~DFOTraceWriter()
+{
+  {
+    std::lock_guard<std::mutex> lk(m_buffer_mutex);
+    hand_over_buffer();
+    m_stopping = true;
+  }
+  m_buffer_full.notify_one();
+  m_writer.join();
+}
+
+uint32_t // NOLINT(build/unsigned)
+DFOTraceWriter::add_app(const std::string& name)
+{
+  std::lock_guard<std::mutex> lk(m_buffer_mutex);
+  auto& rec = m_buffer.records.emplace_back();
+  rec.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count();
+  rec.type = DFOTraceRecord::kApp;
+  rec.app = m_n_apps++;
+  rec.trigger_number = name.size();
+  m_buffer.app_names.push_back(name);
+  auto app = rec.app;
+
+  if (m_buffer.records.size() >= m_buffer_records)
+    hand_over_buffer();
+  return app;
+}
+
+void
+DFOTraceWriter::record(DFOTraceRecord::Type type,
+                       uint64_t trigger_number, // NOLINT(build/unsigned)
+                       uint32_t app,            // NOLINT(build/unsigned)
+                       uint64_t bytes)          // NOLINT(build/unsigned)
+{
+  if (m_failed.load(std::memory_order_relaxed))
+    return;
+
+  auto now = std::chrono::steady_clock::now();
+
+  std::lock_guard<std::mutex> lk(m_buffer_mutex);
+  auto& rec = m_buffer.records.emplace_back();
+  rec.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_start).count();
+  rec.trigger_number = trigger_number;
+  rec.bytes = bytes;
+  rec.app = app;
+  rec.type = type;
+
+  if (m_buffer.records.size() >= m_buffer_records)
+    hand_over_buffer();
+}
+
+void
+DFOTraceWriter::flush()
+{
+  std::unique_lock<std::mutex> lk(m_buffer_mutex);
+  hand_over_buffer();
+  m_buffer_full.notify_one();
+  m_buffers_written.wait(lk, [this]() { return m_full_buffers.empty() && !m_writing; });
+}
+
+void
+DFOTraceWriter::hand_over_buffer()
+{
+  if (m_buffer.records.empty())
+    return;
+
+  if (m_failed.load()) {
+    m_buffer.records.clear();
+    m_buffer.app_names.clear();
+    return;
+  }
+  if (m_full_buffers.size() >= s_max_pending_buffers) {
+    // the trace must not hold back the DFO, nor grow without limit
+    m_buffer.records.clear();
+    m_buffer.app_names.clear();
+    fail("the trace is written more slowly than it is recorded");
+    return;
+  }
+
+  m_full_buffers.push_back(std::move(m_buffer));
+  m_buffer = Buffer();
+  m_buffer.records.reserve(m_buffer_records);
+  m_buffer_full.notify_one();
+}
+
+void
+DFOTraceWriter::fail(const std::string& message)
+{
+  if (!m_failed.exchange(true))
+    ers::error(DFOTraceFileProblem(ERS_HERE, m_file_name, message + ", the trace is disabled"));
+}
+
+bool
+DFOTraceWriter::write(const Buffer& buffer)
+{
+  // the kApp records are followed by the application name
+  auto name_it = buffer.app_names.begin();
+  size_t first = 0;
+  for (size_t i = 0; i < buffer.records.size(); ++i) {
+    if (buffer.records[i].type != DFOTraceRecord::kApp)
+      continue;
+    m_file.write(reinterpret_cast<const char*>(buffer.records.data() + first), // NOLINT
+                 (i + 1 - first) * sizeof(DFOTraceRecord));
+    m_file.write(name_it->data(), name_it->size());
+    ++name_it;
+    first = i + 1;
+  }
+  m_file.write(reinterpret_cast<const char*>(buffer.records.data() + first), // NOLINT
+               (buffer.records.size() - first) * sizeof(DFOTraceRecord));
+  m_file.flush();
+  return m_file.good();
+}
+
+void
+DFOTraceWriter::do_write()
+{
+  std::unique_lock<std::mutex> lk(m_buffer_mutex);
+  while (true) {
+    m_buffer_full.wait(lk, [this]() { return !m_full_buffers.empty() || m_stopping; });
+    if (m_full_buffers.empty())
+      break;
+
+    auto buffer = std::move(m_full_buffers.front());
+    m_full_buffers.pop_front();
+    m_writing = true;
+    lk.unlock();
+    bool written = m_failed.load() || write(buffer);
+    lk.lock();
+    m_writing = false;
+    if (!written)
+      fail("write failed");
+    m_buffers_written.notify_all();
+  }
+}
+
+DFOTraceReader::DFOTraceReader(const std::string& file_name)
+  : m_file_name(file_name)
+  , m_file(file_name, std::ios::binary)
+{
+  if (!m_file.is_open())
+    throw DFOTraceFileProblem(ERS_HERE, file_name, "unable to open the file for reading");
+
+  char magic[sizeof(DFOTraceWriter::s_magic)];
+  m_file.read(magic, sizeof(magic));
+  if (!m_file.good() || std::memcmp(magic, DFOTraceWriter::s_magic, sizeof(magic)) != 0)
+    throw DFOTraceFileProblem(ERS_HERE, file_name, "not a DFO trace");
+}
+
+bool
+DFOTraceReader::next(DFOTraceRecord& record)
+{
+  if (!m_file.read(reinterpret_cast<char*>(&record), sizeof(record))) // NOLINT
+    return false;
+
+  if (record.type == DFOTraceRecord::kApp) {
+    std::string name(record.trigger_number, '\0');
+    if (!m_file.read(name.data(), name.size()))
+      throw DFOTraceFileProblem(ERS_HERE, m_file_name, "truncated application name");
+    if (m_app_names.size() <= record.app)
+      m_app_names.resize(record.app + 1);
+    m_app_names[record.app] = name;
+  }
+  return true;
+}
+
+} // namespace dfmodules
+} // namespace dunedaq
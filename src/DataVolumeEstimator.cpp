@@ -0,0 +1,89 @@
+/**
+ * @file DataVolumeEstimator.cpp DataVolumeEstimator Class Implementation
+ *
+ * The DataVolumeEstimator class predicts the size of the TriggerRecord
+ * produced by a TriggerDecision from the readout windows of its components.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/DataVolumeEstimator.hpp"
+
+#include <algorithm>
+
+namespace dunedaq {
+namespace dfmodules {
+
+DataVolumeEstimator::DataVolumeEstimator(double step_size)
+  : m_step_size(std::clamp(step_size, 0.001, 1.))
+{}
+
+double
+DataVolumeEstimator::predict(const Model& model, daqdataformats::timestamp_diff_t ticks)
+{
+  return std::max(0., model.offset + model.slope * (ticks / model.tick_scale));
+}
+
+uint64_t // NOLINT(build/unsigned)
+DataVolumeEstimator::estimate(const dfmessages::TriggerDecision& decision) const
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+  double total = 0.;
+  for (const auto& component : decision.components) {
+    auto it = m_models.find(component.component);
+    if (it != m_models.end())
+      total += predict(it->second, window_ticks(component));
+  }
+  return static_cast<uint64_t>(total); // NOLINT(build/unsigned)
+}
+
+uint64_t // NOLINT(build/unsigned)
+DataVolumeEstimator::estimate(const daqdataformats::SourceID& source_id, daqdataformats::timestamp_diff_t ticks) const
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+  auto it = m_models.find(source_id);
+  return it == m_models.end() ? 0 : static_cast<uint64_t>(predict(it->second, ticks)); // NOLINT(build/unsigned)
+}
+
+void
+DataVolumeEstimator::update(const daqdataformats::SourceID& source_id,
+                            daqdataformats::timestamp_diff_t ticks,
+                            uint64_t bytes) // NOLINT(build/unsigned)
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+  auto [it, inserted] = m_models.try_emplace(source_id);
+  auto& model = it->second;
+
+  if (inserted) {
+    // the first observation fixes the scale and is reproduced exactly
+    model.tick_scale = ticks > 0 ? static_cast<double>(ticks) : 1.;
+    model.slope = ticks > 0 ? static_cast<double>(bytes) : 0.;
+    model.offset = ticks > 0 ? 0. : static_cast<double>(bytes);
+    return;
+  }
+
+  double x = ticks / model.tick_scale;
+  double error = static_cast<double>(bytes) - (model.offset + model.slope * x);
+  double norm = 1. + x * x;
+  model.offset += m_step_size * error / norm;
+  model.slope += m_step_size * error * x / norm;
+}
+
+size_t
+DataVolumeEstimator::size() const
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+  return m_models.size();
+}
+
+void
+DataVolumeEstimator::clear()
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+  m_models.clear();
+}
+
+} // namespace dfmodules
+} // namespace dunedaq
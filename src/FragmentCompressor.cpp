@@ -0,0 +1,184 @@
+/**
+ * @file FragmentCompressor.cpp FragmentCompressor Class Implementation
+ *
+ * The FragmentCompressor class compresses the fragments of a TriggerRecord
+ * on a pool of worker threads, before the record is written.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/FragmentCompressor.hpp"
+
+#include "boost/iostreams/device/back_inserter.hpp"
+#include "boost/iostreams/filter/zlib.hpp"
+#include "boost/iostreams/filtering_stream.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <exception>
+#include <mutex>
+#include <sstream>
+#include <utility>
+
+namespace dunedaq {
+namespace dfmodules {
+
+namespace {
+// CPU time of the calling thread, in microseconds
+uint64_t // NOLINT(build/unsigned)
+thread_cpu_us()
+{
+  timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return static_cast<uint64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000; // NOLINT(build/unsigned)
+}
+} // namespace
+
+FragmentCompressor::FragmentCompressor(const levels_t& levels, size_t n_threads)
+  : m_levels(levels)
+{
+  for (size_t i = 0; i < std::max(n_threads, static_cast<size_t>(1)); ++i)
+    m_workers.emplace_back(&FragmentCompressor::do_work, this);
+}
+
+FragmentCompressor::~FragmentCompressor()
+{
+  m_running = false;
+  for (auto& worker : m_workers)
+    worker.join();
+}
+
+FragmentCompressor::CompressedRecord
+FragmentCompressor::compress(const daqdataformats::TriggerRecord& tr)
+{
+  const auto& fragments = tr.get_fragments_ref();
+  std::vector<std::optional<CompressedFragment>> results(fragments.size());
+
+  std::mutex done_mutex;
+  std::condition_variable done;
+  size_t pending = 0;
+  std::exception_ptr problem;
+
+  for (size_t i = 0; i < fragments.size(); ++i) {
+    auto level_it = m_levels.find(fragments[i]->get_fragment_type());
+    if (level_it == m_levels.end() || fragments[i]->get_size() > s_max_fragment_bytes)
+      continue;
+
+    {
+      std::lock_guard<std::mutex> lk(done_mutex);
+      ++pending;
+    }
+    m_tasks.push(
+      [&, i, level = level_it->second]() {
+        std::exception_ptr task_problem;
+        try {
+          results[i] = compress_fragment(*fragments[i], level);
+        } catch (...) { // NOLINT(runtime/exceptions)
+          // NOLINT here because the exception is rethrown by the calling thread
+          task_problem = std::current_exception();
+        }
+        // notified under the lock, as done goes away once the caller sees pending at 0
+        std::lock_guard<std::mutex> lk(done_mutex);
+        if (task_problem)
+          problem = task_problem;
+        --pending;
+        done.notify_all();
+      },
+      1);
+  }
+
+  {
+    std::unique_lock<std::mutex> lk(done_mutex);
+    done.wait(lk, [&pending]() { return pending == 0; });
+  }
+  if (problem)
+    std::rethrow_exception(problem);
+
+  CompressedRecord compressed;
+  compressed.record = std::make_unique<daqdataformats::TriggerRecord>(tr.get_header_ref());
+  for (size_t i = 0; i < fragments.size(); ++i) {
+    if (results[i]) {
+      auto placeholder = std::make_unique<daqdataformats::Fragment>(std::vector<std::pair<void*, size_t>>());
+      placeholder->set_header_fields(results[i]->header);
+      compressed.record->add_fragment(std::move(placeholder));
+      compressed.fragments.push_back(std::move(*results[i]));
+    } else {
+      // the fragments stored as they are are not copied, the record being
+      // written before tr goes away
+      compressed.record->add_fragment(std::make_unique<daqdataformats::Fragment>(
+        fragments[i]->get_storage_location(), daqdataformats::Fragment::BufferAdoptionMode::kReadOnlyMode));
+    }
+  }
+  return compressed;
+}
+
+std::string
+FragmentCompressor::get_compressed_types() const
+{
+  std::ostringstream types;
+  for (const auto& [type, level] : m_levels) {
+    if (types.tellp() > 0)
+      types << ",";
+    types << daqdataformats::fragment_type_to_string(type);
+  }
+  return types.str();
+}
+
+std::vector<char>
+FragmentCompressor::deflate(const void* data, size_t size, int level)
+{
+  std::vector<char> compressed;
+  compressed.reserve(size / 2);
+  boost::iostreams::filtering_ostream out;
+  out.push(boost::iostreams::zlib_compressor(boost::iostreams::zlib_params(level)));
+  out.push(boost::iostreams::back_inserter(compressed));
+  out.write(static_cast<const char*>(data), size);
+  boost::iostreams::close(out);
+  return compressed;
+}
+
+std::vector<char>
+FragmentCompressor::inflate(const void* data, size_t size)
+{
+  std::vector<char> payload;
+  boost::iostreams::filtering_ostream out;
+  out.push(boost::iostreams::zlib_decompressor());
+  out.push(boost::iostreams::back_inserter(payload));
+  out.write(static_cast<const char*>(data), size);
+  boost::iostreams::close(out);
+  return payload;
+}
+
+std::optional<FragmentCompressor::CompressedFragment>
+FragmentCompressor::compress_fragment(const daqdataformats::Fragment& fragment, int level)
+{
+  auto start = thread_cpu_us();
+
+  std::optional<CompressedFragment> compressed;
+  auto data = deflate(fragment.get_storage_location(), fragment.get_size(), level);
+  if (data.size() < fragment.get_size()) {
+    compressed = CompressedFragment{ fragment.get_header(), level, std::move(data) };
+  }
+
+  m_bytes_in += fragment.get_size();
+  m_bytes_out += compressed ? compressed->data.size() : fragment.get_size();
+  m_cpu_us += thread_cpu_us() - start;
+  return compressed;
+}
+
+void
+FragmentCompressor::do_work()
+{
+  while (m_running.load() || !m_tasks.empty()) {
+    auto task = m_tasks.pop(std::chrono::milliseconds(10));
+    if (task)
+      (*task)();
+  }
+}
+
+} // namespace dfmodules
+} // namespace dunedaq
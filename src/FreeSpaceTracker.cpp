@@ -0,0 +1,105 @@
+/**
+ * @file FreeSpaceTracker.cpp FreeSpaceTracker Class Implementation
+ *
+ * The FreeSpaceTracker class keeps an estimate of the free space on the disk
+ * written by a DataStore without querying the file system for each write.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/FreeSpaceTracker.hpp"
+
+#include <algorithm>
+#include <thread>
+#include <utility>
+
+namespace dunedaq {
+namespace dfmodules {
+
+FreeSpaceTracker::FreeSpaceTracker(sampler_t sampler, std::chrono::milliseconds sampling_period, size_t margin_bytes)
+  : m_sampler(std::move(sampler))
+  , m_sampling_period(std::max(sampling_period, std::chrono::milliseconds(0)))
+  , m_margin(margin_bytes)
+  , m_thread(std::bind(&FreeSpaceTracker::do_work, this, std::placeholders::_1))
+{}
+
+FreeSpaceTracker::~FreeSpaceTracker()
+{
+  stop();
+}
+
+void
+FreeSpaceTracker::start()
+{
+  sample();
+  if (m_sampling_period.count() > 0 && !m_thread.thread_running())
+    m_thread.start_working_thread("free-space");
+}
+
+void
+FreeSpaceTracker::stop()
+{
+  if (m_thread.thread_running())
+    m_thread.stop_working_thread();
+}
+
+size_t
+FreeSpaceTracker::free_space(size_t needed_bytes)
+{
+  if (m_sampling_period.count() > 0) {
+    auto current = estimate();
+    if (current > needed_bytes && current - needed_bytes > m_margin)
+      return current;
+  }
+
+  ++m_sync_samples;
+  return sample();
+}
+
+size_t
+FreeSpaceTracker::estimate() const
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+  if (!m_has_sample)
+    return 0;
+  auto written = m_written.load() - m_written_at_sample;
+  return m_sampled_free > written ? m_sampled_free - written : 0;
+}
+
+size_t
+FreeSpaceTracker::sample()
+{
+  // the bytes written while the file system is queried are counted again
+  // after the sample, which errs on the side of less free space
+  auto written = m_written.load();
+  auto start = std::chrono::steady_clock::now();
+  auto free_bytes = m_sampler();
+  m_sampling_us +=
+    std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+  ++m_samples;
+
+  std::lock_guard<std::mutex> lk(m_mutex);
+  m_sampled_free = free_bytes;
+  m_written_at_sample = written;
+  m_has_sample = true;
+  return free_bytes;
+}
+
+void
+FreeSpaceTracker::do_work(std::atomic<bool>& running_flag)
+{
+  auto next_sample = std::chrono::steady_clock::now() + m_sampling_period;
+  while (running_flag.load()) {
+    auto now = std::chrono::steady_clock::now();
+    if (now >= next_sample) {
+      sample();
+      next_sample = now + m_sampling_period;
+    }
+    std::this_thread::sleep_for(std::min(m_sampling_period, std::chrono::milliseconds(10)));
+  }
+}
+
+} // namespace dfmodules
+} // namespace dunedaq
@@ -14,10 +14,14 @@
 
 #include "logging/Logging.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <limits>
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 /**
  * @brief Name used by TRACE TLOG calls from this source file
@@ -37,33 +41,158 @@ TriggerRecordBuilderData::TriggerRecordBuilderData(std::string connection_name,
 
 TriggerRecordBuilderData::TriggerRecordBuilderData(std::string connection_name,
                                                    size_t busy_threshold,
-                                                   size_t free_threshold)
+                                                   size_t free_threshold,
+                                                   dataflow_app_id_t app_id)
   : m_busy_threshold(busy_threshold)
   , m_free_threshold(busy_threshold)
   , m_is_busy(false)
   , m_in_error(false)
   , m_connection_name(connection_name)
+  , m_app_id(app_id)
 {
   if (busy_threshold < free_threshold)
     throw dfmodules::DFOThresholdsNotConsistent(ERS_HERE, busy_threshold, free_threshold);
 }
 
+TriggerRecordBuilderData::~TriggerRecordBuilderData()
+{
+  // remove our contribution from the aggregate
+  if (m_occupancy) {
+    m_occupancy->used_slots -= m_assigned_trigger_decisions.size();
+    if (!is_busy())
+      --m_occupancy->available_apps;
+    if (is_in_error())
+      --m_occupancy->apps_in_error;
+  }
+}
+
+void
+TriggerRecordBuilderData::set_occupancy(std::shared_ptr<DataflowOccupancy> occupancy)
+{
+  auto lk = std::lock_guard<std::mutex>(m_assigned_trigger_decisions_mutex);
+  m_occupancy = occupancy;
+  if (m_occupancy) {
+    m_occupancy->used_slots += m_assigned_trigger_decisions.size();
+    if (!is_busy())
+      ++m_occupancy->available_apps;
+    if (is_in_error())
+      ++m_occupancy->apps_in_error;
+  }
+}
+
+void
+TriggerRecordBuilderData::set_in_error(bool err)
+{
+  auto lk = std::lock_guard<std::mutex>(m_assigned_trigger_decisions_mutex);
+  update_status(m_is_busy.load(), err);
+}
+
+void
+TriggerRecordBuilderData::update_status(bool is_busy, bool in_error)
+{
+  update_status(is_busy, in_error, m_health.load());
+}
+
+void
+TriggerRecordBuilderData::update_status(bool is_busy, bool in_error, Health health)
+{
+  bool was_available = !(m_is_busy.load() || m_in_error.load() || m_health.load() == Health::kQuarantined);
+  bool was_in_error = m_in_error.load();
+
+  m_is_busy.store(is_busy);
+  m_in_error.store(in_error);
+  m_health.store(health);
+
+  if (!m_occupancy)
+    return;
+
+  bool available = !(is_busy || in_error || health == Health::kQuarantined);
+  if (available != was_available) {
+    if (available)
+      ++m_occupancy->available_apps;
+    else
+      --m_occupancy->available_apps;
+  }
+  if (in_error != was_in_error) {
+    if (in_error)
+      ++m_occupancy->apps_in_error;
+    else
+      --m_occupancy->apps_in_error;
+  }
+}
+
+size_t
+TriggerRecordBuilderData::busy_limit(Health health) const
+{
+  auto busy = m_busy_threshold.load();
+  return health == Health::kDegraded ? std::max<size_t>(busy / 2, 1) : busy;
+}
+
+size_t
+TriggerRecordBuilderData::capacity() const
+{
+  auto health = m_health.load();
+  if (m_in_error.load() || health == Health::kQuarantined)
+    return 0;
+  return busy_limit(health);
+}
+
+size_t
+TriggerRecordBuilderData::free_limit(Health health) const
+{
+  return std::min(m_free_threshold.load(), busy_limit(health));
+}
+
+void
+TriggerRecordBuilderData::set_health(Health health, double score)
+{
+  auto lk = std::lock_guard<std::mutex>(m_assigned_trigger_decisions_mutex);
+  m_health_score.store(score);
+  if (health == m_health.load())
+    return;
+
+  ++m_health_changes;
+  bool busy = m_is_busy.load();
+  if (m_assigned_trigger_decisions.size() >= busy_limit(health))
+    busy = true;
+  else if (m_assigned_trigger_decisions.size() < free_limit(health))
+    busy = false;
+  update_status(busy, m_in_error.load(), health);
+}
+
 std::shared_ptr<AssignedTriggerDecision>
 TriggerRecordBuilderData::extract_assignment(daqdataformats::trigger_number_t trigger_number)
 {
-  std::shared_ptr<AssignedTriggerDecision> dec_ptr;
   auto lk = std::lock_guard<std::mutex>(m_assigned_trigger_decisions_mutex);
+  auto dec_ptr = extract_assignment_unlocked(trigger_number);
+
+  if (m_assigned_trigger_decisions.size() < free_limit(m_health.load()))
+    update_status(false, m_in_error.load());
+
+  return dec_ptr;
+}
+
+std::shared_ptr<AssignedTriggerDecision>
+TriggerRecordBuilderData::extract_assignment_unlocked(daqdataformats::trigger_number_t trigger_number)
+{
+  std::shared_ptr<AssignedTriggerDecision> dec_ptr;
   for (auto it = m_assigned_trigger_decisions.begin(); it != m_assigned_trigger_decisions.end(); ++it) {
     if ((*it)->decision.trigger_number == trigger_number) {
       dec_ptr = *it;
       m_assigned_trigger_decisions.erase(it);
+      m_outstanding_bytes -= dec_ptr->estimated_bytes;
+      if (m_occupancy)
+        --m_occupancy->used_slots;
       break;
     }
   }
 
-  if (m_assigned_trigger_decisions.size() < m_free_threshold.load())
-    m_is_busy.store(false);
-
+  if (dec_ptr) {
+    // kept for reuse, make_assignment waits until the caller has released it
+    auto pool_lk = std::lock_guard<std::mutex>(m_assignment_pool_mutex);
+    if (m_assignment_pool.size() < s_assignment_pool_size)
+      m_assignment_pool.push_back(dec_ptr);
+  }
   return dec_ptr;
 }
 
@@ -87,38 +216,164 @@ TriggerRecordBuilderData::complete_assignment(daqdataformats::trigger_number_t t
 
   auto dec_ptr = extract_assignment(trigger_number);
 
-  if (dec_ptr == nullptr)
+  if (dec_ptr == nullptr) {
+    auto lk = std::lock_guard<std::mutex>(m_assigned_trigger_decisions_mutex);
+    if (forget_reclaimed_unlocked(trigger_number))
+      return nullptr;
     throw AssignedTriggerDecisionNotFound(ERS_HERE, trigger_number, m_connection_name);
+  }
 
   auto now = std::chrono::steady_clock::now();
   auto time = std::chrono::duration_cast<std::chrono::microseconds>(now - dec_ptr->assigned_time);
   {
     auto lk = std::lock_guard<std::mutex>(m_latency_info_mutex);
-    m_latency_info.emplace_back(now, time);
+    add_latency_unlocked(now, time);
+  }
+
+  if (metadata_fun)
+    metadata_fun(m_metadata);
+
+  update_completion_statistics(*dec_ptr, now);
+
+  return dec_ptr;
+}
+
+void
+TriggerRecordBuilderData::complete_assignments(const std::vector<daqdataformats::trigger_number_t>& trigger_numbers,
+                                               std::vector<std::shared_ptr<AssignedTriggerDecision>>& completed,
+                                               std::function<void(nlohmann::json&)> metadata_fun)
+{
+  completed.clear();
+  std::vector<daqdataformats::trigger_number_t> not_found;
 
-    if (m_latency_info.size() > 1000)
-      m_latency_info.pop_front();
+  {
+    auto lk = std::lock_guard<std::mutex>(m_assigned_trigger_decisions_mutex);
+    for (auto trigger_number : trigger_numbers) {
+      auto dec_ptr = extract_assignment_unlocked(trigger_number);
+      if (dec_ptr == nullptr) {
+        if (!forget_reclaimed_unlocked(trigger_number))
+          not_found.push_back(trigger_number);
+      } else {
+        completed.push_back(dec_ptr);
+      }
+    }
+
+    if (m_assigned_trigger_decisions.size() < free_limit(m_health.load()))
+      update_status(false, m_in_error.load());
+  }
+
+  for (auto trigger_number : not_found) {
+    ers::error(AssignedTriggerDecisionNotFound(ERS_HERE, trigger_number, m_connection_name));
+  }
+
+  if (completed.empty())
+    return;
+
+  auto now = std::chrono::steady_clock::now();
+  {
+    auto lk = std::lock_guard<std::mutex>(m_latency_info_mutex);
+    for (const auto& dec_ptr : completed) {
+      add_latency_unlocked(now, std::chrono::duration_cast<std::chrono::microseconds>(now - dec_ptr->assigned_time));
+    }
   }
 
   if (metadata_fun)
     metadata_fun(m_metadata);
 
+  for (const auto& dec_ptr : completed) {
+    update_completion_statistics(*dec_ptr, now);
+  }
+}
+
+void
+TriggerRecordBuilderData::add_latency_unlocked(std::chrono::steady_clock::time_point now,
+                                               std::chrono::microseconds latency)
+{
+  m_latency_info[m_latency_info_next] = std::make_pair(now, latency);
+  m_latency_info_next = (m_latency_info_next + 1) % s_latency_info_size;
+  if (m_latency_info_count < s_latency_info_size)
+    ++m_latency_info_count;
+}
+
+void
+TriggerRecordBuilderData::update_completion_statistics(const AssignedTriggerDecision& assignment,
+                                                       std::chrono::steady_clock::time_point now)
+{
   ++m_complete_counter;
-  auto completion_time =
-    std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - dec_ptr->assigned_time);
+  auto completion_time = std::chrono::duration_cast<std::chrono::microseconds>(now - assignment.assigned_time);
   if (completion_time.count() < m_min_complete_time.load())
     m_min_complete_time.store(completion_time.count());
   if (completion_time.count() > m_max_complete_time.load())
     m_max_complete_time.store(completion_time.count());
 
+  // accumulated for the regular summary
+  uint64_t us = std::max<int64_t>(completion_time.count(), 0); // NOLINT(build/unsigned)
+  size_t bin = std::min<size_t>(us == 0 ? 0 : 64 - __builtin_clzll(us), s_completion_bins - 1);
+  m_completion_histogram[bin].fetch_add(1, std::memory_order_relaxed);
+  m_completion_time_sum.fetch_add(us, std::memory_order_relaxed);
+  auto max = m_completion_time_max.load(std::memory_order_relaxed);
+  while (us > max && !m_completion_time_max.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+  }
+
+  auto period = m_completion_event_period.load(std::memory_order_relaxed);
+  if (period == 0 || m_completion_events.fetch_add(1, std::memory_order_relaxed) % period != 0)
+    return;
+
   opmon::TRCompleteInfo i;
   i.set_completion_time(completion_time.count());
-  i.set_tr_number( dec_ptr->decision.trigger_number );
-  i.set_run_number( dec_ptr->decision.run_number );
-  i.set_trigger_type( dec_ptr->decision.trigger_type );
+  i.set_tr_number( assignment.decision.trigger_number );
+  i.set_run_number( assignment.decision.run_number );
+  i.set_trigger_type( assignment.decision.trigger_type );
   publish( std::move(i), {}, opmonlib::to_level(opmonlib::EntryOpMonLevel::kEventDriven) );
-  
-  return dec_ptr;
+}
+
+void
+TriggerRecordBuilderData::set_completion_sampling(double fraction)
+{
+  uint64_t period = 0; // NOLINT(build/unsigned)
+  if (fraction > 0.)
+    period = std::max<uint64_t>(1, std::llround(1. / std::min(fraction, 1.))); // NOLINT(build/unsigned)
+  m_completion_event_period.store(period);
+}
+
+void
+TriggerRecordBuilderData::publish_completion_summary()
+{
+  std::array<uint64_t, s_completion_bins> histogram; // NOLINT(build/unsigned)
+  uint64_t completed = 0;                            // NOLINT(build/unsigned)
+  for (size_t i = 0; i < s_completion_bins; ++i) {
+    histogram[i] = m_completion_histogram[i].exchange(0, std::memory_order_relaxed);
+    completed += histogram[i];
+  }
+  auto sum = m_completion_time_sum.exchange(0, std::memory_order_relaxed);
+  auto max = m_completion_time_max.exchange(0, std::memory_order_relaxed);
+  if (completed == 0)
+    return;
+
+  // linear interpolation inside the bin containing the requested rank
+  auto percentile = [&](double p) {
+    double rank = p * completed;
+    double below = 0.;
+    for (size_t i = 0; i < s_completion_bins; ++i) {
+      if (histogram[i] == 0 || below + histogram[i] < rank) {
+        below += histogram[i];
+        continue;
+      }
+      double low = i == 0 ? 0. : std::ldexp(1., i - 1);
+      double high = std::min(std::ldexp(1., i), static_cast<double>(max)); // the top bin ends at the maximum
+      return low + (high - low) * (rank - below) / histogram[i];
+    }
+    return static_cast<double>(max);
+  };
+
+  opmon::TRCompletionSummary summary;
+  summary.set_completed(completed);
+  summary.set_mean_completion_time(static_cast<double>(sum) / completed);
+  summary.set_p50_completion_time(percentile(0.5));
+  summary.set_p90_completion_time(percentile(0.9));
+  summary.set_p99_completion_time(percentile(0.99));
+  summary.set_max_completion_time(max);
+  publish(std::move(summary));
 }
 
 std::list<std::shared_ptr<AssignedTriggerDecision>>
@@ -131,22 +386,89 @@ TriggerRecordBuilderData::flush()
   for (const auto& td : m_assigned_trigger_decisions) {
     ret.push_back(td);
   }
+  if (m_occupancy)
+    m_occupancy->used_slots -= m_assigned_trigger_decisions.size();
   m_assigned_trigger_decisions.clear();
+  m_outstanding_bytes.store(0);
+  m_reclaimed_trigger_numbers.clear();
 
   auto stat_lock = std::lock_guard<std::mutex>(m_latency_info_mutex);
-  m_latency_info.clear();
-  m_is_busy = false;
+  m_latency_info_next = 0;
+  m_latency_info_count = 0;
+  update_status(false, false, Health::kHealthy);
 
-  m_in_error = false;
   m_metadata = nlohmann::json();
+  m_health_score.store(0.);
 
   return ret;
 }
 
+bool
+TriggerRecordBuilderData::forget_reclaimed_unlocked(daqdataformats::trigger_number_t trigger_number)
+{
+  if (m_reclaimed_trigger_numbers.empty() || m_reclaimed_trigger_numbers.erase(trigger_number) == 0)
+    return false;
+
+  ++m_late_token_counter;
+  TLOG_DEBUG(13) << "Late completion of reclaimed trigger number " << trigger_number << " from " << m_connection_name;
+  return true;
+}
+
+void
+TriggerRecordBuilderData::reclaim_stale_assignments(std::vector<std::shared_ptr<AssignedTriggerDecision>>& reclaimed,
+                                                    std::chrono::steady_clock::duration max_age,
+                                                    std::chrono::steady_clock::time_point now)
+{
+  reclaimed.clear();
+
+  auto lk = std::lock_guard<std::mutex>(m_assigned_trigger_decisions_mutex);
+  // assignments are appended as they are made, so the oldest are at the front
+  auto it = m_assigned_trigger_decisions.begin();
+  while (it != m_assigned_trigger_decisions.end() && now - (*it)->assigned_time > max_age) {
+    m_outstanding_bytes -= (*it)->estimated_bytes;
+    m_reclaimed_trigger_numbers.insert((*it)->decision.trigger_number);
+    reclaimed.push_back(*it);
+    ++it;
+  }
+  m_assigned_trigger_decisions.erase(m_assigned_trigger_decisions.begin(), it);
+
+  if (reclaimed.empty())
+    return;
+
+  if (m_occupancy)
+    m_occupancy->used_slots -= reclaimed.size();
+  m_reclaimed_counter += reclaimed.size();
+
+  if (m_assigned_trigger_decisions.size() < free_limit(m_health.load()))
+    update_status(false, m_in_error.load());
+}
+
 std::shared_ptr<AssignedTriggerDecision>
-TriggerRecordBuilderData::make_assignment(dfmessages::TriggerDecision decision)
+TriggerRecordBuilderData::make_assignment(const dfmessages::TriggerDecision& decision)
 {
-  return std::make_shared<AssignedTriggerDecision>(decision, m_connection_name);
+  std::shared_ptr<AssignedTriggerDecision> assignment;
+  {
+    auto lk = std::lock_guard<std::mutex>(m_assignment_pool_mutex);
+    for (auto it = m_assignment_pool.begin(); it != m_assignment_pool.end(); ++it) {
+      if (it->use_count() == 1) {
+        // only the pool holds it: pairs with the release of the last other owner
+        std::atomic_thread_fence(std::memory_order_acquire);
+        assignment = std::move(*it);
+        *it = std::move(m_assignment_pool.back());
+        m_assignment_pool.pop_back();
+        break;
+      }
+    }
+  }
+
+  if (!assignment)
+    return std::make_shared<AssignedTriggerDecision>(decision, m_app_id);
+
+  assignment->decision = decision; // reuses the storage of the previous components
+  assignment->assigned_time = std::chrono::steady_clock::now();
+  assignment->app_id = m_app_id;
+  assignment->estimated_bytes = 0;
+  return assignment;
 }
 
 void
@@ -158,13 +480,26 @@ TriggerRecordBuilderData::add_assignment(std::shared_ptr<AssignedTriggerDecision
     throw NoSlotsAvailable(ERS_HERE, assignment->decision.trigger_number, m_connection_name);
 
   m_assigned_trigger_decisions.push_back(assignment);
+  m_outstanding_bytes += assignment->estimated_bytes;
+  if (m_occupancy)
+    ++m_occupancy->used_slots;
   TLOG_DEBUG(13) << "Size of assigned_trigger_decision list is " << m_assigned_trigger_decisions.size();
 
-  if (m_assigned_trigger_decisions.size() >= m_busy_threshold.load()) {
-    m_is_busy.store(true);
+  if (m_assigned_trigger_decisions.size() >= busy_limit(m_health.load())) {
+    update_status(true, m_in_error.load());
   }
 }
 
+size_t
+TriggerRecordBuilderData::free_slots() const
+{
+  if (is_busy())
+    return 0;
+  auto limit = busy_limit(m_health.load());
+  auto used = used_slots();
+  return limit > used ? limit - used : 0;
+}
+
 void
 TriggerRecordBuilderData::generate_opmon_data() 
 {
@@ -176,6 +511,12 @@ TriggerRecordBuilderData::generate_opmon_data()
 
   auto lk = std::unique_lock<std::mutex>(m_assigned_trigger_decisions_mutex);
   info.set_outstanding_decisions(m_assigned_trigger_decisions.size());
+  info.set_outstanding_bytes(m_outstanding_bytes.load());
+  info.set_reclaimed_decisions(m_reclaimed_counter.exchange(0));
+  info.set_late_tokens(m_late_token_counter.exchange(0));
+  info.set_health_score(m_health_score.load());
+  info.set_health(static_cast<uint32_t>(m_health.load())); // NOLINT(build/unsigned)
+  info.set_health_changes(m_health_changes.exchange(0));
   auto current_time = std::chrono::steady_clock::now();
   for (const auto& dec_ptr : m_assigned_trigger_decisions) {
     auto us_since_assignment =
@@ -202,7 +543,8 @@ TriggerRecordBuilderData::generate_opmon_data()
   }
   
   publish(std::move(info));
-  
+
+  publish_completion_summary();
 }
 
 std::chrono::microseconds
@@ -211,16 +553,43 @@ TriggerRecordBuilderData::average_latency(std::chrono::steady_clock::time_point
   auto lk = std::lock_guard<std::mutex>(m_latency_info_mutex);
   std::chrono::microseconds sum = std::chrono::microseconds(0);
   size_t count = 0;
-  for (auto it = m_latency_info.rbegin(); it != m_latency_info.rend(); ++it) {
-    if (it->first < since)
+  // from the most recent
+  for (size_t i = 1; i <= m_latency_info_count; ++i) {
+    const auto& info = m_latency_info[(m_latency_info_next + s_latency_info_size - i) % s_latency_info_size];
+    if (info.first < since)
       break;
 
     count++;
-    sum += it->second;
+    sum += info.second;
   }
 
   return sum / count;
 }
 
+std::optional<std::chrono::microseconds>
+TriggerRecordBuilderData::latency_percentile(double fraction,
+                                             std::chrono::steady_clock::time_point since,
+                                             size_t min_samples) const
+{
+  std::vector<std::chrono::microseconds> latencies;
+  {
+    auto lk = std::lock_guard<std::mutex>(m_latency_info_mutex);
+    latencies.reserve(m_latency_info_count);
+    for (size_t i = 1; i <= m_latency_info_count; ++i) {
+      const auto& info = m_latency_info[(m_latency_info_next + s_latency_info_size - i) % s_latency_info_size];
+      if (info.first < since)
+        break;
+      latencies.push_back(info.second);
+    }
+  }
+
+  if (latencies.empty() || latencies.size() < min_samples)
+    return std::nullopt;
+
+  auto nth = latencies.begin() + static_cast<size_t>(std::clamp(fraction, 0., 1.) * (latencies.size() - 1));
+  std::nth_element(latencies.begin(), nth, latencies.end());
+  return *nth;
+}
+
 } // namespace dfmodules
 } // namespace dunedaq
@@ -0,0 +1,124 @@
+/**
+ * @file BoundedQueue.hpp BoundedQueue Class
+ *
+ * The BoundedQueue class passes items between the stages of a module
+ * running on different threads, limiting the memory held by the items
+ * waiting in it.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef DFMODULES_SRC_DFMODULES_BOUNDEDQUEUE_HPP_
+#define DFMODULES_SRC_DFMODULES_BOUNDEDQUEUE_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+namespace dunedaq {
+namespace dfmodules {
+
+/**
+ * @brief BoundedQueue is a FIFO whose capacity is a number of bytes.
+ *
+ * The size of each item is given by the producer. push() blocks until the
+ * item fits within the capacity, so that the capacity is a strict limit, but
+ * an empty queue always accepts an item, so that an item larger than the
+ * capacity does not block forever.
+ */
+template<typename T>
+class BoundedQueue
+{
+public:
+  explicit BoundedQueue(size_t capacity_bytes = std::numeric_limits<size_t>::max())
+    : m_capacity(capacity_bytes)
+  {}
+
+  BoundedQueue(const BoundedQueue&) = delete;            ///< BoundedQueue is not copy-constructible
+  BoundedQueue& operator=(const BoundedQueue&) = delete; ///< BoundedQueue is not copy-assignable
+  BoundedQueue(BoundedQueue&&) = delete;                 ///< BoundedQueue is not move-constructible
+  BoundedQueue& operator=(BoundedQueue&&) = delete;      ///< BoundedQueue is not move-assignable
+
+  void set_capacity(size_t capacity_bytes)
+  {
+    {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      m_capacity = capacity_bytes;
+    }
+    m_not_full.notify_all();
+  }
+
+  /**
+   * @brief Adds an item, waiting for room if needed
+   * @return the time spent waiting for room
+   */
+  std::chrono::microseconds push(T&& item, size_t bytes)
+  {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    std::chrono::microseconds waited(0);
+    if (!has_room(bytes)) {
+      auto start = std::chrono::steady_clock::now();
+      m_not_full.wait(lk, [this, bytes]() { return has_room(bytes); });
+      waited = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    }
+    m_items.emplace_back(std::move(item), bytes);
+    m_bytes += bytes;
+    lk.unlock();
+    m_not_empty.notify_one();
+    return waited;
+  }
+
+  /**
+   * @brief Takes the oldest item, waiting up to timeout for one
+   */
+  std::optional<T> pop(std::chrono::milliseconds timeout)
+  {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    if (!m_not_empty.wait_for(lk, timeout, [this]() { return !m_items.empty(); }))
+      return std::nullopt;
+    std::optional<T> item(std::move(m_items.front().first));
+    m_bytes -= m_items.front().second;
+    m_items.pop_front();
+    lk.unlock();
+    m_not_full.notify_all();
+    return item;
+  }
+
+  size_t size() const
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return m_items.size();
+  }
+  size_t bytes() const
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return m_bytes;
+  }
+  bool empty() const { return size() == 0; }
+
+private:
+  // to be called with m_mutex held
+  bool has_room(size_t bytes) const
+  {
+    return m_items.empty() || (m_bytes <= m_capacity && bytes <= m_capacity - m_bytes);
+  }
+
+  std::deque<std::pair<T, size_t>> m_items;
+  size_t m_bytes{ 0 };
+  size_t m_capacity;
+  mutable std::mutex m_mutex;
+  std::condition_variable m_not_empty;
+  std::condition_variable m_not_full;
+};
+
+} // namespace dfmodules
+} // namespace dunedaq
+
+#endif // DFMODULES_SRC_DFMODULES_BOUNDEDQUEUE_HPP_
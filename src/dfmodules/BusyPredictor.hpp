@@ -0,0 +1,90 @@
+/**
+ * @file BusyPredictor.hpp BusyPredictor Class
+ *
+ * The BusyPredictor class decides the busy state advertised by the DFO
+ * by combining the rate of incoming TriggerDecisions with the rate of
+ * completions reported by the dataflow applications.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef DFMODULES_SRC_DFMODULES_BUSYPREDICTOR_HPP_
+#define DFMODULES_SRC_DFMODULES_BUSYPREDICTOR_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace dunedaq {
+namespace dfmodules {
+
+/**
+ * @brief BusyPredictor estimates when the free capacity of the dataflow
+ * applications will be exhausted.
+ *
+ * Decision and completion rates are measured over short windows and smoothed
+ * with an exponentially weighted moving average. The predictor asserts busy
+ * when the free slots are expected to run out within the configured horizon,
+ * and releases it only when the expected exhaustion is beyond twice the
+ * horizon. Predictive transitions are separated by at least the minimum dwell
+ * time, while a hard busy (no application can take a decision) is asserted
+ * immediately.
+ */
+class BusyPredictor
+{
+public:
+  using clock_t = std::chrono::steady_clock;
+
+  BusyPredictor(std::chrono::milliseconds horizon,
+                std::chrono::milliseconds min_dwell,
+                double smoothing = 0.3);
+
+  BusyPredictor(const BusyPredictor&) = delete;            ///< BusyPredictor is not copy-constructible
+  BusyPredictor& operator=(const BusyPredictor&) = delete; ///< BusyPredictor is not copy-assignable
+  BusyPredictor(BusyPredictor&&) = delete;                 ///< BusyPredictor is not move-constructible
+  BusyPredictor& operator=(BusyPredictor&&) = delete;      ///< BusyPredictor is not move-assignable
+
+  void decision_received() noexcept { m_decisions.fetch_add(1, std::memory_order_relaxed); }
+  void decisions_completed(size_t n) noexcept { m_completions.fetch_add(n, std::memory_order_relaxed); }
+
+  /**
+   * @brief Returns the busy state to be advertised
+   * @param hard_busy true when no application is able to take a decision
+   * @param free_slots number of slots still available across the applications
+   */
+  bool evaluate(bool hard_busy, size_t free_slots, clock_t::time_point now = clock_t::now());
+
+  void reset(clock_t::time_point now = clock_t::now());
+
+  double decision_rate() const noexcept { return m_decision_rate.load(); }     ///< Hz
+  double completion_rate() const noexcept { return m_completion_rate.load(); } ///< Hz
+  uint64_t get_predicted_busy_count() const noexcept { return m_predicted_busy.load(); } // NOLINT(build/unsigned)
+
+private:
+  void update_rates(clock_t::time_point now);
+
+  const std::chrono::duration<double> m_horizon;
+  const clock_t::duration m_min_dwell;
+  const clock_t::duration m_window;
+  const double m_smoothing;
+
+  std::atomic<size_t> m_decisions{ 0 };
+  std::atomic<size_t> m_completions{ 0 };
+  std::atomic<double> m_decision_rate{ 0. };
+  std::atomic<double> m_completion_rate{ 0. };
+  std::atomic<uint64_t> m_predicted_busy{ 0 }; // NOLINT(build/unsigned) busy states asserted by the prediction only
+
+  std::mutex m_mutex;
+  clock_t::time_point m_window_start;
+  clock_t::time_point m_last_transition;
+  bool m_busy{ false };
+};
+
+} // namespace dfmodules
+} // namespace dunedaq
+
+#endif // DFMODULES_SRC_DFMODULES_BUSYPREDICTOR_HPP_
@@ -0,0 +1,170 @@
+/**
+ * @file DFOTrace.hpp DFOTraceWriter and DFOTraceReader Classes
+ *
+ * A DFO trace is a compact binary record of the TriggerDecisions received
+ * by the DFO, of their assignment to dataflow applications and of their
+ * completion, used to replay real traffic offline.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef DFMODULES_SRC_DFMODULES_DFOTRACE_HPP_
+#define DFMODULES_SRC_DFMODULES_DFOTRACE_HPP_
+
+#include "ers/Issue.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace dunedaq {
+// Disable coverage checking LCOV_EXCL_START
+ERS_DECLARE_ISSUE(dfmodules,
+                  DFOTraceFileProblem,
+                  "Problem with DFO trace file " << file_name << ": " << message,
+                  ((std::string)file_name)((std::string)message))
+// Re-enable coverage checking LCOV_EXCL_STOP
+
+namespace dfmodules {
+
+/**
+ * @brief One entry of a DFO trace. The layout is fixed, records are written
+ * to file as they are in memory.
+ *
+ * kApp records are followed in the file by the application name, whose
+ * length is stored in trigger_number.
+ */
+struct DFOTraceRecord
+{
+  enum Type : uint8_t // NOLINT(build/unsigned)
+  {
+    kApp = 0,        ///< app = index of a new dataflow application
+    kDecision = 1,   ///< a TriggerDecision was received
+    kAssignment = 2, ///< the decision was assigned to app, bytes is its estimated size
+    kCompletion = 3, ///< the token for the decision was received from app
+    kBusy = 4        ///< app = 1 if the DFO went busy, 0 if it became free
+  };
+
+  int64_t time_ns{ 0 };        ///< since the start of the trace
+  uint64_t trigger_number{ 0 }; // NOLINT(build/unsigned)
+  uint64_t bytes{ 0 };          // NOLINT(build/unsigned)
+  uint32_t app{ 0 };            // NOLINT(build/unsigned)
+  uint8_t type{ kDecision };    // NOLINT(build/unsigned)
+  uint8_t padding[3]{ 0, 0, 0 }; // NOLINT(build/unsigned)
+};
+static_assert(sizeof(DFOTraceRecord) == 32, "DFOTraceRecord layout is part of the file format");
+
+/**
+ * @brief Buffers trace records in memory and appends them to a file.
+ * All methods can be called concurrently.
+ *
+ * Full buffers are handed to a writer thread, so that recording never waits
+ * for the file. Recording never throws either: the first failure to write
+ * the file, or the writer falling behind by more than s_max_pending_buffers,
+ * is reported once and disables the trace.
+ */
+class DFOTraceWriter
+{
+public:
+  static constexpr char s_magic[8] = { 'D', 'F', 'O', 'T', 'R', 'C', '0', '1' };
+  static constexpr size_t s_max_pending_buffers = 16;
+
+  explicit DFOTraceWriter(const std::string& file_name, size_t buffer_records = 65536);
+  ~DFOTraceWriter();
+
+  DFOTraceWriter(const DFOTraceWriter&) = delete;            ///< DFOTraceWriter is not copy-constructible
+  DFOTraceWriter& operator=(const DFOTraceWriter&) = delete; ///< DFOTraceWriter is not copy-assignable
+  DFOTraceWriter(DFOTraceWriter&&) = delete;                 ///< DFOTraceWriter is not move-constructible
+  DFOTraceWriter& operator=(DFOTraceWriter&&) = delete;      ///< DFOTraceWriter is not move-assignable
+
+  /**
+   * @brief Registers a dataflow application, returning its index in the trace
+   */
+  uint32_t add_app(const std::string& name); // NOLINT(build/unsigned)
+
+  void record(DFOTraceRecord::Type type,
+              uint64_t trigger_number,   // NOLINT(build/unsigned)
+              uint32_t app = 0,          // NOLINT(build/unsigned)
+              uint64_t bytes = 0);       // NOLINT(build/unsigned)
+
+  /**
+   * @brief Waits until everything recorded so far is written to the file
+   */
+  void flush();
+
+  /**
+   * @brief Whether a problem disabled the trace
+   */
+  bool failed() const { return m_failed.load(); }
+
+  const std::string& get_file_name() const { return m_file_name; }
+
+private:
+  // records, and the names of the applications of their kApp records in order
+  struct Buffer
+  {
+    std::vector<DFOTraceRecord> records;
+    std::vector<std::string> app_names;
+  };
+
+  // to be called with m_buffer_mutex held
+  void hand_over_buffer();
+  void fail(const std::string& message);
+  bool write(const Buffer& buffer);
+  void do_write();
+
+  const std::string m_file_name;
+  const size_t m_buffer_records;
+  const std::chrono::steady_clock::time_point m_start;
+
+  Buffer m_buffer;
+  uint32_t m_n_apps{ 0 }; // NOLINT(build/unsigned)
+  std::deque<Buffer> m_full_buffers;
+  bool m_writing{ false };
+  bool m_stopping{ false };
+  std::mutex m_buffer_mutex;
+  std::condition_variable m_buffer_full;
+  std::condition_variable m_buffers_written;
+  std::atomic<bool> m_failed{ false };
+
+  // only used by the writer thread once it is started
+  std::ofstream m_file;
+  std::thread m_writer;
+};
+
+/**
+ * @brief Reads back a trace written by DFOTraceWriter
+ */
+class DFOTraceReader
+{
+public:
+  explicit DFOTraceReader(const std::string& file_name);
+
+  /**
+   * @brief Reads the next record.
+   * @return false at the end of the trace. For kApp records the name is
+   * available as get_app_names()[record.app].
+   */
+  bool next(DFOTraceRecord& record);
+
+  const std::vector<std::string>& get_app_names() const { return m_app_names; }
+
+private:
+  std::string m_file_name;
+  std::ifstream m_file;
+  std::vector<std::string> m_app_names;
+};
+
+} // namespace dfmodules
+} // namespace dunedaq
+
+#endif // DFMODULES_SRC_DFMODULES_DFOTRACE_HPP_
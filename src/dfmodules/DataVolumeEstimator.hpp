@@ -0,0 +1,85 @@
+/**
+ * @file DataVolumeEstimator.hpp DataVolumeEstimator Class
+ *
+ * The DataVolumeEstimator class predicts the size of the TriggerRecord
+ * produced by a TriggerDecision from the readout windows of its components.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef DFMODULES_SRC_DFMODULES_DATAVOLUMEESTIMATOR_HPP_
+#define DFMODULES_SRC_DFMODULES_DATAVOLUMEESTIMATOR_HPP_
+
+#include "daqdataformats/SourceID.hpp"
+#include "daqdataformats/Types.hpp"
+#include "dfmessages/TriggerDecision.hpp"
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+namespace dunedaq {
+namespace dfmodules {
+
+/**
+ * @brief DataVolumeEstimator learns, for each SourceID, the fragment size as a
+ * linear function of the readout window length.
+ *
+ * The model of each SourceID is bytes = offset + slope * ticks, with the
+ * weights adapted by a normalised least mean squares (NLMS) filter from the
+ * fragment sizes reported back by the writers. The window length is
+ * expressed in units of the first window seen for that SourceID so that both
+ * weights adapt at a comparable speed.
+ */
+class DataVolumeEstimator
+{
+public:
+  explicit DataVolumeEstimator(double step_size = 0.2);
+
+  DataVolumeEstimator(const DataVolumeEstimator&) = delete;            ///< DataVolumeEstimator is not copy-constructible
+  DataVolumeEstimator& operator=(const DataVolumeEstimator&) = delete; ///< DataVolumeEstimator is not copy-assignable
+  DataVolumeEstimator(DataVolumeEstimator&&) = delete;                 ///< DataVolumeEstimator is not move-constructible
+  DataVolumeEstimator& operator=(DataVolumeEstimator&&) = delete;      ///< DataVolumeEstimator is not move-assignable
+
+  /**
+   * @brief Predicted size in bytes of the data requested by the decision.
+   * Components from SourceIDs that have not been learnt yet do not contribute.
+   */
+  uint64_t estimate(const dfmessages::TriggerDecision& decision) const; // NOLINT(build/unsigned)
+
+  uint64_t estimate(const daqdataformats::SourceID& source_id, // NOLINT(build/unsigned)
+                    daqdataformats::timestamp_diff_t ticks) const;
+
+  void update(const daqdataformats::SourceID& source_id,
+              daqdataformats::timestamp_diff_t ticks,
+              uint64_t bytes); // NOLINT(build/unsigned)
+
+  size_t size() const;
+  void clear();
+
+  static daqdataformats::timestamp_diff_t window_ticks(const dfmessages::ComponentRequest& component)
+  {
+    return component.window_end > component.window_begin ? component.window_end - component.window_begin : 0;
+  }
+
+private:
+  struct Model
+  {
+    double tick_scale{ 1. };
+    double offset{ 0. };
+    double slope{ 0. }; // bytes per tick_scale ticks
+  };
+
+  static double predict(const Model& model, daqdataformats::timestamp_diff_t ticks);
+
+  const double m_step_size;
+  std::map<daqdataformats::SourceID, Model> m_models;
+  mutable std::mutex m_mutex;
+};
+
+} // namespace dfmodules
+} // namespace dunedaq
+
+#endif // DFMODULES_SRC_DFMODULES_DATAVOLUMEESTIMATOR_HPP_
@@ -0,0 +1,128 @@
+/**
+ * @file FragmentCompressor.hpp FragmentCompressor Class
+ *
+ * The FragmentCompressor class compresses the fragments of a TriggerRecord
+ * on a pool of worker threads, before the record is written.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef DFMODULES_SRC_DFMODULES_FRAGMENTCOMPRESSOR_HPP_
+#define DFMODULES_SRC_DFMODULES_FRAGMENTCOMPRESSOR_HPP_
+
+#include "dfmodules/BoundedQueue.hpp"
+
+#include "daqdataformats/Fragment.hpp"
+#include "daqdataformats/TriggerRecord.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace dunedaq {
+namespace dfmodules {
+
+/**
+ * @brief FragmentCompressor compresses fragments with zlib, with a
+ * compression level for each fragment type.
+ *
+ * A fragment is compressed as a whole, header included, into the zlib stream
+ * that the HDF5 deflate filter stores for a dataset made of a single chunk,
+ * so that the DataStore can write it as such a chunk and the files are read
+ * back by any HDF5 reader without knowing about the compression. The
+ * fragments of the types without a level, and those that deflate does not
+ * make smaller, are left as they are.
+ *
+ * A compressed fragment is replaced in the record by a placeholder made of
+ * its header without payload, so that hdf5libs writes the record as a whole,
+ * with the metadata of all its fragments, before the DataStore replaces the
+ * placeholders by the compressed chunks.
+ */
+class FragmentCompressor
+{
+public:
+  using levels_t = std::map<daqdataformats::FragmentType, int>;
+
+  /// larger fragments are left as they are, not fitting in an HDF5 chunk
+  static constexpr size_t s_max_fragment_bytes = 0xffffffff;
+
+  struct CompressedFragment
+  {
+    daqdataformats::FragmentHeader header; ///< of the original fragment
+    int level;
+    std::vector<char> data; ///< zlib stream of the whole fragment
+  };
+
+  struct CompressedRecord
+  {
+    /// the record header, the fragments to store as they are and, in place of
+    /// the compressed fragments, their placeholders
+    std::unique_ptr<daqdataformats::TriggerRecord> record;
+    std::vector<CompressedFragment> fragments;
+  };
+
+  /**
+   * @param levels zlib level (1 to 9) of each fragment type to compress
+   * @param n_threads size of the worker pool
+   */
+  FragmentCompressor(const levels_t& levels, size_t n_threads);
+  ~FragmentCompressor();
+
+  FragmentCompressor(const FragmentCompressor&) = delete;            ///< FragmentCompressor is not copy-constructible
+  FragmentCompressor& operator=(const FragmentCompressor&) = delete; ///< FragmentCompressor is not copy-assignable
+  FragmentCompressor(FragmentCompressor&&) = delete;                 ///< FragmentCompressor is not move-constructible
+  FragmentCompressor& operator=(FragmentCompressor&&) = delete;      ///< FragmentCompressor is not move-assignable
+
+  /**
+   * @brief Splits the record into the fragments compressed by the worker
+   * pool and the rest. The returned record refers to the fragments of tr
+   * that are not compressed, which must outlive it.
+   */
+  CompressedRecord compress(const daqdataformats::TriggerRecord& tr);
+
+  const levels_t& get_levels() const { return m_levels; }
+
+  /**
+   * @brief Comma-separated names of the compressed fragment types, for the file attributes
+   */
+  std::string get_compressed_types() const;
+
+  // zlib stream of the data, with the zlib header and checksum, as written
+  // by the HDF5 deflate filter
+  static std::vector<char> deflate(const void* data, size_t size, int level);
+  static std::vector<char> inflate(const void* data, size_t size);
+
+  // Bytes of the fragments of the compressed types before and after
+  // compression, and CPU time of the compression, since the last call of
+  // the corresponding method
+  uint64_t take_bytes_in() { return m_bytes_in.exchange(0); }   // NOLINT(build/unsigned)
+  uint64_t take_bytes_out() { return m_bytes_out.exchange(0); } // NOLINT(build/unsigned)
+  uint64_t take_cpu_us() { return m_cpu_us.exchange(0); }       // NOLINT(build/unsigned)
+
+private:
+  std::optional<CompressedFragment> compress_fragment(const daqdataformats::Fragment& fragment, int level);
+  void do_work();
+
+  const levels_t m_levels;
+
+  BoundedQueue<std::function<void()>> m_tasks;
+  std::vector<std::thread> m_workers;
+  std::atomic<bool> m_running{ true };
+
+  std::atomic<uint64_t> m_bytes_in{ 0 };  // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_bytes_out{ 0 }; // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_cpu_us{ 0 };    // NOLINT(build/unsigned)
+};
+
+} // namespace dfmodules
+} // namespace dunedaq
+
+#endif // DFMODULES_SRC_DFMODULES_FRAGMENTCOMPRESSOR_HPP_
@@ -0,0 +1,98 @@
+/**
+ * @file FreeSpaceTracker.hpp FreeSpaceTracker Class
+ *
+ * The FreeSpaceTracker class keeps an estimate of the free space on the disk
+ * written by a DataStore without querying the file system for each write.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef DFMODULES_SRC_DFMODULES_FREESPACETRACKER_HPP_
+#define DFMODULES_SRC_DFMODULES_FREESPACETRACKER_HPP_
+
+#include "utilities/WorkerThread.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+namespace dunedaq {
+namespace dfmodules {
+
+/**
+ * @brief FreeSpaceTracker samples the free space periodically on its own
+ * thread and decrements the last sample by the bytes written since it was taken.
+ *
+ * A write asks for the free space it needs with free_space(). The estimate is
+ * returned when it exceeds that need by more than the margin; otherwise, or
+ * when sampling is disabled or has not happened yet, the free space is
+ * sampled synchronously so that a full disk is still detected exactly.
+ */
+class FreeSpaceTracker
+{
+public:
+  using sampler_t = std::function<size_t()>; ///< returns the free space in bytes, 0 if it is not available
+
+  /**
+   * @param sampler queries the file system
+   * @param sampling_period period of the background samples, 0 to sample for each write
+   * @param margin_bytes estimates closer than this to the need are checked synchronously
+   */
+  FreeSpaceTracker(sampler_t sampler, std::chrono::milliseconds sampling_period, size_t margin_bytes);
+  ~FreeSpaceTracker();
+
+  FreeSpaceTracker(const FreeSpaceTracker&) = delete;            ///< FreeSpaceTracker is not copy-constructible
+  FreeSpaceTracker& operator=(const FreeSpaceTracker&) = delete; ///< FreeSpaceTracker is not copy-assignable
+  FreeSpaceTracker(FreeSpaceTracker&&) = delete;                 ///< FreeSpaceTracker is not move-constructible
+  FreeSpaceTracker& operator=(FreeSpaceTracker&&) = delete;      ///< FreeSpaceTracker is not move-assignable
+
+  /**
+   * @brief Takes a first sample and starts the background sampling, if enabled
+   */
+  void start();
+  void stop();
+
+  /**
+   * @brief Free space to compare with needed_bytes, estimated or sampled
+   */
+  size_t free_space(size_t needed_bytes);
+
+  void record_written(size_t bytes) { m_written += bytes; }
+
+  size_t estimate() const;
+
+  // Cost of the sampling, since the last call of the corresponding method
+  uint64_t take_samples() { return m_samples.exchange(0); }                 // NOLINT(build/unsigned)
+  uint64_t take_synchronous_samples() { return m_sync_samples.exchange(0); } // NOLINT(build/unsigned)
+  uint64_t take_sampling_us() { return m_sampling_us.exchange(0); }         // NOLINT(build/unsigned)
+
+private:
+  size_t sample();
+  void do_work(std::atomic<bool>&);
+
+  sampler_t m_sampler;
+  const std::chrono::milliseconds m_sampling_period;
+  const size_t m_margin;
+
+  // bytes written since the creation, and the value it had when the last sample was taken
+  std::atomic<uint64_t> m_written{ 0 }; // NOLINT(build/unsigned)
+  uint64_t m_written_at_sample{ 0 };    // NOLINT(build/unsigned)
+  size_t m_sampled_free{ 0 };
+  bool m_has_sample{ false };
+  mutable std::mutex m_mutex; // protects the sample and the three members above
+
+  std::atomic<uint64_t> m_samples{ 0 };      // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_sync_samples{ 0 }; // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_sampling_us{ 0 };  // NOLINT(build/unsigned)
+
+  dunedaq::utilities::WorkerThread m_thread;
+};
+
+} // namespace dfmodules
+} // namespace dunedaq
+
+#endif // DFMODULES_SRC_DFMODULES_FREESPACETRACKER_HPP_
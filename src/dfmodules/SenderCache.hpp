@@ -0,0 +1,113 @@
+/**
+ * @file SenderCache.hpp SenderCache Class
+ *
+ * The SenderCache class keeps the iomanager senders of a given data type
+ * by connection name, so that modules sending to a destination taken from
+ * a message do not look it up in the IOManager for every message.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef DFMODULES_SRC_DFMODULES_SENDERCACHE_HPP_
+#define DFMODULES_SRC_DFMODULES_SENDERCACHE_HPP_
+
+#include "iomanager/IOManager.hpp"
+#include "iomanager/Sender.hpp"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dunedaq {
+namespace dfmodules {
+
+/**
+ * @brief SenderCache resolves each destination once, on first use.
+ *
+ * Lookups of destinations already resolved do not take any lock: the map is
+ * replaced by an extended copy when a destination is added, and the previous
+ * copies are kept until clear(), so that concurrent readers never see a map
+ * being modified or freed. The number of copies grows with the number of
+ * destinations, which is small for the dataflow connections.
+ */
+template<typename Datatype>
+class SenderCache
+{
+public:
+  using sender_ptr_t = std::shared_ptr<iomanager::SenderConcept<Datatype>>;
+
+  SenderCache() = default;
+
+  SenderCache(const SenderCache&) = delete;            ///< SenderCache is not copy-constructible
+  SenderCache& operator=(const SenderCache&) = delete; ///< SenderCache is not copy-assignable
+  SenderCache(SenderCache&&) = delete;                 ///< SenderCache is not move-constructible
+  SenderCache& operator=(SenderCache&&) = delete;      ///< SenderCache is not move-assignable
+
+  /**
+   * @brief Returns the sender for the given connection, resolving it if needed.
+   * The reference stays valid until clear().
+   * @throws the IOManager issues if the connection cannot be resolved
+   */
+  const sender_ptr_t& get(const std::string& connection_name)
+  {
+    const map_t* current = m_current.load(std::memory_order_acquire);
+    if (current) {
+      auto it = current->find(connection_name);
+      if (it != current->end())
+        return it->second;
+    }
+    return resolve(connection_name);
+  }
+
+  size_t size() const
+  {
+    const map_t* current = m_current.load(std::memory_order_acquire);
+    return current ? current->size() : 0;
+  }
+
+  /**
+   * @brief Drops all the senders. Not to be called while get() can run, e.g. at scrap.
+   */
+  void clear()
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_current.store(nullptr, std::memory_order_release);
+    m_maps.clear();
+  }
+
+private:
+  using map_t = std::unordered_map<std::string, sender_ptr_t>;
+
+  const sender_ptr_t& resolve(const std::string& connection_name)
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    const map_t* current = m_current.load(std::memory_order_relaxed);
+    if (current) {
+      // another thread may have resolved it in the meantime
+      auto it = current->find(connection_name);
+      if (it != current->end())
+        return it->second;
+    }
+
+    auto sender = get_iom_sender<Datatype>(connection_name);
+    auto next = current ? std::make_unique<map_t>(*current) : std::make_unique<map_t>();
+    auto& entry = (*next)[connection_name] = sender;
+    m_current.store(next.get(), std::memory_order_release);
+    m_maps.push_back(std::move(next));
+    return entry;
+  }
+
+  std::atomic<const map_t*> m_current{ nullptr };
+  std::vector<std::unique_ptr<const map_t>> m_maps; // the last one is m_current, older ones may still be read
+  std::mutex m_mutex;
+};
+
+} // namespace dfmodules
+} // namespace dunedaq
+
+#endif // DFMODULES_SRC_DFMODULES_SENDERCACHE_HPP_
@@ -20,6 +20,7 @@
 #include "nlohmann/json.hpp"
 #include "opmonlib/MonitorableObject.hpp"
 
+#include <array>
 #include <atomic>
 #include <chrono>
 #include <functional>
@@ -27,8 +28,11 @@
 #include <list>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
+#include <unordered_set>
 #include <utility>
+#include <vector>
 
 namespace dunedaq {
 // Disable coverage checking LCOV_EXCL_START
@@ -50,70 +54,201 @@ ERS_DECLARE_ISSUE(dfmodules,
 // Re-enable coverage checking LCOV_EXCL_STOP
 
 namespace dfmodules {
+
+/**
+ * @brief Aggregate occupancy of a set of dataflow applications.
+ * The counters are kept up to date by the TriggerRecordBuilderData objects
+ * attached to it, so that they can be read without looping over the applications.
+ */
+struct DataflowOccupancy
+{
+  std::atomic<size_t> used_slots{ 0 };
+  std::atomic<size_t> available_apps{ 0 }; // neither busy nor in error
+  std::atomic<size_t> apps_in_error{ 0 };
+};
+
+/**
+ * @brief Index of a dataflow application in the DFO, assigned at registration
+ */
+using dataflow_app_id_t = uint32_t; // NOLINT(build/unsigned)
+
 struct AssignedTriggerDecision
 {
   dfmessages::TriggerDecision decision;
   std::chrono::steady_clock::time_point assigned_time;
-  std::string connection_name;
+  dataflow_app_id_t app_id;
+  uint64_t estimated_bytes{ 0 }; // NOLINT(build/unsigned) predicted TriggerRecord size, 0 if unknown
 
-  AssignedTriggerDecision(dfmessages::TriggerDecision dec, std::string conn_name)
-    : decision(dec)
+  AssignedTriggerDecision(dfmessages::TriggerDecision dec, dataflow_app_id_t app)
+    : decision(std::move(dec))
     , assigned_time(std::chrono::steady_clock::now())
-    , connection_name(conn_name)
+    , app_id(app)
   {}
 };
 
 class TriggerRecordBuilderData : public opmonlib::MonitorableObject
 {
 public:
+  /**
+   * @brief Health of the application judged from its completion latency.
+   * Degraded applications go busy at half of their busy threshold,
+   * quarantined ones are busy until they are reinstated.
+   */
+  enum class Health : uint32_t // NOLINT(build/unsigned)
+  {
+    kHealthy = 0,
+    kDegraded = 1,
+    kQuarantined = 2
+  };
+
   TriggerRecordBuilderData() = default;
   TriggerRecordBuilderData(std::string connection_name, size_t busy_threshold);
-  TriggerRecordBuilderData(std::string connection_name, size_t busy_threshold, size_t free_threshold);
+  TriggerRecordBuilderData(std::string connection_name,
+                           size_t busy_threshold,
+                           size_t free_threshold,
+                           dataflow_app_id_t app_id = 0);
 
   TriggerRecordBuilderData(TriggerRecordBuilderData const&) = delete;
   TriggerRecordBuilderData(TriggerRecordBuilderData&&) = delete;
   TriggerRecordBuilderData& operator=(TriggerRecordBuilderData const&) = delete;
   TriggerRecordBuilderData& operator=(TriggerRecordBuilderData&&) = delete;
 
-  ~TriggerRecordBuilderData() = default;
+  ~TriggerRecordBuilderData();
   
-  bool is_busy() const { return m_in_error || m_is_busy; }
+  bool is_busy() const { return m_in_error || m_is_busy || is_quarantined(); }
+  bool is_quarantined() const { return m_health.load() == Health::kQuarantined; }
   size_t used_slots() const { return m_assigned_trigger_decisions.size(); }
+  size_t free_slots() const; // assignments that can be added before the application is busy
+  uint64_t outstanding_bytes() const { return m_outstanding_bytes.load(); } // NOLINT(build/unsigned)
+
+  const std::string& connection_name() const { return m_connection_name; }
+  dataflow_app_id_t app_id() const { return m_app_id; }
 
   size_t busy_threshold() const { return m_busy_threshold.load(); }
   size_t free_threshold() const { return m_free_threshold.load(); }
 
   std::shared_ptr<AssignedTriggerDecision> get_assignment(daqdataformats::trigger_number_t trigger_number) const;
   std::shared_ptr<AssignedTriggerDecision> extract_assignment(daqdataformats::trigger_number_t trigger_number);
-  std::shared_ptr<AssignedTriggerDecision> make_assignment(dfmessages::TriggerDecision decision);
+  /**
+   * @brief Creates an assignment of a copy of the decision to this application.
+   * The objects of completed assignments are reused once nobody holds them any longer,
+   * so that in steady state no memory is allocated.
+   */
+  std::shared_ptr<AssignedTriggerDecision> make_assignment(const dfmessages::TriggerDecision& decision);
   void add_assignment(std::shared_ptr<AssignedTriggerDecision> assignment);
+  /**
+   * @brief Completes the assignment of the given trigger number.
+   * @return the completed assignment, or nullptr if the assignment had been reclaimed as stale
+   * @throws AssignedTriggerDecisionNotFound if the trigger number is not known at all
+   */
   std::shared_ptr<AssignedTriggerDecision> complete_assignment(
     daqdataformats::trigger_number_t trigger_number,
     std::function<void(nlohmann::json&)> metadata_fun = nullptr);
+
+  /**
+   * @brief Completes several assignments at once, taking the assignment lock only once.
+   * Trigger numbers that are not assigned to this application are reported as errors and skipped.
+   * @param completed replaced by the completed assignments; the caller can reuse it
+   * between calls, so that completing does not allocate
+   */
+  void complete_assignments(const std::vector<daqdataformats::trigger_number_t>& trigger_numbers,
+                            std::vector<std::shared_ptr<AssignedTriggerDecision>>& completed,
+                            std::function<void(nlohmann::json&)> metadata_fun = nullptr);
   std::list<std::shared_ptr<AssignedTriggerDecision>> flush();
 
+  /**
+   * @brief Removes the assignments older than max_age, freeing their slots.
+   * The trigger numbers are remembered, so that late tokens for them are
+   * recognised and not reported as unknown.
+   * @param reclaimed replaced by the reclaimed assignments, oldest first
+   */
+  void reclaim_stale_assignments(std::vector<std::shared_ptr<AssignedTriggerDecision>>& reclaimed,
+                                 std::chrono::steady_clock::duration max_age,
+                                 std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
   void generate_opmon_data() override;
 
   std::chrono::microseconds average_latency(std::chrono::steady_clock::time_point since) const;
+  /**
+   * @brief Percentile of the completion latencies since the given time.
+   * @return nothing if fewer than min_samples assignments were completed since then
+   */
+  std::optional<std::chrono::microseconds> latency_percentile(double fraction,
+                                                              std::chrono::steady_clock::time_point since,
+                                                              size_t min_samples = 1) const;
+
+  Health health() const { return m_health.load(); }
+  /**
+   * @brief Assignments the application can hold before it is busy: its busy
+   * threshold, halved when it is degraded, and none in error or quarantined
+   */
+  size_t capacity() const;
+  double health_score() const { return m_health_score.load(); }
+  /**
+   * @brief Sets the health, with the score it was derived from (latency relative to the other applications)
+   */
+  void set_health(Health health, double score);
 
   bool is_in_error() const { return m_in_error.load(); }
-  void set_in_error(bool err) { m_in_error = err; }
+  void set_in_error(bool err);
+
+  /**
+   * @brief Fraction of the completed assignments that are published individually
+   * as TRCompleteInfo, 1 for all of them and 0 for none. All the completions are
+   * in any case summarised in the regular TRCompletionSummary.
+   */
+  void set_completion_sampling(double fraction);
+
+  /**
+   * @brief Attaches the aggregate occupancy that this object keeps up to date.
+   * The current state of this object is added to it immediately.
+   */
+  void set_occupancy(std::shared_ptr<DataflowOccupancy> occupancy);
 
 private:
+  // to be called with m_assigned_trigger_decisions_mutex held
+  void update_status(bool is_busy, bool in_error);
+  void update_status(bool is_busy, bool in_error, Health health);
+  size_t busy_limit(Health health) const; // busy threshold adjusted for the health
+  size_t free_limit(Health health) const;
+
+  // to be called with m_assigned_trigger_decisions_mutex held
+  std::shared_ptr<AssignedTriggerDecision> extract_assignment_unlocked(daqdataformats::trigger_number_t trigger_number);
+  bool forget_reclaimed_unlocked(daqdataformats::trigger_number_t trigger_number);
+  void update_completion_statistics(const AssignedTriggerDecision& assignment,
+                                    std::chrono::steady_clock::time_point now);
+  // to be called with m_latency_info_mutex held
+  void add_latency_unlocked(std::chrono::steady_clock::time_point now, std::chrono::microseconds latency);
+
   std::atomic<size_t> m_busy_threshold{ 0 };
   std::atomic<size_t> m_free_threshold{ std::numeric_limits<size_t>::max() };
   std::atomic<bool> m_is_busy{ false };
-  std::list<std::shared_ptr<AssignedTriggerDecision>> m_assigned_trigger_decisions;
+  std::vector<std::shared_ptr<AssignedTriggerDecision>> m_assigned_trigger_decisions; // in order of assignment
   mutable std::mutex m_assigned_trigger_decisions_mutex;
+  std::atomic<uint64_t> m_outstanding_bytes{ 0 }; // NOLINT(build/unsigned) sum of estimated_bytes of the assignments
+  std::unordered_set<daqdataformats::trigger_number_t> m_reclaimed_trigger_numbers; // waiting for a late token
 
-  // TODO: Eric Flumerfelt <eflumerf@github.com> Dec-03-2021: Replace with circular buffer
-  std::list<std::pair<std::chrono::steady_clock::time_point, std::chrono::microseconds>> m_latency_info;
+  // completed assignments, reused by make_assignment
+  static constexpr size_t s_assignment_pool_size = 64;
+  std::vector<std::shared_ptr<AssignedTriggerDecision>> m_assignment_pool;
+  std::mutex m_assignment_pool_mutex;
+
+  // circular buffer of the latencies of the last completed assignments
+  static constexpr size_t s_latency_info_size = 1000;
+  std::array<std::pair<std::chrono::steady_clock::time_point, std::chrono::microseconds>, s_latency_info_size>
+    m_latency_info;
+  size_t m_latency_info_next{ 0 };
+  size_t m_latency_info_count{ 0 };
   mutable std::mutex m_latency_info_mutex;
 
   std::atomic<bool> m_in_error{ true };
+  std::atomic<Health> m_health{ Health::kHealthy };
+  std::atomic<double> m_health_score{ 0. };
+  std::shared_ptr<DataflowOccupancy> m_occupancy;
 
   nlohmann::json m_metadata;
   std::string m_connection_name{ "" };
+  dataflow_app_id_t m_app_id{ 0 };
 
   // monitoring
   using metric_t = dunedaq::dfmodules::opmon::DFApplicationInfo;
@@ -121,7 +256,19 @@ private:
 						  metric_t>::type;
   using time_counter_t = std::remove_const<const_time_counter_t>::type;
   std::atomic<uint32_t> m_complete_counter{ 0 };
+  std::atomic<uint32_t> m_reclaimed_counter{ 0 };
+  std::atomic<uint32_t> m_late_token_counter{ 0 };
+  std::atomic<uint32_t> m_health_changes{ 0 };
   std::atomic<time_counter_t> m_min_complete_time{ std::numeric_limits<time_counter_t>::max() }, m_max_complete_time{ 0 };  // in us
+
+  // completion times since the last summary, bin i counts times below 2^i us and not below 2^(i-1)
+  static constexpr size_t s_completion_bins = 40;
+  std::array<std::atomic<uint64_t>, s_completion_bins> m_completion_histogram{}; // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_completion_time_sum{ 0 };                              // NOLINT(build/unsigned) in us
+  std::atomic<uint64_t> m_completion_time_max{ 0 };                              // NOLINT(build/unsigned) in us
+  std::atomic<uint64_t> m_completion_event_period{ 1 }; // NOLINT(build/unsigned) 0 for no TRCompleteInfo
+  std::atomic<uint64_t> m_completion_events{ 0 };       // NOLINT(build/unsigned)
+  void publish_completion_summary();
   double m_last_average_time{0.};
 };
 } // namespace dfmodules
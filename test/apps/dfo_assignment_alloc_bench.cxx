@@ -0,0 +1,232 @@
+/**
+ * @file dfo_assignment_alloc_bench.cxx
+ *
+ * Counts the heap allocations made by the assignment bookkeeping of
+ * TriggerRecordBuilderData: the creation of the assignment, its addition to
+ * the application and its completion, by single tokens and by token batches.
+ * The global allocation functions are replaced by counting versions, and the
+ * counts are taken after a warm-up, when the assignment objects and the
+ * containers of TriggerRecordBuilderData have reached their steady state.
+ *
+ * The rest of the DFOModule decision path (the choice of the slot, the volume
+ * estimate, the trace, the senders and the dispatch) is not run, nor is the
+ * transport of the decisions and tokens by the IOManager. The individual
+ * TRCompleteInfo records are not published unless --completion-sampling is
+ * given, their cost being that of opmonlib.
+ *
+ * The program exits with an error if the decision or completion paths allocate.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/TriggerRecordBuilderData.hpp"
+
+#include "dfmessages/TriggerDecision.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+std::atomic<size_t> s_allocations{ 0 };
+} // namespace
+
+void*
+operator new(std::size_t size)
+{
+  ++s_allocations;
+  if (void* ptr = std::malloc(size ? size : 1))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void
+operator delete(void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void
+operator delete(void* ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
+using namespace dunedaq;
+using namespace dunedaq::dfmodules;
+
+namespace {
+
+struct BenchOptions
+{
+  size_t n_decisions = 1000000;
+  size_t n_warmup = 10000;
+  size_t n_components = 10;
+  size_t outstanding = 5;
+  size_t token_batch = 10;
+  double completion_sampling = 0.;
+};
+
+struct BenchResult
+{
+  size_t decision_allocations = 0;
+  size_t completion_allocations = 0;
+  double elapsed = 0.;
+};
+
+void
+print_usage(const char* name)
+{
+  std::cout << "Usage: " << name << " [options]\n"
+            << "  --decisions <n>    number of measured decisions (default 1000000)\n"
+            << "  --warmup <n>       number of decisions before the measurement (default 10000)\n"
+            << "  --components <n>   number of components of each decision (default 10)\n"
+            << "  --outstanding <n>  decisions assigned and not yet completed (default 5)\n"
+            << "  --token-batch <n>  tokens per batch for the batched completion (default 10)\n"
+            << "  --completion-sampling <f>  fraction of completions published as TRCompleteInfo (default 0)\n";
+}
+
+bool
+parse_options(int argc, char** argv, BenchOptions& opts)
+{
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc)
+      return false;
+    if (arg == "--completion-sampling") {
+      opts.completion_sampling = std::stod(argv[++i]);
+      continue;
+    }
+    auto value = std::stoul(argv[++i]);
+    if (arg == "--decisions")
+      opts.n_decisions = value;
+    else if (arg == "--warmup")
+      opts.n_warmup = value;
+    else if (arg == "--components")
+      opts.n_components = value;
+    else if (arg == "--outstanding")
+      opts.outstanding = value;
+    else if (arg == "--token-batch")
+      opts.token_batch = value;
+    else
+      return false;
+  }
+  return opts.outstanding > 0 && opts.n_decisions > 0 && opts.token_batch > 0;
+}
+
+// assigns and completes the decisions, by single tokens when token_batch is
+// 1 and by batches of token_batch tokens otherwise
+BenchResult
+run(const BenchOptions& opts, dfmessages::TriggerDecision& received, size_t token_batch)
+{
+  auto occupancy = std::make_shared<DataflowOccupancy>();
+  TriggerRecordBuilderData app("bench", opts.outstanding + token_batch, opts.outstanding, 0);
+  app.set_occupancy(occupancy);
+  app.set_completion_sampling(opts.completion_sampling);
+
+  std::deque<daqdataformats::trigger_number_t> outstanding;
+  // owned by the caller and reused, as DFOModule does
+  std::vector<daqdataformats::trigger_number_t> batch;
+  batch.reserve(token_batch);
+  std::vector<std::shared_ptr<AssignedTriggerDecision>> completed;
+  completed.reserve(token_batch);
+
+  BenchResult result;
+  auto start = std::chrono::steady_clock::now();
+
+  const size_t total = opts.n_warmup + opts.n_decisions;
+  for (size_t n = 1; n <= total; ++n) {
+    bool measured = n > opts.n_warmup;
+    if (n == opts.n_warmup + 1)
+      start = std::chrono::steady_clock::now();
+    received.trigger_number = n;
+
+    auto before = s_allocations.load();
+    {
+      auto assignment = app.make_assignment(received);
+      app.add_assignment(assignment);
+    }
+    auto after = s_allocations.load();
+    if (measured)
+      result.decision_allocations += after - before;
+
+    outstanding.push_back(n);
+    if (outstanding.size() < opts.outstanding + token_batch)
+      continue;
+
+    batch.clear();
+    for (size_t i = 0; i < token_batch; ++i) {
+      batch.push_back(outstanding.front());
+      outstanding.pop_front();
+    }
+    before = s_allocations.load();
+    if (token_batch == 1) {
+      app.complete_assignment(batch.front());
+    } else {
+      app.complete_assignments(batch, completed);
+      completed.clear();
+    }
+    after = s_allocations.load();
+    if (measured)
+      result.completion_allocations += after - before;
+  }
+
+  result.elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return result;
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+  BenchOptions opts;
+  try {
+    if (!parse_options(argc, argv, opts)) {
+      print_usage(argv[0]);
+      return 1;
+    }
+  } catch (const std::exception&) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  // the decision as received by the DFO
+  dfmessages::TriggerDecision received;
+  received.run_number = 1;
+  received.trigger_type = 1;
+  received.readout_type = dfmessages::ReadoutType::kLocalized;
+  for (size_t i = 0; i < opts.n_components; ++i) {
+    dfmessages::ComponentRequest request;
+    request.component = daqdataformats::SourceID(daqdataformats::SourceID::Subsystem::kDetectorReadout, i);
+    request.window_begin = 1000;
+    request.window_end = 2000;
+    received.components.push_back(request);
+  }
+
+  std::cout << "Measured " << opts.n_decisions << " decisions with " << opts.n_components << " components, "
+            << opts.outstanding << " outstanding, after " << opts.n_warmup << " decisions of warm-up\n";
+
+  size_t allocations = 0;
+  for (size_t token_batch : { static_cast<size_t>(1), opts.token_batch }) {
+    auto result = run(opts, received, token_batch);
+    allocations += result.decision_allocations + result.completion_allocations;
+    std::cout << (token_batch == 1 ? "single tokens:\n" : "token batches of " + std::to_string(token_batch) + ":\n")
+              << "  decision path:   " << static_cast<double>(result.decision_allocations) / opts.n_decisions
+              << " allocations per decision\n"
+              << "  completion path: " << static_cast<double>(result.completion_allocations) / opts.n_decisions
+              << " allocations per decision\n"
+              << "  " << opts.n_decisions / result.elapsed << " decisions per second\n";
+  }
+
+  return allocations == 0 ? 0 : 2;
+}
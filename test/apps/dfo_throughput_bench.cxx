@@ -0,0 +1,435 @@
+/**
+ * @file dfo_throughput_bench.cxx
+ *
+ * In-process throughput benchmark of the DFOModule. A synthetic trigger
+ * source sends TriggerDecisions to the DFO and a set of simulated dataflow
+ * applications return TriggerDecisionTokens after a configurable completion
+ * latency. All connections are in-process queues, so no network is needed.
+ *
+ * The benchmark reports the rate at which decisions are assigned (received
+ * by the simulated applications) and retired, the assignment latency
+ * (decision sent to the DFO until it is received by a simulated application)
+ * and the fraction of time the DFO signalled busy.
+ *
+ * The OKS configuration, such as test/config/dfo_bench.data.xml in the
+ * source tree, is given with --config.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmessages/TriggerDecision.hpp"
+#include "dfmessages/TriggerDecisionToken.hpp"
+#include "dfmessages/TriggerInhibit.hpp"
+
+#include "appfwk/ConfigurationManager.hpp"
+#include "appfwk/DAQModule.hpp"
+#include "appfwk/ModuleConfiguration.hpp"
+#include "iomanager/IOManager.hpp"
+#include "opmonlib/TestOpMonManager.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace dunedaq;
+using clock_type = std::chrono::steady_clock;
+
+namespace {
+
+struct BenchOptions
+{
+  std::string config; // required
+  size_t n_apps = 4;
+  size_t n_decisions = 100000;
+  double rate_hz = 0.;             // 0 means as fast as the DFO accepts them
+  std::string latency = "exp";     // fixed, exp or lognormal
+  double mean_latency_us = 1000.;
+  double lognormal_sigma = 0.5;
+  bool respect_inhibit = true;
+  unsigned seed = 12345;
+};
+
+void
+print_usage(const char* name)
+{
+  std::cout << "Usage: " << name << " --config <file> [options]\n"
+            << "  --config <file>        OKS configuration, e.g. test/config/dfo_bench.data.xml in the source tree\n"
+            << "  --apps <n>             number of simulated dataflow applications, at most 8 (default 4)\n"
+            << "  --decisions <n>        number of TriggerDecisions to send (default 100000)\n"
+            << "  --rate <Hz>            decision rate, 0 to send as fast as possible (default 0)\n"
+            << "  --latency <dist>       completion latency distribution: fixed, exp, lognormal (default exp)\n"
+            << "  --mean-latency-us <us> mean completion latency (default 1000)\n"
+            << "  --sigma <s>            sigma of the lognormal distribution (default 0.5)\n"
+            << "  --ignore-inhibit       keep sending decisions while the DFO is busy\n"
+            << "  --seed <n>             random seed (default 12345)\n";
+}
+
+bool
+parse_options(int argc, char** argv, BenchOptions& opts)
+{
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto next = [&]() -> std::string {
+      if (i + 1 >= argc)
+        throw std::invalid_argument("missing value for " + arg);
+      return argv[++i];
+    };
+    if (arg == "--config")
+      opts.config = next();
+    else if (arg == "--apps")
+      opts.n_apps = std::stoul(next());
+    else if (arg == "--decisions")
+      opts.n_decisions = std::stoul(next());
+    else if (arg == "--rate")
+      opts.rate_hz = std::stod(next());
+    else if (arg == "--latency")
+      opts.latency = next();
+    else if (arg == "--mean-latency-us")
+      opts.mean_latency_us = std::stod(next());
+    else if (arg == "--sigma")
+      opts.lognormal_sigma = std::stod(next());
+    else if (arg == "--ignore-inhibit")
+      opts.respect_inhibit = false;
+    else if (arg == "--seed")
+      opts.seed = std::stoul(next());
+    else
+      return false;
+  }
+  if (opts.config.empty())
+    throw std::invalid_argument("--config is required");
+  if (!std::filesystem::exists(opts.config))
+    throw std::invalid_argument("configuration file " + opts.config + " not found");
+  opts.config = std::filesystem::absolute(opts.config).string();
+  return opts.n_apps > 0 && opts.n_apps <= 8 && opts.n_decisions > 0 &&
+         (opts.latency == "fixed" || opts.latency == "exp" || opts.latency == "lognormal");
+}
+
+/**
+ * @brief A simulated dataflow application: it receives TriggerDecisions from
+ * the DFO and returns the corresponding token once the sampled completion
+ * latency has elapsed.
+ */
+class SimulatedApp
+{
+public:
+  SimulatedApp(std::string connection,
+               const BenchOptions& opts,
+               unsigned seed,
+               std::vector<clock_type::time_point>& sent_times,
+               std::vector<double>& assignment_latencies,
+               std::vector<clock_type::time_point>& received_times,
+               std::atomic<size_t>& completed)
+    : m_connection(std::move(connection))
+    , m_opts(opts)
+    , m_generator(seed)
+    , m_sent_times(sent_times)
+    , m_assignment_latencies(assignment_latencies)
+    , m_received_times(received_times)
+    , m_completed(completed)
+  {
+    m_token_sender = get_iom_sender<dfmessages::TriggerDecisionToken>("bench_token");
+  }
+
+  void start()
+  {
+    m_running = true;
+    m_thread = std::thread(&SimulatedApp::complete_decisions, this);
+    get_iom_receiver<dfmessages::TriggerDecision>(m_connection)
+      ->add_callback(std::bind(&SimulatedApp::receive_decision, this, std::placeholders::_1));
+
+    dfmessages::TriggerDecisionToken token;
+    token.run_number = 0;
+    token.trigger_number = 0;
+    token.decision_destination = m_connection;
+    m_token_sender->send(std::move(token), iomanager::Sender::s_block);
+  }
+
+  void stop()
+  {
+    get_iom_receiver<dfmessages::TriggerDecision>(m_connection)->remove_callback();
+    {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      m_running = false;
+    }
+    m_cv.notify_all();
+    m_thread.join();
+  }
+
+  size_t received() const { return m_received.load(); }
+
+private:
+  using pending_t = std::pair<clock_type::time_point, dfmessages::trigger_number_t>;
+
+  clock_type::duration sample_latency()
+  {
+    double us = m_opts.mean_latency_us;
+    if (m_opts.latency == "exp") {
+      us = std::exponential_distribution<double>(1. / m_opts.mean_latency_us)(m_generator);
+    } else if (m_opts.latency == "lognormal") {
+      // mean of the lognormal is exp(mu + sigma^2/2)
+      double sigma = m_opts.lognormal_sigma;
+      double mu = std::log(m_opts.mean_latency_us) - sigma * sigma / 2.;
+      us = std::lognormal_distribution<double>(mu, sigma)(m_generator);
+    }
+    return std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double, std::micro>(us));
+  }
+
+  void receive_decision(dfmessages::TriggerDecision& decision)
+  {
+    auto now = clock_type::now();
+    auto trigger_number = decision.trigger_number;
+    if (trigger_number < m_sent_times.size()) {
+      m_assignment_latencies[trigger_number] =
+        std::chrono::duration<double, std::micro>(now - m_sent_times[trigger_number]).count();
+      m_received_times[trigger_number] = now;
+    }
+    ++m_received;
+
+    {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      m_pending.emplace(now + sample_latency(), trigger_number);
+    }
+    m_cv.notify_one();
+  }
+
+  void complete_decisions()
+  {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    while (m_running) {
+      if (m_pending.empty()) {
+        m_cv.wait(lk);
+        continue;
+      }
+      auto [due, trigger_number] = m_pending.top();
+      if (clock_type::now() < due) {
+        m_cv.wait_until(lk, due);
+        continue;
+      }
+      m_pending.pop();
+      lk.unlock();
+
+      dfmessages::TriggerDecisionToken token;
+      token.run_number = 1;
+      token.trigger_number = trigger_number;
+      token.decision_destination = m_connection;
+      m_token_sender->send(std::move(token), iomanager::Sender::s_block);
+      ++m_completed;
+
+      lk.lock();
+    }
+  }
+
+  const std::string m_connection;
+  const BenchOptions& m_opts;
+  std::mt19937_64 m_generator;
+  std::vector<clock_type::time_point>& m_sent_times;
+  std::vector<double>& m_assignment_latencies;
+  std::vector<clock_type::time_point>& m_received_times;
+  std::atomic<size_t>& m_completed;
+  std::atomic<size_t> m_received{ 0 };
+
+  std::shared_ptr<iomanager::SenderConcept<dfmessages::TriggerDecisionToken>> m_token_sender;
+  std::priority_queue<pending_t, std::vector<pending_t>, std::greater<pending_t>> m_pending;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  bool m_running{ false };
+  std::thread m_thread;
+};
+
+/**
+ * @brief Accumulates the time spent in the busy state advertised by the DFO
+ */
+class BusyMonitor
+{
+public:
+  void receive_inhibit(dfmessages::TriggerInhibit& inhibit)
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    auto now = clock_type::now();
+    if (inhibit.busy && !m_busy) {
+      m_busy_since = now;
+      ++m_transitions;
+    } else if (!inhibit.busy && m_busy) {
+      m_busy_time += now - m_busy_since;
+    }
+    m_busy = inhibit.busy;
+  }
+
+  bool is_busy() const
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return m_busy;
+  }
+
+  std::pair<clock_type::duration, size_t> summary(clock_type::time_point now) const
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return { m_busy_time + (m_busy ? now - m_busy_since : clock_type::duration::zero()), m_transitions };
+  }
+
+private:
+  mutable std::mutex m_mutex;
+  bool m_busy{ false };
+  clock_type::time_point m_busy_since;
+  clock_type::duration m_busy_time{ clock_type::duration::zero() };
+  size_t m_transitions{ 0 };
+};
+
+double
+percentile(const std::vector<double>& sorted, double p)
+{
+  if (sorted.empty())
+    return 0.;
+  auto index = static_cast<size_t>(p * (sorted.size() - 1));
+  return sorted[index];
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+  BenchOptions opts;
+  try {
+    if (!parse_options(argc, argv, opts)) {
+      print_usage(argv[0]);
+      return 1;
+    }
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  setenv("DUNEDAQ_PARTITION", "bench_session", 0);
+
+  opmonlib::TestOpMonManager opmgr;
+  auto cfg_mgr =
+    std::make_shared<appfwk::ConfigurationManager>("oksconflibs:" + opts.config, "BenchApp", "bench_session");
+  auto mod_cfg = std::make_shared<appfwk::ModuleConfiguration>(cfg_mgr);
+  get_iomanager()->configure("bench_session", mod_cfg->queues(), mod_cfg->networkconnections(), nullptr, opmgr);
+
+  auto dfo = appfwk::make_module("DFOModule", "bench");
+  opmgr.register_node("dfo", dfo);
+  dfo->init(mod_cfg);
+
+  std::vector<clock_type::time_point> sent_times(opts.n_decisions + 1);
+  std::vector<double> assignment_latencies(opts.n_decisions + 1, -1.);
+  std::vector<clock_type::time_point> received_times(opts.n_decisions + 1);
+  std::atomic<size_t> completed{ 0 };
+
+  BusyMonitor busy_monitor;
+  auto inhibit_receiver = get_iom_receiver<dfmessages::TriggerInhibit>("bench_triginh");
+  inhibit_receiver->add_callback(std::bind(&BusyMonitor::receive_inhibit, &busy_monitor, std::placeholders::_1));
+
+  nlohmann::json null_json = nlohmann::json::object();
+  dfo->execute_command("conf", null_json);
+  dfo->execute_command("start", nlohmann::json{ { "run", 1 } });
+
+  std::vector<std::unique_ptr<SimulatedApp>> apps;
+  for (size_t i = 0; i < opts.n_apps; ++i) {
+    apps.emplace_back(std::make_unique<SimulatedApp>(
+      "bench_trigdec_" + std::to_string(i), opts, opts.seed + i, sent_times, assignment_latencies, received_times,
+      completed));
+    apps.back()->start();
+  }
+  // let the DFO register the applications
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  auto decision_sender = get_iom_sender<dfmessages::TriggerDecision>("bench_trigdec");
+  auto period = opts.rate_hz > 0. ? std::chrono::duration_cast<clock_type::duration>(
+                                      std::chrono::duration<double>(1. / opts.rate_hz))
+                                  : clock_type::duration::zero();
+
+  auto start_time = clock_type::now();
+  auto next_send = start_time;
+  for (size_t n = 1; n <= opts.n_decisions; ++n) {
+    if (opts.respect_inhibit) {
+      while (busy_monitor.is_busy())
+        std::this_thread::sleep_for(std::chrono::microseconds(10));
+    }
+    if (period > clock_type::duration::zero()) {
+      std::this_thread::sleep_until(next_send);
+      next_send += period;
+    }
+
+    dfmessages::TriggerDecision td;
+    td.trigger_number = n;
+    td.run_number = 1;
+    td.trigger_timestamp = n;
+    td.trigger_type = 1;
+    td.readout_type = dfmessages::ReadoutType::kLocalized;
+    sent_times[n] = clock_type::now();
+    decision_sender->send(std::move(td), iomanager::Sender::s_block);
+  }
+  auto sent_time = clock_type::now();
+
+  // wait for all the decisions to be retired, with a generous timeout
+  auto deadline = sent_time + std::chrono::seconds(10) +
+                  std::chrono::microseconds(static_cast<int64_t>(10 * opts.mean_latency_us));
+  while (completed.load() < opts.n_decisions && clock_type::now() < deadline)
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  auto end_time = clock_type::now();
+  auto [busy_time, busy_transitions] = busy_monitor.summary(end_time);
+
+  dfo->execute_command("drain_dataflow", null_json);
+  for (auto& app : apps)
+    app->stop();
+  dfo->execute_command("scrap", null_json);
+  inhibit_receiver->remove_callback();
+
+  // the assignment rate is measured where the decisions arrive, between the
+  // first and the last decision received by the applications
+  std::vector<double> latencies;
+  latencies.reserve(opts.n_decisions);
+  auto first_received = clock_type::time_point::max();
+  auto last_received = clock_type::time_point::min();
+  for (size_t n = 1; n <= opts.n_decisions; ++n) {
+    if (assignment_latencies[n] < 0.)
+      continue;
+    latencies.push_back(assignment_latencies[n]);
+    first_received = std::min(first_received, received_times[n]);
+    last_received = std::max(last_received, received_times[n]);
+  }
+  std::sort(latencies.begin(), latencies.end());
+
+  double elapsed = std::chrono::duration<double>(end_time - start_time).count();
+  double receiving =
+    latencies.size() > 1 ? std::chrono::duration<double>(last_received - first_received).count() : 0.;
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "DFO throughput benchmark: " << opts.n_apps << " apps, " << opts.n_decisions << " decisions, "
+            << opts.latency << " completion latency with mean " << opts.mean_latency_us << " us\n";
+  std::cout << "  decisions retired:        " << completed.load() << " / " << opts.n_decisions << "\n";
+  std::cout << "  assigned decisions/s:     " << (receiving > 0. ? (latencies.size() - 1) / receiving : 0.) << "\n";
+  std::cout << "  retired decisions/s:      " << completed.load() / elapsed << "\n";
+  std::cout << "  assignment latency [us]:  p50 " << percentile(latencies, 0.5) << ", p90 "
+            << percentile(latencies, 0.9) << ", p99 " << percentile(latencies, 0.99) << ", max "
+            << (latencies.empty() ? 0. : latencies.back()) << "\n";
+  std::cout << "  busy fraction:            " << std::setprecision(3)
+            << std::chrono::duration<double>(busy_time).count() / elapsed << " (" << busy_transitions
+            << " busy transitions)\n";
+  for (size_t i = 0; i < apps.size(); ++i)
+    std::cout << "  app " << i << " received:           " << apps[i]->received() << "\n";
+
+  get_iomanager()->reset();
+  return completed.load() == opts.n_decisions ? 0 : 2;
+}
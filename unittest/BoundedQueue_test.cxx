@@ -0,0 +1,77 @@
+/**
+ * @file BoundedQueue_test.cxx Test application that tests and demonstrates
+ * the functionality of the BoundedQueue class.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/BoundedQueue.hpp"
+
+#define BOOST_TEST_MODULE BoundedQueue_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+using namespace dunedaq::dfmodules;
+using namespace std::chrono_literals;
+
+BOOST_AUTO_TEST_SUITE(BoundedQueue_Test)
+
+BOOST_AUTO_TEST_CASE(Order)
+{
+  BoundedQueue<std::unique_ptr<int>> queue;
+  BOOST_REQUIRE(!queue.pop(1ms));
+
+  for (int i = 0; i < 3; ++i)
+    queue.push(std::make_unique<int>(i), 10);
+  BOOST_REQUIRE_EQUAL(queue.size(), 3);
+  BOOST_REQUIRE_EQUAL(queue.bytes(), 30);
+
+  for (int i = 0; i < 3; ++i) {
+    auto item = queue.pop(1ms);
+    BOOST_REQUIRE(item);
+    BOOST_REQUIRE_EQUAL(**item, i);
+  }
+  BOOST_REQUIRE(queue.empty());
+  BOOST_REQUIRE_EQUAL(queue.bytes(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(Capacity)
+{
+  BoundedQueue<int> queue(100);
+
+  // an empty queue takes an item larger than the capacity
+  auto waited = queue.push(1, 1000);
+  BOOST_REQUIRE_EQUAL(waited.count(), 0);
+
+  std::atomic<bool> pushed{ false };
+  std::thread producer([&]() {
+    queue.push(2, 10);
+    pushed = true;
+  });
+
+  std::this_thread::sleep_for(20ms);
+  BOOST_REQUIRE(!pushed);
+
+  BOOST_REQUIRE_EQUAL(*queue.pop(1ms), 1);
+  producer.join();
+  BOOST_REQUIRE(pushed);
+  BOOST_REQUIRE_EQUAL(queue.bytes(), 10);
+
+  // the capacity is not exceeded by the last item
+  queue.push(3, 80);
+  std::thread second_producer([&]() { queue.push(4, 20); });
+  std::this_thread::sleep_for(20ms);
+  BOOST_REQUIRE_EQUAL(queue.size(), 2);
+  BOOST_REQUIRE_EQUAL(*queue.pop(1ms), 2);
+  second_producer.join();
+  BOOST_REQUIRE_EQUAL(queue.bytes(), 100);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,85 @@
+/**
+ * @file BusyPredictor_test.cxx Test application that tests and demonstrates
+ * the functionality of the BusyPredictor class.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/BusyPredictor.hpp"
+
+#define BOOST_TEST_MODULE BusyPredictor_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <chrono>
+
+using namespace dunedaq::dfmodules;
+using namespace std::chrono_literals;
+
+BOOST_AUTO_TEST_SUITE(BusyPredictor_Test)
+
+BOOST_AUTO_TEST_CASE(HardBusy)
+{
+  BusyPredictor predictor(100ms, 50ms);
+  auto start = BusyPredictor::clock_t::now();
+  predictor.reset(start);
+
+  BOOST_REQUIRE(!predictor.evaluate(false, 10, start + 1ms));
+
+  // hard busy is not subject to the dwell time
+  BOOST_REQUIRE(predictor.evaluate(true, 0, start + 2ms));
+
+  // but its release is
+  BOOST_REQUIRE(predictor.evaluate(false, 10, start + 10ms));
+  BOOST_REQUIRE(!predictor.evaluate(false, 10, start + 60ms));
+  BOOST_REQUIRE_EQUAL(predictor.get_predicted_busy_count(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(PredictedBusy)
+{
+  BusyPredictor predictor(100ms, 10ms);
+  auto start = BusyPredictor::clock_t::now();
+  predictor.reset(start);
+
+  // decisions arriving much faster than they complete
+  for (int i = 0; i < 100; ++i)
+    predictor.decision_received();
+  BOOST_REQUIRE(predictor.evaluate(false, 10, start + 30ms));
+  BOOST_REQUIRE_GT(predictor.decision_rate(), 0.);
+  BOOST_REQUIRE_EQUAL(predictor.completion_rate(), 0.);
+  BOOST_REQUIRE_EQUAL(predictor.get_predicted_busy_count(), 1);
+
+  // within the dwell time nothing changes
+  predictor.decisions_completed(1000);
+  BOOST_REQUIRE(predictor.evaluate(false, 10, start + 35ms));
+
+  // completions now exceed decisions
+  BOOST_REQUIRE(!predictor.evaluate(false, 10, start + 100ms));
+  BOOST_REQUIRE_GT(predictor.completion_rate(), predictor.decision_rate());
+}
+
+BOOST_AUTO_TEST_CASE(Hysteresis)
+{
+  BusyPredictor predictor(100ms, 0ms, 1.);
+  auto start = BusyPredictor::clock_t::now();
+  predictor.reset(start);
+
+  // 1 kHz excess, 50 slots free: full in 50 ms
+  for (int i = 0; i < 25; ++i)
+    predictor.decision_received();
+  BOOST_REQUIRE(predictor.evaluate(false, 50, start + 25ms));
+
+  // 150 ms to full is not enough to release
+  for (int i = 0; i < 25; ++i)
+    predictor.decision_received();
+  BOOST_REQUIRE(predictor.evaluate(false, 150, start + 50ms));
+
+  // 250 ms is
+  for (int i = 0; i < 25; ++i)
+    predictor.decision_received();
+  BOOST_REQUIRE(!predictor.evaluate(false, 250, start + 75ms));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,91 @@
+/**
+ * @file DFOTrace_test.cxx Test application that tests and demonstrates
+ * the functionality of the DFOTraceWriter and DFOTraceReader classes.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/DFOTrace.hpp"
+
+#define BOOST_TEST_MODULE DFOTrace_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+using namespace dunedaq::dfmodules;
+
+BOOST_AUTO_TEST_SUITE(DFOTrace_Test)
+
+BOOST_AUTO_TEST_CASE(RoundTrip)
+{
+  auto file_name = (std::filesystem::temp_directory_path() / "DFOTrace_test.dfotrace").string();
+
+  {
+    DFOTraceWriter writer(file_name, 2);
+    auto first = writer.add_app("first");
+    writer.record(DFOTraceRecord::kDecision, 1);
+    writer.record(DFOTraceRecord::kAssignment, 1, first, 1000);
+    writer.record(DFOTraceRecord::kBusy, 0, 1);
+    auto second = writer.add_app("second");
+    writer.record(DFOTraceRecord::kCompletion, 1, second);
+    BOOST_REQUIRE_EQUAL(first, 0);
+    BOOST_REQUIRE_EQUAL(second, 1);
+  }
+
+  DFOTraceReader reader(file_name);
+  std::vector<DFOTraceRecord> records;
+  DFOTraceRecord rec;
+  while (reader.next(rec))
+    records.push_back(rec);
+
+  BOOST_REQUIRE_EQUAL(records.size(), 6);
+  BOOST_REQUIRE_EQUAL(records[0].type, DFOTraceRecord::kApp);
+  BOOST_REQUIRE_EQUAL(records[1].type, DFOTraceRecord::kDecision);
+  BOOST_REQUIRE_EQUAL(records[2].type, DFOTraceRecord::kAssignment);
+  BOOST_REQUIRE_EQUAL(records[2].bytes, 1000);
+  BOOST_REQUIRE_EQUAL(records[3].type, DFOTraceRecord::kBusy);
+  BOOST_REQUIRE_EQUAL(records[4].type, DFOTraceRecord::kApp);
+  BOOST_REQUIRE_EQUAL(records[5].type, DFOTraceRecord::kCompletion);
+  BOOST_REQUIRE_EQUAL(records[5].app, 1);
+  for (size_t i = 1; i < records.size(); ++i)
+    BOOST_REQUIRE(records[i - 1].time_ns <= records[i].time_ns);
+
+  BOOST_REQUIRE_EQUAL(reader.get_app_names().size(), 2);
+  BOOST_REQUIRE_EQUAL(reader.get_app_names()[0], "first");
+  BOOST_REQUIRE_EQUAL(reader.get_app_names()[1], "second");
+
+  std::filesystem::remove(file_name);
+}
+
+BOOST_AUTO_TEST_CASE(WriteFailure)
+{
+  // the device accepts to be opened but every write fails
+  if (!std::filesystem::exists("/dev/full"))
+    return;
+
+  DFOTraceWriter writer("/dev/full", 1);
+  BOOST_REQUIRE_NO_THROW(writer.record(DFOTraceRecord::kDecision, 1));
+  writer.flush();
+  BOOST_REQUIRE(writer.failed());
+  // the trace is disabled, recording goes on without effect
+  BOOST_REQUIRE_NO_THROW(writer.record(DFOTraceRecord::kDecision, 2));
+  BOOST_REQUIRE_NO_THROW(writer.flush());
+}
+
+BOOST_AUTO_TEST_CASE(NotATrace)
+{
+  auto file_name = (std::filesystem::temp_directory_path() / "DFOTrace_test.txt").string();
+  {
+    std::ofstream file(file_name);
+    file << "not a trace";
+  }
+  BOOST_REQUIRE_THROW(DFOTraceReader reader(file_name), DFOTraceFileProblem);
+  std::filesystem::remove(file_name);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
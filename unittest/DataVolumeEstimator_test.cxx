@@ -0,0 +1,80 @@
+/**
+ * @file DataVolumeEstimator_test.cxx Test application that tests and demonstrates
+ * the functionality of the DataVolumeEstimator class.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/DataVolumeEstimator.hpp"
+
+#define BOOST_TEST_MODULE DataVolumeEstimator_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+using namespace dunedaq::dfmodules;
+using dunedaq::daqdataformats::SourceID;
+
+BOOST_AUTO_TEST_SUITE(DataVolumeEstimator_Test)
+
+BOOST_AUTO_TEST_CASE(FirstObservation)
+{
+  DataVolumeEstimator estimator;
+  SourceID sid(SourceID::Subsystem::kDetectorReadout, 1);
+
+  BOOST_REQUIRE_EQUAL(estimator.size(), 0);
+  BOOST_REQUIRE_EQUAL(estimator.estimate(sid, 1000), 0);
+
+  estimator.update(sid, 1000, 10000);
+  BOOST_REQUIRE_EQUAL(estimator.size(), 1);
+  BOOST_REQUIRE_EQUAL(estimator.estimate(sid, 1000), 10000);
+  BOOST_REQUIRE_EQUAL(estimator.estimate(sid, 2000), 20000);
+
+  estimator.clear();
+  BOOST_REQUIRE_EQUAL(estimator.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(Convergence)
+{
+  DataVolumeEstimator estimator;
+  SourceID sid(SourceID::Subsystem::kDetectorReadout, 1);
+
+  // 500 bytes of fixed overhead and 8 bytes per tick
+  auto truth = [](uint64_t ticks) { return 500 + 8 * ticks; }; // NOLINT(build/unsigned)
+  for (int i = 0; i < 2000; ++i) {
+    uint64_t ticks = (i % 2) ? 1000 : 3000; // NOLINT(build/unsigned)
+    estimator.update(sid, ticks, truth(ticks));
+  }
+
+  BOOST_CHECK_CLOSE(static_cast<double>(estimator.estimate(sid, 2000)), static_cast<double>(truth(2000)), 1.);
+  BOOST_CHECK_CLOSE(static_cast<double>(estimator.estimate(sid, 10000)), static_cast<double>(truth(10000)), 1.);
+}
+
+BOOST_AUTO_TEST_CASE(TriggerDecisionEstimate)
+{
+  DataVolumeEstimator estimator;
+  SourceID known(SourceID::Subsystem::kDetectorReadout, 1);
+  SourceID unknown(SourceID::Subsystem::kDetectorReadout, 2);
+  estimator.update(known, 100, 1000);
+
+  dunedaq::dfmessages::TriggerDecision td;
+  td.trigger_number = 1;
+  td.run_number = 1;
+
+  dunedaq::dfmessages::ComponentRequest known_request;
+  known_request.component = known;
+  known_request.window_begin = 1000;
+  known_request.window_end = 1500;
+  td.components.push_back(known_request);
+
+  dunedaq::dfmessages::ComponentRequest unknown_request;
+  unknown_request.component = unknown;
+  unknown_request.window_begin = 1000;
+  unknown_request.window_end = 1500;
+  td.components.push_back(unknown_request);
+
+  BOOST_REQUIRE_EQUAL(estimator.estimate(td), 5000);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,125 @@
+/**
+ * @file FragmentCompressor_test.cxx Test application that tests and demonstrates
+ * the functionality of the FragmentCompressor class.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/FragmentCompressor.hpp"
+
+#define BOOST_TEST_MODULE FragmentCompressor_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace dunedaq::dfmodules;
+using namespace dunedaq::daqdataformats;
+
+namespace {
+// sparse data, as from the detector: mostly zeros
+std::vector<char>
+make_payload(size_t size)
+{
+  std::vector<char> payload(size, 0);
+  for (size_t i = 0; i < size; i += 64)
+    payload[i] = static_cast<char>(i);
+  return payload;
+}
+
+std::unique_ptr<TriggerRecord>
+make_trigger_record(const std::vector<char>& payload)
+{
+  TriggerRecordHeaderData trh_data;
+  trh_data.trigger_number = 1;
+  trh_data.run_number = 53;
+  trh_data.num_requested_components = 2;
+  trh_data.max_sequence_number = 1;
+  TriggerRecordHeader trh(&trh_data);
+  auto tr = std::make_unique<TriggerRecord>(trh);
+
+  for (auto type : { FragmentType::kWIBEth, FragmentType::kTriggerPrimitive }) {
+    FragmentHeader fh;
+    fh.trigger_number = 1;
+    fh.run_number = 53;
+    fh.fragment_type = static_cast<fragment_type_t>(type);
+    fh.element_id = SourceID(SourceID::Subsystem::kDetectorReadout, static_cast<uint32_t>(type)); // NOLINT(build/unsigned)
+    auto fragment = std::make_unique<Fragment>(const_cast<char*>(payload.data()), payload.size());
+    fragment->set_header_fields(fh);
+    tr->add_fragment(std::move(fragment));
+  }
+  return tr;
+}
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(FragmentCompressor_Test)
+
+BOOST_AUTO_TEST_CASE(Payload)
+{
+  auto payload = make_payload(100000);
+  auto compressed = FragmentCompressor::deflate(payload.data(), payload.size(), 6);
+  BOOST_REQUIRE(compressed.size() < payload.size() / 3);
+  BOOST_REQUIRE(FragmentCompressor::inflate(compressed.data(), compressed.size()) == payload);
+}
+
+BOOST_AUTO_TEST_CASE(TriggerRecordFragments)
+{
+  auto payload = make_payload(100000);
+  auto tr = make_trigger_record(payload);
+
+  // only the fragments of the configured type are compressed
+  FragmentCompressor compressor({ { FragmentType::kWIBEth, 6 } }, 2);
+  auto compressed = compressor.compress(*tr);
+  BOOST_REQUIRE_EQUAL(compressed.record->get_header_ref().get_trigger_number(), 1);
+  BOOST_REQUIRE_EQUAL(compressed.fragments.size(), 1);
+  BOOST_REQUIRE_EQUAL(compressed.record->get_fragments_ref().size(), 2);
+
+  // the whole fragment is compressed, header included
+  const auto& wib = compressed.fragments[0];
+  const auto& original = *tr->get_fragments_ref()[0];
+  BOOST_REQUIRE(wib.header.element_id == original.get_element_id());
+  BOOST_REQUIRE_EQUAL(wib.level, 6);
+  BOOST_REQUIRE(wib.data.size() < payload.size() / 3);
+  auto restored = FragmentCompressor::inflate(wib.data.data(), wib.data.size());
+  BOOST_REQUIRE_EQUAL(restored.size(), original.get_size());
+  BOOST_REQUIRE_EQUAL(std::memcmp(restored.data(), original.get_storage_location(), restored.size()), 0);
+
+  // the compressed fragment keeps its place in the record, as its header only
+  const auto& placeholder = *compressed.record->get_fragments_ref()[0];
+  BOOST_REQUIRE(placeholder.get_element_id() == original.get_element_id());
+  BOOST_REQUIRE(placeholder.get_fragment_type() == FragmentType::kWIBEth);
+  BOOST_REQUIRE_EQUAL(placeholder.get_size(), sizeof(FragmentHeader));
+
+  const auto& tp = *compressed.record->get_fragments_ref()[1];
+  BOOST_REQUIRE(tp.get_fragment_type() == FragmentType::kTriggerPrimitive);
+  BOOST_REQUIRE_EQUAL(tp.get_size(), tr->get_fragments_ref()[1]->get_size());
+  BOOST_REQUIRE_EQUAL(std::memcmp(tp.get_data(), payload.data(), payload.size()), 0);
+
+  BOOST_REQUIRE_EQUAL(compressor.take_bytes_in(), original.get_size());
+  BOOST_REQUIRE_EQUAL(compressor.take_bytes_out(), wib.data.size());
+  BOOST_REQUIRE_EQUAL(compressor.take_bytes_in(), 0);
+  BOOST_REQUIRE_EQUAL(compressor.get_compressed_types(), fragment_type_to_string(FragmentType::kWIBEth));
+}
+
+BOOST_AUTO_TEST_CASE(IncompressibleFragments)
+{
+  // random data does not deflate, such fragments are stored as they are
+  std::vector<char> payload(100000);
+  std::mt19937 generator(53);
+  for (auto& byte : payload)
+    byte = static_cast<char>(generator());
+  auto tr = make_trigger_record(payload);
+
+  FragmentCompressor compressor({ { FragmentType::kWIBEth, 6 } }, 1);
+  auto compressed = compressor.compress(*tr);
+  BOOST_REQUIRE(compressed.fragments.empty());
+  BOOST_REQUIRE_EQUAL(compressed.record->get_fragments_ref().size(), 2);
+  BOOST_REQUIRE_EQUAL(compressor.take_bytes_in(), compressor.take_bytes_out());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
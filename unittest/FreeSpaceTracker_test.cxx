@@ -0,0 +1,82 @@
+/**
+ * @file FreeSpaceTracker_test.cxx Test application that tests and demonstrates
+ * the functionality of the FreeSpaceTracker class.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "dfmodules/FreeSpaceTracker.hpp"
+
+#define BOOST_TEST_MODULE FreeSpaceTracker_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using namespace dunedaq::dfmodules;
+using namespace std::chrono_literals;
+
+BOOST_AUTO_TEST_SUITE(FreeSpaceTracker_Test)
+
+BOOST_AUTO_TEST_CASE(SampleForEachWrite)
+{
+  std::atomic<size_t> disk_free{ 1000 };
+  FreeSpaceTracker tracker([&]() { return disk_free.load(); }, 0ms, 0);
+
+  // without a sampling period, the file system is queried for each write
+  BOOST_REQUIRE_EQUAL(tracker.free_space(10), 1000);
+  disk_free = 500;
+  BOOST_REQUIRE_EQUAL(tracker.free_space(10), 500);
+  BOOST_REQUIRE_EQUAL(tracker.take_samples(), 2);
+  BOOST_REQUIRE_EQUAL(tracker.take_synchronous_samples(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(Estimate)
+{
+  std::atomic<size_t> disk_free{ 1000 };
+  FreeSpaceTracker tracker([&]() { return disk_free.load(); }, 1h, 100);
+
+  // the first request samples, as there is no estimate yet
+  BOOST_REQUIRE_EQUAL(tracker.free_space(10), 1000);
+  BOOST_REQUIRE_EQUAL(tracker.take_synchronous_samples(), 1);
+
+  // the writes are subtracted from the sample, without querying the file system
+  disk_free = 700;
+  tracker.record_written(300);
+  BOOST_REQUIRE_EQUAL(tracker.estimate(), 700);
+  BOOST_REQUIRE_EQUAL(tracker.free_space(10), 700);
+  BOOST_REQUIRE_EQUAL(tracker.take_synchronous_samples(), 0);
+
+  // close to the need, the file system is queried again
+  disk_free = 650;
+  BOOST_REQUIRE_EQUAL(tracker.free_space(650), 650);
+  BOOST_REQUIRE_EQUAL(tracker.take_synchronous_samples(), 1);
+  BOOST_REQUIRE_EQUAL(tracker.estimate(), 650);
+
+  // the estimate does not go below zero
+  tracker.record_written(1000);
+  BOOST_REQUIRE_EQUAL(tracker.estimate(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(BackgroundSampling)
+{
+  std::atomic<size_t> disk_free{ 1000 };
+  FreeSpaceTracker tracker([&]() { return disk_free.load(); }, 5ms, 0);
+  tracker.start();
+  BOOST_REQUIRE_EQUAL(tracker.estimate(), 1000);
+
+  // another writer fills the disk, the background samples catch up with it
+  disk_free = 400;
+  std::this_thread::sleep_for(100ms);
+  BOOST_REQUIRE_EQUAL(tracker.estimate(), 400);
+  BOOST_REQUIRE(tracker.take_samples() > 1);
+  BOOST_REQUIRE_EQUAL(tracker.take_synchronous_samples(), 0);
+
+  tracker.stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
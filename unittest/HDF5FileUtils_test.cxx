@@ -8,6 +8,7 @@
  */
 
 #include "HDF5FileUtils.hpp"
+#include "dfmodules/FragmentCompressor.hpp"
 
 #define BOOST_TEST_MODULE HDF5FileUtils_test // NOLINT
 
@@ -16,6 +17,7 @@
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <numeric>
 #include <regex>
 #include <string>
 #include <vector>
@@ -75,4 +77,55 @@ BOOST_AUTO_TEST_CASE(GetFileList)
   BOOST_REQUIRE_EQUAL(file_list.size(), 3);
 }
 
+BOOST_AUTO_TEST_CASE(ReplaceWithDeflatedDataset)
+{
+  std::string file_name =
+    std::string(std::filesystem::temp_directory_path()) + "/deflated_" + std::to_string(getpid()) + ".hdf5";
+  const std::string dataset_path = "/TriggerRecord00001.0000/RawData/Detector_Readout_0x00000000_WIB";
+
+  // the placeholder, written through one identifier as hdf5libs would do
+  hid_t writer_id = H5Fcreate(file_name.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+  BOOST_REQUIRE(writer_id >= 0);
+  hsize_t placeholder_size = 72;
+  std::vector<char> placeholder(placeholder_size, 1);
+  hid_t space = H5Screate_simple(1, &placeholder_size, nullptr);
+  hid_t link_props = H5Pcreate(H5P_LINK_CREATE);
+  H5Pset_create_intermediate_group(link_props, 1);
+  hid_t dataset = H5Dcreate2(writer_id, dataset_path.c_str(), H5T_NATIVE_CHAR, space, link_props, H5P_DEFAULT, H5P_DEFAULT);
+  H5Dwrite(dataset, H5T_NATIVE_CHAR, H5S_ALL, H5S_ALL, H5P_DEFAULT, placeholder.data());
+  H5Dclose(dataset);
+  H5Pclose(link_props);
+  H5Sclose(space);
+
+  std::vector<char> original(100000);
+  std::iota(original.begin(), original.end(), 0);
+  auto deflated = FragmentCompressor::deflate(original.data(), original.size(), 6);
+
+  // a placeholder of another size is not replaced
+  hid_t file_id = HDF5FileUtils::reopen_file(file_name);
+  BOOST_REQUIRE(file_id >= 0);
+  BOOST_REQUIRE(!HDF5FileUtils::replace_with_deflated_dataset(file_id, dataset_path, 10, original.size(), 6, deflated));
+  BOOST_REQUIRE(!HDF5FileUtils::replace_with_deflated_dataset(file_id, "/nothing", 72, original.size(), 6, deflated));
+  BOOST_REQUIRE(
+    HDF5FileUtils::replace_with_deflated_dataset(file_id, dataset_path, 72, original.size(), 6, deflated));
+  H5Fclose(file_id);
+  H5Fclose(writer_id);
+
+  // any reader gets the original bytes back through the filter
+  file_id = H5Fopen(file_name.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+  BOOST_REQUIRE(file_id >= 0);
+  dataset = H5Dopen2(file_id, dataset_path.c_str(), H5P_DEFAULT);
+  space = H5Dget_space(dataset);
+  BOOST_REQUIRE_EQUAL(H5Sget_simple_extent_npoints(space), original.size());
+  BOOST_REQUIRE_EQUAL(H5Dget_storage_size(dataset), deflated.size());
+  std::vector<char> restored(original.size());
+  BOOST_REQUIRE(H5Dread(dataset, H5T_NATIVE_CHAR, H5S_ALL, H5S_ALL, H5P_DEFAULT, restored.data()) >= 0);
+  BOOST_REQUIRE(restored == original);
+  H5Sclose(space);
+  H5Dclose(dataset);
+  H5Fclose(file_id);
+
+  std::filesystem::remove(file_name);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -17,17 +17,22 @@
 #include "confmodel/Session.hpp"
 #include "appmodel/DataStoreConf.hpp"
 #include "detdataformats/DetID.hpp"
+#include "hdf5libs/HDF5RawDataFile.hpp"
 
 #define BOOST_TEST_MODULE HDF5Write_test // NOLINT
 
 #include "boost/test/unit_test.hpp"
 
+#include <atomic>
 #include <cstdlib>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <future>
 #include <iostream>
 #include <memory>
 #include <regex>
+#include <set>
 #include <string>
 #include <utility>
 #include <vector>
@@ -316,6 +321,180 @@ BOOST_AUTO_TEST_CASE(FileSizeLimitResultsInMultipleFiles)
   BOOST_REQUIRE_EQUAL(file_list.size(), 3);
 }
 
+BOOST_AUTO_TEST_CASE(WriteBatches)
+{
+  std::string file_path(std::filesystem::temp_directory_path());
+
+  const int trigger_count = 15;
+  const int batch_count = 5;
+  const int apa_count = 5;
+  const int link_count = 10;
+  const int fragment_size = 10000;
+
+  // 500,000 bytes per TR, so each batch of 5 TRs is 2,500,000 bytes. With files
+  // of 3,000,000 bytes, each batch goes into its own file.
+
+  // delete any pre-existing files so that we start with a clean slate
+  std::string delete_pattern = "hdf5writetest.*\\.hdf5";
+  delete_files_matching_pattern(file_path, delete_pattern);
+
+  // create the DataStore
+  CfgFixture cfg("test-session-5-10");
+  auto data_writer_conf = cfg.modCfg->module<dunedaq::appmodel::DataWriterModule>("dwm-01")->get_configuration();
+  auto data_store_conf = data_writer_conf->get_data_store_params();
+
+  auto data_store_conf_obj = data_store_conf->config_object();
+  data_store_conf_obj.set_by_val<std::string>("directory_path", file_path);
+  data_store_conf_obj.set_by_val<int>("max_file_size", 3000000);
+
+  auto data_store_ptr = make_data_store(data_store_conf->get_type(), data_store_conf->UID(), cfg.modCfg, "dwm-01");
+
+  // write the events in batches
+  for (int first = 1; first <= trigger_count; first += batch_count) {
+    std::vector<dunedaq::daqdataformats::TriggerRecord> batch;
+    batch.reserve(batch_count);
+    for (int trigger_number = first; trigger_number < first + batch_count; ++trigger_number)
+      batch.push_back(create_trigger_record(trigger_number, fragment_size, apa_count * link_count));
+    std::vector<const dunedaq::daqdataformats::TriggerRecord*> records;
+    for (const auto& tr : batch)
+      records.push_back(&tr);
+    BOOST_REQUIRE_EQUAL(data_store_ptr->write_batch(records), batch_count);
+  }
+
+  data_store_ptr.reset(); // explicit destruction
+
+  // check that the expected number of files was created
+  std::string search_pattern = "hdf5writetest.*\\.hdf5";
+  std::vector<std::string> file_list = get_files_matching_pattern(file_path, search_pattern);
+  BOOST_REQUIRE_EQUAL(file_list.size(), 3);
+
+  // clean up the files that were created
+  file_list = delete_files_matching_pattern(file_path, delete_pattern);
+  delete_files_matching_pattern(file_path, "HardwareMap.*\\.txt");
+  BOOST_REQUIRE_EQUAL(file_list.size(), 3);
+}
+
+BOOST_AUTO_TEST_CASE(WriteAsync)
+{
+  std::string file_path(std::filesystem::temp_directory_path());
+
+  const int trigger_count = 5;
+  const int apa_count = 3;
+  const int link_count = 1;
+  const int fragment_size = 10 + sizeof(dunedaq::daqdataformats::FragmentHeader);
+
+  // delete any pre-existing files so that we start with a clean slate
+  std::string delete_pattern = "hdf5writetest.*\\.hdf5";
+  delete_files_matching_pattern(file_path, delete_pattern);
+
+  // create the DataStore
+  CfgFixture cfg("test-session-3-1");
+  auto data_writer_conf = cfg.modCfg->module<dunedaq::appmodel::DataWriterModule>("dwm-01")->get_configuration();
+  auto data_store_conf = data_writer_conf->get_data_store_params();
+
+  auto data_store_conf_obj = data_store_conf->config_object();
+  data_store_conf_obj.set_by_val<std::string>("directory_path", file_path);
+
+  auto data_store_ptr = make_data_store(data_store_conf->get_type(), data_store_conf->UID(), cfg.modCfg, "dwm-01");
+
+  // hand over all the events before waiting for any of them
+  std::atomic<int> completed{ 0 };
+  std::vector<std::future<void>> futures;
+  for (int trigger_number = 1; trigger_number <= trigger_count; ++trigger_number) {
+    auto tr = std::make_shared<const dunedaq::daqdataformats::TriggerRecord>(
+      create_trigger_record(trigger_number, fragment_size, apa_count * link_count));
+    futures.push_back(data_store_ptr->write_async(tr, [&completed](std::exception_ptr problem) {
+      if (!problem)
+        ++completed;
+    }));
+  }
+  for (auto& future : futures)
+    future.get();
+  BOOST_REQUIRE_EQUAL(completed.load(), trigger_count);
+
+  data_store_ptr->wait_for_async_writes();
+  data_store_ptr.reset(); // explicit destruction
+
+  // check that the expected number of files was created
+  std::string search_pattern = "hdf5writetest.*\\.hdf5";
+  std::vector<std::string> file_list = get_files_matching_pattern(file_path, search_pattern);
+  BOOST_REQUIRE_EQUAL(file_list.size(), 1);
+
+  // clean up the files that were created
+  file_list = delete_files_matching_pattern(file_path, delete_pattern);
+  delete_files_matching_pattern(file_path, "HardwareMap.*\\.txt");
+  BOOST_REQUIRE_EQUAL(file_list.size(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(WriteCompressedFragments)
+{
+  std::string file_path(std::filesystem::temp_directory_path());
+
+  const int trigger_count = 3;
+  const int element_count = 3;
+  const int fragment_size = 100000;
+
+  // delete any pre-existing files so that we start with a clean slate
+  std::string delete_pattern = "hdf5writetest.*\\.hdf5";
+  delete_files_matching_pattern(file_path, delete_pattern);
+
+  // create the DataStore, compressing the WIB fragments
+  CfgFixture cfg("test-session-3-1");
+  auto data_writer_conf = cfg.modCfg->module<dunedaq::appmodel::DataWriterModule>("dwm-01")->get_configuration();
+  auto data_store_conf = data_writer_conf->get_data_store_params();
+
+  auto data_store_conf_obj = data_store_conf->config_object();
+  data_store_conf_obj.set_by_val<std::string>("directory_path", file_path);
+  data_store_conf_obj.set_by_val<std::vector<std::string>>("compression_levels", { "WIB:6" });
+  data_store_conf_obj.set_by_val<uint32_t>("compression_threads", 2); // NOLINT(build/unsigned)
+
+  auto data_store_ptr = make_data_store(data_store_conf->get_type(), data_store_conf->UID(), cfg.modCfg, "dwm-01");
+
+  // the first fragment of each record is of a type that is not compressed
+  std::vector<dunedaq::daqdataformats::TriggerRecord> records;
+  for (int trigger_number = 1; trigger_number <= trigger_count; ++trigger_number) {
+    records.push_back(create_trigger_record(trigger_number, fragment_size, element_count));
+    records.back().get_fragments_ref()[0]->set_type(dunedaq::daqdataformats::FragmentType::kTriggerPrimitive);
+    data_store_ptr->write(records.back());
+  }
+
+  data_store_ptr.reset(); // explicit destruction
+
+  std::string search_pattern = "hdf5writetest.*\\.hdf5";
+  std::vector<std::string> file_list = get_files_matching_pattern(file_path, search_pattern);
+  BOOST_REQUIRE_EQUAL(file_list.size(), 1);
+
+  // the compressed fragments are found and read back as the others, through hdf5libs
+  {
+    dunedaq::hdf5libs::HDF5RawDataFile file(file_list[0]);
+    BOOST_REQUIRE_EQUAL(file.get_all_record_ids().size(), trigger_count);
+    for (const auto& record : records) {
+      auto record_id = std::make_pair(record.get_header_ref().get_trigger_number(),
+                                      record.get_header_ref().get_sequence_number());
+
+      std::set<dunedaq::daqdataformats::SourceID> expected_source_ids;
+      for (const auto& fragment : record.get_fragments_ref())
+        expected_source_ids.insert(fragment->get_element_id());
+      auto source_ids = file.get_source_ids(record_id);
+      source_ids.erase(record.get_header_ref().get_element_id());
+      BOOST_REQUIRE(source_ids == expected_source_ids);
+
+      for (const auto& fragment : record.get_fragments_ref()) {
+        auto read_back = file.get_frag_ptr(record_id, fragment->get_element_id());
+        BOOST_REQUIRE_EQUAL(read_back->get_size(), fragment->get_size());
+        BOOST_REQUIRE(read_back->get_fragment_type() == fragment->get_fragment_type());
+        BOOST_REQUIRE_EQUAL(
+          std::memcmp(read_back->get_storage_location(), fragment->get_storage_location(), fragment->get_size()), 0);
+      }
+    }
+  }
+
+  // clean up the files that were created
+  file_list = delete_files_matching_pattern(file_path, delete_pattern);
+  delete_files_matching_pattern(file_path, "HardwareMap.*\\.txt");
+  BOOST_REQUIRE_EQUAL(file_list.size(), 1);
+}
+
 BOOST_AUTO_TEST_CASE(SmallFileSizeLimitDataBlockListWrite)
 {
   std::string file_path(std::filesystem::temp_directory_path());
@@ -39,10 +39,10 @@ BOOST_AUTO_TEST_CASE(Constructors)
   td.trigger_type = 4;
   td.readout_type = dunedaq::dfmessages::ReadoutType::kLocalized;
 
-  AssignedTriggerDecision atd(td, "test");
+  AssignedTriggerDecision atd(td, 5);
 
   BOOST_REQUIRE_EQUAL(atd.decision.trigger_number, td.trigger_number);
-  BOOST_REQUIRE_EQUAL(atd.connection_name, "test");
+  BOOST_REQUIRE_EQUAL(atd.app_id, 5);
 
   // TRBD must have a default constructor so that it can be used in a std::map, but a default-constructed TRBD is
   // invalid.
@@ -80,13 +80,14 @@ BOOST_AUTO_TEST_CASE(Assignments)
   td.readout_type = dunedaq::dfmessages::ReadoutType::kLocalized;
 
   dunedaq::opmonlib::TestOpMonManager opmgr;
-  auto trbd_p = std::make_shared<TriggerRecordBuilderData>("test", 2);
+  auto trbd_p = std::make_shared<TriggerRecordBuilderData>("test", 2, 2, 3);
   opmgr.register_node("trbd", trbd_p);
   BOOST_REQUIRE_EQUAL(trbd_p->used_slots(), 0);
   BOOST_REQUIRE(!trbd_p->is_busy());
 
   auto assignment = trbd_p->make_assignment(td);
-  BOOST_REQUIRE_EQUAL(assignment->connection_name, "test");
+  BOOST_REQUIRE_EQUAL(assignment->app_id, 3);
+  BOOST_REQUIRE_EQUAL(trbd_p->connection_name(), "test");
   trbd_p->add_assignment(assignment);
 
   BOOST_REQUIRE_EQUAL(trbd_p->used_slots(), 1);
@@ -152,7 +153,7 @@ BOOST_AUTO_TEST_CASE(Exceptions)
   BOOST_REQUIRE(!trbd.is_busy());
 
   auto assignment = trbd.make_assignment(td);
-  BOOST_REQUIRE_EQUAL(assignment->connection_name, "test");
+  BOOST_REQUIRE_EQUAL(assignment->app_id, trbd.app_id());
   trbd.add_assignment(assignment);
 
   auto another_assignment = trbd.make_assignment(another_td);
@@ -183,6 +184,156 @@ BOOST_AUTO_TEST_CASE(Exceptions)
     trbd.add_assignment(err_assignment), NoSlotsAvailable, [](NoSlotsAvailable const&) { return true; });
 }
 
+BOOST_AUTO_TEST_CASE(BatchedCompletion)
+{
+  TriggerRecordBuilderData trbd("test", 3, 1);
+
+  for (dunedaq::daqdataformats::trigger_number_t tn = 1; tn <= 3; ++tn) {
+    dunedaq::dfmessages::TriggerDecision td;
+    td.trigger_number = tn;
+    td.run_number = 2;
+    td.trigger_timestamp = tn;
+    td.trigger_type = 4;
+    td.readout_type = dunedaq::dfmessages::ReadoutType::kLocalized;
+    trbd.add_assignment(trbd.make_assignment(td));
+  }
+  BOOST_REQUIRE_EQUAL(trbd.used_slots(), 3);
+  BOOST_REQUIRE(trbd.is_busy());
+
+  // trigger number 7 was never assigned, it is reported and skipped
+  std::vector<std::shared_ptr<AssignedTriggerDecision>> completed;
+  trbd.complete_assignments({ 1, 3, 7 }, completed);
+  BOOST_REQUIRE_EQUAL(completed.size(), 2);
+  BOOST_REQUIRE_EQUAL(completed.front()->decision.trigger_number, 1);
+  BOOST_REQUIRE_EQUAL(completed.back()->decision.trigger_number, 3);
+  BOOST_REQUIRE_EQUAL(trbd.used_slots(), 1);
+  BOOST_REQUIRE(!trbd.is_busy());
+  BOOST_REQUIRE(trbd.get_assignment(2) != nullptr);
+
+  trbd.complete_assignments({}, completed);
+  BOOST_REQUIRE(completed.empty());
+}
+
+BOOST_AUTO_TEST_CASE(Occupancy)
+{
+  auto occupancy = std::make_shared<DataflowOccupancy>();
+  TriggerRecordBuilderData trbd("test", 2, 1);
+  TriggerRecordBuilderData other("other", 2, 1);
+  trbd.set_occupancy(occupancy);
+  other.set_occupancy(occupancy);
+
+  BOOST_REQUIRE_EQUAL(occupancy->used_slots.load(), 0);
+  BOOST_REQUIRE_EQUAL(occupancy->available_apps.load(), 2);
+  BOOST_REQUIRE_EQUAL(occupancy->apps_in_error.load(), 0);
+  BOOST_REQUIRE_EQUAL(trbd.free_slots(), 2);
+
+  dunedaq::dfmessages::TriggerDecision td;
+  td.trigger_number = 1;
+  td.run_number = 2;
+  td.trigger_type = 4;
+  trbd.add_assignment(trbd.make_assignment(td));
+  td.trigger_number = 2;
+  trbd.add_assignment(trbd.make_assignment(td));
+
+  BOOST_REQUIRE_EQUAL(occupancy->used_slots.load(), 2);
+  BOOST_REQUIRE_EQUAL(occupancy->available_apps.load(), 1);
+  BOOST_REQUIRE_EQUAL(trbd.free_slots(), 0);
+
+  other.set_in_error(true);
+  BOOST_REQUIRE_EQUAL(occupancy->available_apps.load(), 0);
+  BOOST_REQUIRE_EQUAL(occupancy->apps_in_error.load(), 1);
+
+  trbd.complete_assignment(1);
+  trbd.complete_assignment(2);
+  BOOST_REQUIRE_EQUAL(occupancy->used_slots.load(), 0);
+  BOOST_REQUIRE_EQUAL(occupancy->available_apps.load(), 1);
+
+  other.flush();
+  BOOST_REQUIRE_EQUAL(occupancy->available_apps.load(), 2);
+  BOOST_REQUIRE_EQUAL(occupancy->apps_in_error.load(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(StaleReclaim)
+{
+  auto occupancy = std::make_shared<DataflowOccupancy>();
+  TriggerRecordBuilderData trbd("test", 3, 1);
+  trbd.set_occupancy(occupancy);
+
+  auto now = std::chrono::steady_clock::now();
+  for (dunedaq::daqdataformats::trigger_number_t tn = 1; tn <= 3; ++tn) {
+    dunedaq::dfmessages::TriggerDecision td;
+    td.trigger_number = tn;
+    td.run_number = 2;
+    td.trigger_type = 4;
+    auto assignment = trbd.make_assignment(td);
+    // trigger 1 and 2 were assigned a long time ago
+    assignment->assigned_time = now - std::chrono::seconds(tn < 3 ? 10 : 0);
+    trbd.add_assignment(assignment);
+  }
+  BOOST_REQUIRE(trbd.is_busy());
+
+  std::vector<std::shared_ptr<AssignedTriggerDecision>> reclaimed;
+  trbd.reclaim_stale_assignments(reclaimed, std::chrono::seconds(5), now);
+  BOOST_REQUIRE_EQUAL(reclaimed.size(), 2);
+  BOOST_REQUIRE_EQUAL(reclaimed.front()->decision.trigger_number, 1);
+  BOOST_REQUIRE_EQUAL(trbd.used_slots(), 1);
+  BOOST_REQUIRE_EQUAL(occupancy->used_slots.load(), 1);
+  BOOST_REQUIRE(!trbd.is_busy());
+  trbd.reclaim_stale_assignments(reclaimed, std::chrono::seconds(5), now);
+  BOOST_REQUIRE(reclaimed.empty());
+
+  // late tokens are recognised once, unknown trigger numbers are still errors
+  BOOST_REQUIRE(trbd.complete_assignment(1) == nullptr);
+  BOOST_REQUIRE_EXCEPTION(trbd.complete_assignment(1),
+                          AssignedTriggerDecisionNotFound,
+                          [](AssignedTriggerDecisionNotFound const&) { return true; });
+  std::vector<std::shared_ptr<AssignedTriggerDecision>> completed;
+  trbd.complete_assignments({ 2, 3 }, completed);
+  BOOST_REQUIRE_EQUAL(completed.size(), 1);
+  BOOST_REQUIRE_EQUAL(trbd.used_slots(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(Health)
+{
+  auto occupancy = std::make_shared<DataflowOccupancy>();
+  TriggerRecordBuilderData trbd("test", 4, 2);
+  trbd.set_occupancy(occupancy);
 
+  dunedaq::dfmessages::TriggerDecision td;
+  td.run_number = 2;
+  td.trigger_type = 4;
+  for (dunedaq::daqdataformats::trigger_number_t tn = 1; tn <= 2; ++tn) {
+    td.trigger_number = tn;
+    trbd.add_assignment(trbd.make_assignment(td));
+  }
+  BOOST_REQUIRE(!trbd.is_busy());
+  BOOST_REQUIRE_EQUAL(trbd.capacity(), 4);
+
+  // a degraded application gets half of its slots
+  trbd.set_health(TriggerRecordBuilderData::Health::kDegraded, 2.5);
+  BOOST_REQUIRE(trbd.is_busy());
+  BOOST_REQUIRE_EQUAL(trbd.capacity(), 2);
+  BOOST_REQUIRE_EQUAL(trbd.health_score(), 2.5);
+  BOOST_REQUIRE_EQUAL(occupancy->available_apps.load(), 0);
+
+  // a quarantined application stays busy whatever its occupancy
+  trbd.set_health(TriggerRecordBuilderData::Health::kQuarantined, 6.);
+  trbd.complete_assignment(1);
+  trbd.complete_assignment(2);
+  BOOST_REQUIRE(trbd.is_quarantined());
+  BOOST_REQUIRE(trbd.is_busy());
+  BOOST_REQUIRE_EQUAL(trbd.capacity(), 0);
+  BOOST_REQUIRE_EQUAL(occupancy->available_apps.load(), 0);
+
+  trbd.set_health(TriggerRecordBuilderData::Health::kHealthy, 1.);
+  BOOST_REQUIRE(!trbd.is_busy());
+  BOOST_REQUIRE_EQUAL(occupancy->available_apps.load(), 1);
+
+  // the completion latencies are available for the scoring
+  auto since = std::chrono::steady_clock::now() - std::chrono::seconds(10);
+  BOOST_REQUIRE(trbd.latency_percentile(0.9, since, 2));
+  BOOST_REQUIRE(!trbd.latency_percentile(0.9, since, 3));
+  BOOST_REQUIRE(!trbd.latency_percentile(0.9, std::chrono::steady_clock::now() + std::chrono::seconds(1)));
+}
 
 BOOST_AUTO_TEST_SUITE_END()